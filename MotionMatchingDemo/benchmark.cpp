@@ -0,0 +1,123 @@
+// Loads lafan01/database.bin, builds the matching features with the
+// same weights as controller.cpp and compares the search structures
+// that aren't used by the controller on random queries. The HNSW
+// graph is built offline here and saved next to the database as
+// database_hnsw.bin, where it is loaded from on the next run.
+//
+//     benchmark [database file]
+//
+// By default it reads ./lafan01/database.bin like controller.cpp.
+
+#if !defined(_restrict)
+#define _restrict __restrict
+#endif
+
+#include "common.h"
+#include "vec.h"
+#include "quat.h"
+#include "array.h"
+#include "character.h"
+#include "database.h"
+#include "database_hierarchy.h"
+#include "database_quantized.h"
+#include "database_pca.h"
+#include "database_cluster.h"
+#include "database_hnsw.h"
+
+#include <chrono>
+#include <string>
+
+//--------------------------------------
+
+int main(int argc, char** argv)
+{
+    const char* input = argc > 1 ? argv[1] : "./lafan01/database.bin";
+
+    FILE* f = fopen(input, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Failed to open \"%s\" for reading\n", input);
+        return 1;
+    }
+    fclose(f);
+
+    database db;
+    database_load(db, input);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    database_build_matching_features(db, 0.75f, 1.0f, 1.0f, 1.0f, 1.5f);
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+
+    printf("Built %i features for %i frames of \"%s\" in %.1f ms\n",
+        db.nfeatures(), db.nframes(), input,
+        std::chrono::duration<double, std::milli>(end_time - start_time).count());
+
+    // Changing a single weight, and back again which only differs from
+    // the features built above by rounding
+
+    start_time = std::chrono::high_resolution_clock::now();
+
+    database_rebuild_feature_group(db, FEATURE_GROUP_FOOT_POSITION, 1.0f);
+    database_rebuild_feature_group(db, FEATURE_GROUP_FOOT_POSITION, 0.75f);
+
+    end_time = std::chrono::high_resolution_clock::now();
+
+    printf("Changed the weight of one feature group in %.1f ms\n",
+        std::chrono::duration<double, std::milli>(end_time - start_time).count() / 2);
+
+    // Hierarchies of boxes
+
+    printf("\n");
+    database_benchmark_hierarchies(db);
+
+    // Quantized features
+
+    quantized_index quantized;
+    quantized_index_build(quantized, db);
+
+    printf("\n");
+    database_benchmark_quantized(db, quantized);
+
+    // Reduced dimensions
+
+    printf("\n");
+    database_benchmark_pca(db);
+
+    // Clusters
+
+    printf("\n");
+    database_benchmark_clusters(db);
+
+    // Graph, only built when there is no up to date one saved
+
+    std::string hnsw_file = input;
+    size_t separator = hnsw_file.find_last_of("/\\");
+    hnsw_file = (separator == std::string::npos ? std::string() : hnsw_file.substr(0, separator + 1)) + "database_hnsw.bin";
+
+    hnsw_index hnsw;
+
+    printf("\n");
+    if (hnsw_index_load(hnsw, db, hnsw_file.c_str()))
+    {
+        printf("Loaded \"%s\"\n", hnsw_file.c_str());
+    }
+    else
+    {
+        start_time = std::chrono::high_resolution_clock::now();
+
+        hnsw_index_build(hnsw, db);
+
+        end_time = std::chrono::high_resolution_clock::now();
+
+        hnsw_index_save(hnsw, db, hnsw_file.c_str());
+
+        printf("Built and saved \"%s\" in %.1f ms\n", hnsw_file.c_str(),
+            std::chrono::duration<double, std::milli>(end_time - start_time).count());
+    }
+
+    database_benchmark_hnsw(db, hnsw);
+
+    return 0;
+}
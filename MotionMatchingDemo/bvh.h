@@ -0,0 +1,271 @@
+#pragma once
+
+#include "vec.h"
+#include "array.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+//--------------------------------------
+
+// Animation data loaded from a BVH file, the same as what
+// lafan01/bvh.py returns
+/*
+    names     : 每个bone的名字
+    parents   : 每个bone的父bone序号，root为-1
+    offsets   : 每个bone相对父bone的偏移，单位和文件相同(lafan01为cm)
+    positions : [Frames, Bones]，每帧每个bone的局部位置，没有位置通道的bone为offsets
+    rotations : [Frames, Bones]，每帧每个bone的欧拉角，单位为度，顺序见order
+    order     : 欧拉角的轴顺序，例如"zyx"，取自第一个有旋转通道的bone
+*/
+struct bvh
+{
+    std::vector<std::string> names;
+    array1d<int> parents;
+    array1d<vec3> offsets;
+    array2d<vec3> positions;
+    array2d<vec3> rotations;
+    char order[4];
+    float frame_time;
+
+    int nframes() const { return positions.rows; }
+    int nbones() const { return positions.cols; }
+
+    int bone_index(const char* name) const
+    {
+        for (int i = 0; i < (int)names.size(); i++)
+        {
+            if (names[i] == name) { return i; }
+        }
+        return -1;
+    }
+};
+
+static inline const char* bvh_skip_space(const char* s)
+{
+    while (*s == ' ' || *s == '\t') { s++; }
+    return s;
+}
+
+// Returns the text after `keyword` if the line starts with it
+static inline const char* bvh_match(const char* line, const char* keyword)
+{
+    size_t len = strlen(keyword);
+    return strncmp(line, keyword, len) == 0 ? line + len : NULL;
+}
+
+static inline std::string bvh_read_name(const char* s)
+{
+    s = bvh_skip_space(s);
+    const char* e = s;
+    while (*e == '_' || (*e >= '0' && *e <= '9') || (*e >= 'a' && *e <= 'z') || (*e >= 'A' && *e <= 'Z')) { e++; }
+    return std::string(s, e - s);
+}
+
+static inline void bvh_add_bone(bvh& data, int& active, const std::string& name)
+{
+    int nbones = (int)data.names.size();
+
+    data.names.push_back(name);
+    data.parents.resize(nbones + 1);
+    data.offsets.resize(nbones + 1);
+    data.parents(nbones) = active;
+    data.offsets(nbones) = vec3();
+    active = nbones;
+}
+
+// Parse a BVH file line by line in the same way as bvh.py.
+// Returns false if the file can't be read or the data is
+// in a layout that bvh.py doesn't support either.
+bool bvh_load(bvh& data, const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { return false; }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    std::vector<char> text(size + 1);
+    size_t num = fread(text.data(), 1, size, f);
+    fclose(f);
+    if ((long)num != size) { return false; }
+    text[size] = '\0';
+
+    data.names.clear();
+    data.parents.resize(0);
+    data.offsets.resize(0);
+    data.positions.resize(0, 0);
+    data.rotations.resize(0, 0);
+    data.order[0] = '\0';
+    data.frame_time = 0.0f;
+
+    int active = -1;
+    bool end_site = false;
+    int channels = 0;
+    int frame = 0;
+    std::vector<float> values;
+
+    char* line = text.data();
+    while (line != NULL && *line != '\0')
+    {
+        char* next = strchr(line, '\n');
+        if (next != NULL) { *next++ = '\0'; }
+
+        const char* raw = line;
+        const char* l = bvh_skip_space(raw);
+        const char* m;
+        line = next;
+
+        if (strstr(l, "HIERARCHY") != NULL || strstr(l, "MOTION") != NULL) { continue; }
+
+        // Like bvh.py, ROOT must be at the very start of the line
+        if ((m = bvh_match(raw, "ROOT ")) != NULL)
+        {
+            bvh_add_bone(data, active, bvh_read_name(m));
+            continue;
+        }
+
+        if (strchr(l, '{') != NULL) { continue; }
+
+        if (strchr(l, '}') != NULL)
+        {
+            if (end_site)
+            {
+                end_site = false;
+            }
+            else
+            {
+                active = data.parents(active);
+            }
+            continue;
+        }
+
+        if ((m = bvh_match(l, "OFFSET")) != NULL)
+        {
+            vec3 offset;
+            if (sscanf(m, "%f %f %f", &offset.x, &offset.y, &offset.z) == 3 && !end_site)
+            {
+                data.offsets(active) = offset;
+            }
+            continue;
+        }
+
+        if ((m = bvh_match(l, "CHANNELS")) != NULL)
+        {
+            channels = atoi(m);
+
+            // Euler order comes from the first bone with rotation channels
+            if (data.order[0] == '\0')
+            {
+                char parts[9][32];
+                int nparts = sscanf(m, "%*d %31s %31s %31s %31s %31s %31s %31s %31s %31s",
+                    parts[0], parts[1], parts[2], parts[3], parts[4], parts[5], parts[6], parts[7], parts[8]);
+
+                int start = channels == 3 ? 0 : 3;
+                bool valid = nparts >= start + 3;
+                char order[4] = {};
+
+                for (int i = 0; valid && i < 3; i++)
+                {
+                    const char* p = parts[start + i];
+                    valid = strlen(p) == 9 && strcmp(p + 1, "rotation") == 0 && p[0] >= 'X' && p[0] <= 'Z';
+                    order[i] = p[0] - 'X' + 'x';
+                }
+
+                if (valid) { memcpy(data.order, order, sizeof(order)); }
+            }
+            continue;
+        }
+
+        if ((m = bvh_match(l, "JOINT ")) != NULL)
+        {
+            bvh_add_bone(data, active, bvh_read_name(m));
+            continue;
+        }
+
+        if (strstr(l, "End Site") != NULL)
+        {
+            end_site = true;
+            continue;
+        }
+
+        if ((m = bvh_match(l, "Frames:")) != NULL)
+        {
+            int nframes = atoi(m);
+            int nbones = (int)data.names.size();
+
+            data.positions.resize(nframes, nbones);
+            data.rotations.resize(nframes, nbones);
+            for (int i = 0; i < nframes; i++)
+            {
+                for (int j = 0; j < nbones; j++)
+                {
+                    data.positions(i, j) = data.offsets(j);
+                    data.rotations(i, j) = vec3();
+                }
+            }
+            continue;
+        }
+
+        if ((m = bvh_match(l, "Frame Time:")) != NULL)
+        {
+            data.frame_time = (float)atof(m);
+            continue;
+        }
+
+        if (*l == '\0' || *l == '\r') { continue; }
+
+        // Frame data
+        values.clear();
+        char* end;
+        for (const char* s = l; ; s = end)
+        {
+            float v = strtof(s, &end);
+            if (end == s) { break; }
+            values.push_back(v);
+        }
+
+        int nbones = data.nbones();
+        if (frame >= data.nframes()) { return false; }
+
+        if (channels == 3 && (int)values.size() == 3 + nbones * 3)
+        {
+            data.positions(frame, 0) = vec3(values[0], values[1], values[2]);
+            for (int j = 0; j < nbones; j++)
+            {
+                data.rotations(frame, j) = vec3(values[3 + j*3 + 0], values[3 + j*3 + 1], values[3 + j*3 + 2]);
+            }
+        }
+        else if (channels == 6 && (int)values.size() == nbones * 6)
+        {
+            for (int j = 0; j < nbones; j++)
+            {
+                data.positions(frame, j) = vec3(values[j*6 + 0], values[j*6 + 1], values[j*6 + 2]);
+                data.rotations(frame, j) = vec3(values[j*6 + 3], values[j*6 + 4], values[j*6 + 5]);
+            }
+        }
+        else if (channels == 9 && (int)values.size() == 3 + (nbones - 1) * 9)
+        {
+            data.positions(frame, 0) = vec3(values[0], values[1], values[2]);
+            for (int j = 1; j < nbones; j++)
+            {
+                const float* v = &values[3 + (j - 1) * 9];
+                data.rotations(frame, j) = vec3(v[3], v[4], v[5]);
+                data.positions(frame, j) = data.positions(frame, j) + vec3(v[0], v[1], v[2]) * vec3(v[6], v[7], v[8]);
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        frame++;
+    }
+
+    return data.order[0] != '\0' && frame == data.nframes();
+}
@@ -0,0 +1,443 @@
+#pragma once
+
+#include "array.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#elif !defined(_WINDOWS_)
+// windows.h clashes with raylib (CloseWindow, Rectangle, DrawText...)
+// so only the few functions needed for mapping files are declared
+extern "C"
+{
+    __declspec(dllimport) void* __stdcall CreateFileA(const char*, unsigned long, unsigned long, void*, unsigned long, unsigned long, void*);
+    __declspec(dllimport) void* __stdcall CreateFileMappingA(void*, void*, unsigned long, unsigned long, unsigned long, const char*);
+    __declspec(dllimport) void* __stdcall MapViewOfFile(void*, unsigned long, unsigned long, unsigned long, size_t);
+    __declspec(dllimport) int __stdcall UnmapViewOfFile(const void*);
+    __declspec(dllimport) unsigned long __stdcall GetFileSize(void*, unsigned long*);
+    __declspec(dllimport) int __stdcall CloseHandle(void*);
+    __declspec(dllimport) int __stdcall MoveFileExA(const char*, const char*, unsigned long);
+}
+#endif
+
+//--------------------------------------
+
+// A simple file format for storing named arrays so that they can be
+// used straight from a memory mapping of the file without any copy.
+// The file starts with a header and a table of contents, both made of
+// 64 byte records, followed by the data of each array starting at a
+// multiple of 64 bytes from the start of the file:
+//
+//     container_header
+//     container_entry * nentries
+//     data of array 0, padded to 64 bytes
+//     data of array 1, padded to 64 bytes
+//     ...
+//
+// Because the data is never copied, several processes mapping the
+// same file share the same physical pages, using mmap on POSIX and
+// MapViewOfFile on Windows. Containers are written to a temporary file
+// which is renamed over the target at the end, so a process mapping
+// the old file never sees it truncated or half written.
+
+enum
+{
+    CONTAINER_ALIGNMENT = 64,
+    CONTAINER_NAME_MAX = 32,
+    CONTAINER_ENTRIES_MAX = 64,
+    CONTAINER_PATH_MAX = 1024,
+};
+
+struct container_header
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int nentries;
+    unsigned int reserved0;
+    unsigned long long file_size;
+    unsigned char reserved1[40];
+};
+
+struct container_entry
+{
+    char name[CONTAINER_NAME_MAX];
+    unsigned int element_size;
+    int rows;
+    int cols;
+    unsigned int reserved;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+static_assert(sizeof(container_header) == CONTAINER_ALIGNMENT, "container_header must be 64 bytes");
+static_assert(sizeof(container_entry) == CONTAINER_ALIGNMENT, "container_entry must be 64 bytes");
+
+//--------------------------------------
+
+// A container file mapped into memory
+/*
+    data     : 文件内容的起始地址，按64字节对齐
+    size     : 文件大小
+*/
+struct container_mapping
+{
+    void* data;
+    size_t size;
+
+    container_mapping() : data(NULL), size(0) {}
+};
+
+static inline const container_header* container_get_header(const container_mapping& m)
+{
+    return (const container_header*)m.data;
+}
+
+static inline const container_entry* container_get_entries(const container_mapping& m)
+{
+    return (const container_entry*)((const char*)m.data + sizeof(container_header));
+}
+
+void container_unmap(container_mapping& m)
+{
+    if (m.data == NULL) { return; }
+
+#if !defined(_WIN32)
+    munmap(m.data, m.size);
+#else
+    UnmapViewOfFile(m.data);
+#endif
+
+    m.data = NULL;
+    m.size = 0;
+}
+
+// Map a container file checking its header and table of contents.
+// Returns false if the file does not exist or is not a valid
+// container with the given magic and version. When `writable` is
+// true the mapping is private and copy-on-write, so the data can be
+// modified in memory without changing the file, at the cost of the
+// modified pages no longer being shared.
+bool container_map(
+    container_mapping& m,
+    const char* filename,
+    const unsigned int magic,
+    const unsigned int version,
+    const bool writable = false)
+{
+    container_unmap(m);
+
+#if !defined(_WIN32)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(container_header))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = writable ?
+        mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+        mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) { return false; }
+
+    m.data = data;
+    m.size = (size_t)st.st_size;
+#else
+    const unsigned long generic_read = 0x80000000;
+    const unsigned long file_share_read = 0x00000001;
+    const unsigned long open_existing = 3;
+    const unsigned long file_attribute_normal = 0x00000080;
+    const unsigned long page_readonly = 0x02;
+    const unsigned long page_writecopy = 0x08;
+    const unsigned long file_map_read = 0x0004;
+    const unsigned long file_map_copy = 0x0001;
+    void* const invalid_handle_value = (void*)(long long)-1;
+
+    void* file = CreateFileA(filename, generic_read, file_share_read, NULL, open_existing, file_attribute_normal, NULL);
+    if (file == invalid_handle_value) { return false; }
+
+    unsigned long size_high = 0;
+    unsigned long size_low = GetFileSize(file, &size_high);
+    unsigned long long size = ((unsigned long long)size_high << 32) | size_low;
+
+    if (size_low == 0xFFFFFFFF || size < sizeof(container_header))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The view keeps the file mapped after the handles are closed
+    void* mapping = CreateFileMappingA(file, NULL, writable ? page_writecopy : page_readonly, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) { return false; }
+
+    void* data = MapViewOfFile(mapping, writable ? file_map_copy : file_map_read, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL) { return false; }
+
+    m.data = data;
+    m.size = (size_t)size;
+#endif
+
+    // Check header and that every entry lies inside the file
+    const container_header* header = container_get_header(m);
+
+    bool valid =
+        header->magic == magic &&
+        header->version == version &&
+        header->file_size == m.size &&
+        header->nentries <= CONTAINER_ENTRIES_MAX &&
+        sizeof(container_header) + header->nentries * sizeof(container_entry) <= m.size;
+
+    for (unsigned int e = 0; valid && e < header->nentries; e++)
+    {
+        const container_entry& entry = container_get_entries(m)[e];
+
+        valid =
+            entry.name[CONTAINER_NAME_MAX - 1] == '\0' &&
+            entry.offset % CONTAINER_ALIGNMENT == 0 &&
+            entry.rows >= 0 && entry.cols >= 0 &&
+            entry.size == (unsigned long long)entry.element_size * entry.rows * entry.cols &&
+            entry.offset + entry.size <= m.size;
+    }
+
+    if (!valid)
+    {
+        container_unmap(m);
+        return false;
+    }
+
+    return true;
+}
+
+// Returns true if `filename` exists and was modified no earlier than
+// `source`, for checking a container made from another file is not stale
+bool container_is_newer(const char* filename, const char* source)
+{
+    struct stat st_file;
+    struct stat st_source;
+    if (stat(filename, &st_file) != 0) { return false; }
+    if (stat(source, &st_source) != 0) { return true; }
+    return st_file.st_mtime >= st_source.st_mtime;
+}
+
+static inline const container_entry* container_find(
+    const container_mapping& m,
+    const char* name,
+    const unsigned int element_size)
+{
+    const container_header* header = container_get_header(m);
+
+    for (unsigned int e = 0; e < header->nentries; e++)
+    {
+        const container_entry& entry = container_get_entries(m)[e];
+        if (strcmp(entry.name, name) == 0)
+        {
+            return entry.element_size == element_size ? &entry : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// Point an array at data inside the mapping. The array does not own
+// the data, so it must not be resized, and it must be released with
+// container_release_array before the mapping is unmapped. Unless the
+// container was mapped as writable the data is read only so writing
+// to the array will crash.
+template<typename T>
+bool container_view_array1d(array1d<T>& arr, const container_mapping& m, const char* name)
+{
+    const container_entry* entry = container_find(m, name, sizeof(T));
+    if (entry == NULL || entry->rows != 1) { return false; }
+
+    arr.resize(0);
+    arr.size = entry->cols;
+    arr.data = entry->cols > 0 ? (T*)((char*)m.data + entry->offset) : NULL;
+    return true;
+}
+
+template<typename T>
+bool container_view_array2d(array2d<T>& arr, const container_mapping& m, const char* name)
+{
+    const container_entry* entry = container_find(m, name, sizeof(T));
+    if (entry == NULL) { return false; }
+
+    arr.resize(0, 0);
+    arr.rows = entry->rows;
+    arr.cols = entry->cols;
+    arr.data = entry->rows * entry->cols > 0 ? (T*)((char*)m.data + entry->offset) : NULL;
+    return true;
+}
+
+// Detach an array from a mapping without freeing the data
+template<typename T>
+void container_release_array(array1d<T>& arr)
+{
+    arr.size = 0;
+    arr.data = NULL;
+}
+
+template<typename T>
+void container_release_array(array2d<T>& arr)
+{
+    arr.rows = 0;
+    arr.cols = 0;
+    arr.data = NULL;
+}
+
+//--------------------------------------
+
+// Writes a container to `<filename>.tmp`. The header and table of
+// contents are written last, once the offset of every array is known,
+// and then the file is renamed to `filename`.
+/*
+    failed   : 有任何写入失败时为true，container_write_end会删除临时文件并返回false
+*/
+struct container_writer
+{
+    FILE* f;
+    char filename[CONTAINER_PATH_MAX];
+    char temp_filename[CONTAINER_PATH_MAX];
+    bool failed;
+    unsigned int magic;
+    unsigned int version;
+    unsigned int nentries;
+    unsigned int nentries_max;
+    unsigned long long offset;
+    container_entry entries[CONTAINER_ENTRIES_MAX];
+};
+
+static inline void container_write_padding(container_writer& w)
+{
+    static const char zeros[CONTAINER_ALIGNMENT] = {};
+
+    unsigned long long padding = (CONTAINER_ALIGNMENT - w.offset % CONTAINER_ALIGNMENT) % CONTAINER_ALIGNMENT;
+    if (fwrite(zeros, 1, (size_t)padding, w.f) != padding) { w.failed = true; }
+    w.offset += padding;
+}
+
+// Start writing a container which will hold at most `nentries_max` arrays
+bool container_write_begin(
+    container_writer& w,
+    const char* filename,
+    const unsigned int magic,
+    const unsigned int version,
+    const unsigned int nentries_max)
+{
+    assert(nentries_max <= CONTAINER_ENTRIES_MAX);
+
+    w.f = NULL;
+    if (strlen(filename) + 5 > CONTAINER_PATH_MAX) { return false; }
+    strcpy(w.filename, filename);
+    strcpy(w.temp_filename, filename);
+    strcat(w.temp_filename, ".tmp");
+
+    w.f = fopen(w.temp_filename, "wb");
+    if (w.f == NULL) { return false; }
+
+    w.failed = false;
+
+    w.magic = magic;
+    w.version = version;
+    w.nentries = 0;
+    w.nentries_max = nentries_max;
+    memset(w.entries, 0, sizeof(w.entries));
+
+    // Leave space for header and table of contents
+    w.offset = sizeof(container_header) + nentries_max * sizeof(container_entry);
+    if (fseek(w.f, (long)w.offset, SEEK_SET) != 0) { w.failed = true; }
+    container_write_padding(w);
+
+    return true;
+}
+
+void container_write(
+    container_writer& w,
+    const char* name,
+    const void* data,
+    const unsigned int element_size,
+    const int rows,
+    const int cols)
+{
+    assert(w.nentries < w.nentries_max);
+    assert(strlen(name) < CONTAINER_NAME_MAX);
+
+    container_entry& entry = w.entries[w.nentries];
+    strncpy(entry.name, name, CONTAINER_NAME_MAX - 1);
+    entry.element_size = element_size;
+    entry.rows = rows;
+    entry.cols = cols;
+    entry.offset = w.offset;
+    entry.size = (unsigned long long)element_size * rows * cols;
+    w.nentries++;
+
+    if (fwrite(data, 1, (size_t)entry.size, w.f) != entry.size) { w.failed = true; }
+    w.offset += entry.size;
+
+    container_write_padding(w);
+}
+
+template<typename T>
+void container_write_array1d(container_writer& w, const char* name, const array1d<T>& arr)
+{
+    container_write(w, name, arr.data, sizeof(T), 1, arr.size);
+}
+
+template<typename T>
+void container_write_array2d(container_writer& w, const char* name, const array2d<T>& arr)
+{
+    container_write(w, name, arr.data, sizeof(T), arr.rows, arr.cols);
+}
+
+// Finish writing and replace `filename` with the new container. Returns
+// false, leaving any existing file untouched, if anything failed.
+bool container_write_end(container_writer& w)
+{
+    container_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = w.magic;
+    header.version = w.version;
+    header.nentries = w.nentries;
+    header.file_size = w.offset;
+
+    if (fseek(w.f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, w.f) != 1 ||
+        fwrite(w.entries, sizeof(container_entry), w.nentries, w.f) != w.nentries)
+    {
+        w.failed = true;
+    }
+
+    if (fclose(w.f) != 0) { w.failed = true; }
+    w.f = NULL;
+
+    // Renaming is atomic, so processes which have the old file mapped
+    // keep their pages and new processes see the complete new file
+#if !defined(_WIN32)
+    if (!w.failed && rename(w.temp_filename, w.filename) != 0) { w.failed = true; }
+#else
+    // Fails while another process has the old file mapped
+    const unsigned long movefile_replace_existing = 0x00000001;
+    if (!w.failed && !MoveFileExA(w.temp_filename, w.filename, movefile_replace_existing)) { w.failed = true; }
+#endif
+
+    if (w.failed)
+    {
+        remove(w.temp_filename);
+        return false;
+    }
+
+    return true;
+}
@@ -13,6 +13,7 @@ extern "C"
 #include "array.h"
 #include "character.h"
 #include "database.h"
+#include "database_compressed.h"
 
 #include <initializer_list>
 
@@ -1257,6 +1258,33 @@ quat clamp_character_rotation(
 
 //--------------------------------------
 
+// Sample the local rotations and angular velocities of a database
+// frame, decoding them when the compressed poses are in use
+void sample_bone_rotations(
+    slice1d<quat> bone_rotations,
+    slice1d<vec3> bone_angular_velocities,
+    const database& db,
+    const compressed_poses& poses,
+    const bool compressed,
+    const int frame)
+{
+    if (compressed)
+    {
+        compressed_poses_decode_rotations(bone_rotations, poses, frame);
+        compressed_poses_decode_angular_velocities(bone_angular_velocities, poses, frame);
+    }
+    else
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            bone_rotations(j) = db.bone_rotations(frame, j);
+            bone_angular_velocities(j) = db.bone_angular_velocities(frame, j);
+        }
+    }
+}
+
+//--------------------------------------
+
 int main(void)
 {
     // Init Window
@@ -1316,32 +1344,76 @@ int main(void)
     // Load Animation Data and build Matching Database
     
     database db;
-    database_load(db, "./lafan01/database.bin");
     
+    // Map the container written alongside the database when it is up to
+    // date, otherwise load database.bin and write the container for next time
+    if (!container_is_newer("./lafan01/database.mmdb", "./lafan01/database.bin") ||
+        !database_load_mapped(db, "./lafan01/database.mmdb"))
+    {
+        database_load(db, "./lafan01/database.bin");
+        if (!database_save_mapped(db, "./lafan01/database.mmdb"))
+        {
+            printf("Failed to write ./lafan01/database.mmdb\n");
+        }
+    }
+    
+    // Features are built with unit weights and weighted at search
+    // time so the weights can be changed without a rebuild
     float feature_weight_foot_position = 0.75f;
     float feature_weight_foot_velocity = 1.0f;
     float feature_weight_hip_velocity = 1.0f;
     float feature_weight_trajectory_positions = 1.0f;
     float feature_weight_trajectory_directions = 1.5f;
     
-    database_build_matching_features(
-        db,
-        feature_weight_foot_position,
-        feature_weight_foot_velocity,
-        feature_weight_hip_velocity,
-        feature_weight_trajectory_positions,
-        feature_weight_trajectory_directions);
+    array1d<float> feature_weights(FEATURE_GROUP_COUNT);
+    feature_weights(FEATURE_GROUP_FOOT_POSITION) = feature_weight_foot_position;
+    feature_weights(FEATURE_GROUP_FOOT_VELOCITY) = feature_weight_foot_velocity;
+    feature_weights(FEATURE_GROUP_HIP_VELOCITY) = feature_weight_hip_velocity;
+    feature_weights(FEATURE_GROUP_TRAJECTORY_POSITIONS) = feature_weight_trajectory_positions;
+    feature_weights(FEATURE_GROUP_TRAJECTORY_DIRECTIONS) = feature_weight_trajectory_directions;
+    
+    // Features and bounds are loaded from the cache when it was built
+    // from the same animation data and weights, otherwise rebuilt. The
+    // order features are visited in by the search is built from the
+    // weights used at search time and saved in the cache with them.
+    if (database_build_matching_features_cached(db, "./lafan01/database_features.mmdb", 
+        1.0f, 1.0f, 1.0f, 1.0f, 1.0f, false, feature_weights.data) ==
+        DATABASE_FEATURES_CACHE_SAVE_FAILED)
+    {
+        printf("Failed to write ./lafan01/database_features.mmdb\n");
+    }
    
     // Pose & Inertializer Data
     
     int frame_index = db.range_starts(0);
     float inertialize_blending_halflife = 0.1f;
 
-    array1d<vec3> bone_positions = db.bone_positions(frame_index);                    //当前Character Entity的骨骼位置信息，bone_position(0)即Entity的位置信息
-    array1d<vec3> bone_velocities = db.bone_velocities(frame_index);                  // 同上，Entity的骨骼速度信息
+    array1d<vec3> bone_positions(db.nbones());                                        //当前Character Entity的骨骼位置信息，bone_position(0)即Entity的位置信息
+    array1d<vec3> bone_velocities(db.nbones());                                       // 同上，Entity的骨骼速度信息
     array1d<quat> bone_rotations = db.bone_rotations(frame_index);                    // 同上，Entity的骨骼旋转信息
     array1d<vec3> bone_angular_velocities = db.bone_angular_velocities(frame_index);  // 同上，Entity的骨骼旋转速度信息
     
+    database_sample_bone_positions(bone_positions, db, frame_index);
+    database_sample_bone_velocities(bone_velocities, db, frame_index);
+    
+    // Positions and velocities of the current and transition frame in the
+    // database, which stores static bones once so they are sampled into these
+    array1d<vec3> curr_bone_positions(db.nbones());
+    array1d<vec3> curr_bone_velocities(db.nbones());
+    array1d<vec3> trns_bone_positions(db.nbones());
+    array1d<vec3> trns_bone_velocities(db.nbones());
+    
+    // Likewise for rotations, which can optionally be decoded from a 
+    // compressed copy built the first time it is enabled
+    array1d<quat> curr_bone_rotations(db.nbones());
+    array1d<vec3> curr_bone_angular_velocities(db.nbones());
+    array1d<quat> trns_bone_rotations(db.nbones());
+    array1d<vec3> trns_bone_angular_velocities(db.nbones());
+    
+    compressed_poses poses;
+    bool pose_compression_enabled = false;
+    const float pose_compression_tolerance = 0.002f; // Radians
+    
     // Inertializer使用的数据，如何使用其实可以参考Spring提供的inertialization demo工程
     array1d<vec3> bone_offset_positions(db.nbones());
     array1d<vec3> bone_offset_velocities(db.nbones());
@@ -1396,6 +1468,10 @@ int main(void)
         bone_positions(0),
         bone_rotations(0));
     
+    database_sample_bone_positions(curr_bone_positions, db, frame_index);
+    database_sample_bone_velocities(curr_bone_velocities, db, frame_index);
+    sample_bone_rotations(curr_bone_rotations, curr_bone_angular_velocities, db, poses, pose_compression_enabled, frame_index);
+    
     inertialize_pose_update(
         bone_positions,
         bone_velocities,
@@ -1405,10 +1481,10 @@ int main(void)
         bone_offset_velocities,
         bone_offset_rotations,
         bone_offset_angular_velocities,
-        db.bone_positions(frame_index),
-        db.bone_velocities(frame_index),
-        db.bone_rotations(frame_index),
-        db.bone_angular_velocities(frame_index),
+        curr_bone_positions,
+        curr_bone_velocities,
+        curr_bone_rotations,
+        curr_bone_angular_velocities,
         transition_src_position,
         transition_src_rotation,
         transition_dst_position,
@@ -1422,6 +1498,20 @@ int main(void)
     float search_timer = search_time;
     float force_search_timer = search_time;
     
+    bool search_warm_start_enabled = true;
+    search_warm_start search_warm;
+    int search_elapsed_frames = 0;
+    
+    search_context search_ctx;
+    search_context_init(search_ctx, db);
+    
+    // Statistics of the last search, optionally written to a csv file each search
+    search_stats search_stats_last;
+    bool search_stats_csv_enabled = false;
+    FILE* search_stats_csv = NULL;
+    
+    array1d<float> query(db.nfeatures());
+    
     vec3 desired_velocity;
     vec3 desired_velocity_change_curr;
     vec3 desired_velocity_change_prev;
@@ -1672,7 +1762,6 @@ int main(void)
         // In theory this only needs to be done when a search is 
         // actually required however for visualization purposes it
         // can be nice to do it every frame
-        array1d<float> query(db.nfeatures());
         
         // Compute the features of the query vector
         int offset = 0;
@@ -1699,15 +1788,60 @@ int main(void)
             int best_index = end_of_anim ? -1 : frame_index;
             float best_cost = FLT_MAX;
             
-            database_search(
-                best_index,
-                best_cost,
-                db,
-                query);
+            feature_weights(FEATURE_GROUP_FOOT_POSITION) = feature_weight_foot_position;
+            feature_weights(FEATURE_GROUP_FOOT_VELOCITY) = feature_weight_foot_velocity;
+            feature_weights(FEATURE_GROUP_HIP_VELOCITY) = feature_weight_hip_velocity;
+            feature_weights(FEATURE_GROUP_TRAJECTORY_POSITIONS) = feature_weight_trajectory_positions;
+            feature_weights(FEATURE_GROUP_TRAJECTORY_DIRECTIONS) = feature_weight_trajectory_directions;
+            
+            search_stats search_stats_before = search_ctx.stats;
+            
+            if (search_warm_start_enabled)
+            {
+                database_search_warm_weighted(
+                    best_index,
+                    best_cost,
+                    search_ctx,
+                    search_warm,
+                    search_elapsed_frames,
+                    db,
+                    feature_weights,
+                    query,
+                    0.0f,
+                    20,
+                    20);
+            }
+            else
+            {
+                database_search_weighted(
+                    best_index,
+                    best_cost,
+                    search_ctx,
+                    db,
+                    feature_weights,
+                    query,
+                    0.0f,
+                    20,
+                    20);
+            }
+            
+            search_stats_last = search_stats_difference(search_ctx.stats, search_stats_before);
+            
+            if (search_stats_csv != NULL)
+            {
+                search_stats_csv_row(search_stats_csv, search_stats_last);
+            }
             
             // Transition if better frame found
             if (best_index != frame_index)
             {
+                database_sample_bone_positions(curr_bone_positions, db, frame_index);
+                database_sample_bone_velocities(curr_bone_velocities, db, frame_index);
+                database_sample_bone_positions(trns_bone_positions, db, best_index);
+                database_sample_bone_velocities(trns_bone_velocities, db, best_index);
+                sample_bone_rotations(curr_bone_rotations, curr_bone_angular_velocities, db, poses, pose_compression_enabled, frame_index);
+                sample_bone_rotations(trns_bone_rotations, trns_bone_angular_velocities, db, poses, pose_compression_enabled, best_index);
+                
                 inertialize_pose_transition(
                     bone_offset_positions,
                     bone_offset_velocities,
@@ -1721,27 +1855,33 @@ int main(void)
                     bone_velocities(0),
                     bone_rotations(0),
                     bone_angular_velocities(0),
-                    db.bone_positions(frame_index),
-                    db.bone_velocities(frame_index),
-                    db.bone_rotations(frame_index),
-                    db.bone_angular_velocities(frame_index),
-                    db.bone_positions(best_index),
-                    db.bone_velocities(best_index),
-                    db.bone_rotations(best_index),
-                    db.bone_angular_velocities(best_index));
+                    curr_bone_positions,
+                    curr_bone_velocities,
+                    curr_bone_rotations,
+                    curr_bone_angular_velocities,
+                    trns_bone_positions,
+                    trns_bone_velocities,
+                    trns_bone_rotations,
+                    trns_bone_angular_velocities);
                 
                 frame_index = best_index;
             }
             
             // Reset search timer
             search_timer = search_time;
+            search_elapsed_frames = 0;
         }
         
         // Tick frame and update inertializer
         
         frame_index++; // Assumes dt is fixed to 60fps
+        search_elapsed_frames++;
         search_timer -= dt;
         
+        database_sample_bone_positions(curr_bone_positions, db, frame_index);
+        database_sample_bone_velocities(curr_bone_velocities, db, frame_index);
+        sample_bone_rotations(curr_bone_rotations, curr_bone_angular_velocities, db, poses, pose_compression_enabled, frame_index);
+        
         inertialize_pose_update(
             bone_positions,
             bone_velocities,
@@ -1751,10 +1891,10 @@ int main(void)
             bone_offset_velocities,
             bone_offset_rotations,
             bone_offset_angular_velocities,
-            db.bone_positions(frame_index),
-            db.bone_velocities(frame_index),
-            db.bone_rotations(frame_index),
-            db.bone_angular_velocities(frame_index),
+            curr_bone_positions,
+            curr_bone_velocities,
+            curr_bone_rotations,
+            curr_bone_angular_velocities,
             transition_src_position,
             transition_src_rotation,
             transition_dst_position,
@@ -2217,7 +2357,66 @@ int main(void)
         
         //---------
         
-        GuiGroupBox(CreateRectangle( 20, 20, 290, 190 ), "feature weights");
+        float ui_search_hei = 480;
+        
+        GuiGroupBox(CreateRectangle( 970, ui_search_hei, 290, 220 ), "search");
+        
+        bool search_warm_start_enabled_prev = search_warm_start_enabled;
+        
+        search_warm_start_enabled = GuiCheckBox(
+            CreateRectangle( 1000, ui_search_hei + 10, 20, 20 ), 
+            "warm start",
+            search_warm_start_enabled);
+        
+        // History is stale once it has not been kept up to date
+        if (search_warm_start_enabled && !search_warm_start_enabled_prev)
+        {
+            search_warm_start_reset(search_warm);
+        }
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 40, 240, 20 ), 
+            TextFormat("avg dims visited %5.2f / %d", search_stats_average_dims(search_ctx.stats), db.nfeatures()));
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 60, 240, 20 ), "last search");
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 80, 240, 20 ), 
+            TextFormat("large boxes pruned %lld / %lld", search_stats_last.lr_boxes_pruned, search_stats_last.lr_boxes_tested));
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 100, 240, 20 ), 
+            TextFormat("small boxes pruned %lld / %lld", search_stats_last.sm_boxes_pruned, search_stats_last.sm_boxes_tested));
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 120, 240, 20 ), 
+            TextFormat("frames evaluated %lld, dims %5.2f", search_stats_last.frames_evaluated, search_stats_average_dims(search_stats_last)));
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 140, 240, 20 ), 
+            TextFormat("frames skipped surrounding %lld", search_stats_last.frames_skipped_surrounding));
+        
+        GuiLabel(CreateRectangle( 1000, ui_search_hei + 160, 240, 20 ), 
+            TextFormat("time %6.1f us", search_stats_last.time_us));
+        
+        search_stats_csv_enabled = GuiCheckBox(
+            CreateRectangle( 1000, ui_search_hei + 190, 20, 20 ), 
+            "write search_stats.csv",
+            search_stats_csv_enabled);
+        
+        // Open or close the csv file when the checkbox changes
+        if (search_stats_csv_enabled && search_stats_csv == NULL)
+        {
+            search_stats_csv = fopen("./search_stats.csv", "w");
+            if (search_stats_csv != NULL)
+            {
+                search_stats_csv_header(search_stats_csv);
+            }
+        }
+        else if (!search_stats_csv_enabled && search_stats_csv != NULL)
+        {
+            fclose(search_stats_csv);
+            search_stats_csv = NULL;
+        }
+        
+        //---------
+        
+        GuiGroupBox(CreateRectangle( 20, 20, 290, 160 ), "feature weights");
         
         feature_weight_foot_position = GuiSliderBar(
             CreateRectangle( 150, 30, 120, 20 ), 
@@ -2246,17 +2445,6 @@ int main(void)
             
             TextFormat("%s %5.3f", "trajectory directions", feature_weight_trajectory_directions), 
             feature_weight_trajectory_directions, 0.001f, 3.0f, showValue);
-            
-        if (GuiButton(CreateRectangle( 150, 180, 120, 20 ), "rebuild database"))
-        {
-            database_build_matching_features(
-                db,
-                feature_weight_foot_position,
-                feature_weight_foot_velocity,
-                feature_weight_hip_velocity,
-                feature_weight_trajectory_positions,
-                feature_weight_trajectory_directions);
-        }
         
         //---------
         
@@ -2383,6 +2571,24 @@ int main(void)
             ik_unlock_radius, 0.0f, 0.5f, showValue);
         
         //---------
+        
+        float ui_comp_hei = 660;
+        
+        GuiGroupBox(CreateRectangle( 20, ui_comp_hei, 290, 40 ), "pose compression");
+        
+        pose_compression_enabled = GuiCheckBox(
+            CreateRectangle( 50, ui_comp_hei + 10, 20, 20 ), 
+            TextFormat("enabled (%.1f MB)", poses.nframes > 0 ? compressed_poses_memory(poses) / (1024.0f * 1024.0f) : 0.0f),
+            pose_compression_enabled);
+        
+        // Built on first use, printing the error of each bone
+        if (pose_compression_enabled && poses.nframes == 0)
+        {
+            compressed_poses_build(poses, db, pose_compression_tolerance);
+            compressed_poses_error_report(poses, db);
+        }
+        
+        //---------
 
         EndDrawing();
 
@@ -2393,6 +2599,11 @@ int main(void)
     UnloadModel(ground_plane_model);
     UnloadShader(character_shader);
     UnloadShader(ground_plane_shader);
+    
+    if (search_stats_csv != NULL)
+    {
+        fclose(search_stats_csv);
+    }
 
     CloseWindow();
 
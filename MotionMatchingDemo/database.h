@@ -4,11 +4,14 @@
 #include "vec.h"
 #include "quat.h"
 #include "array.h"
+#include "simd.h"
+#include "container.h"
 
 #include <assert.h>
 #include <float.h>
 #include <stdio.h>
 #include <math.h>
+#include <chrono>
 
 //--------------------------------------
 
@@ -18,6 +21,190 @@ enum
     BOUND_LR_SIZE = 64,
 };
 
+// Set to 0 to compile out all search statistics, in which
+// case any search_stats passed to a search is left untouched.
+#ifndef SEARCH_STATS
+#define SEARCH_STATS 1
+#endif
+
+// Set to 1 to check every feature lies inside its boxes each 
+// time the acceleration structure is built
+#ifndef VALIDATE_BOUNDS
+#define VALIDATE_BOUNDS 0
+#endif
+
+// Set to 0 to allow searches given a search_context to grow its
+// buffers, rather than asserting it was sized up front
+#ifndef SEARCH_CONTEXT_ASSERT_NO_ALLOCATIONS
+#define SEARCH_CONTEXT_ASSERT_NO_ALLOCATIONS 1
+#endif
+
+#if SEARCH_STATS
+#define SEARCH_STATS_ADD(stats, counter, amount) if (stats) { (stats)->counter += (amount); }
+#define SEARCH_STATS_TIMER_START(stats) \
+    std::chrono::steady_clock::time_point search_stats_start_time; \
+    if (stats) { search_stats_start_time = std::chrono::steady_clock::now(); }
+#define SEARCH_STATS_TIMER_STOP(stats) if (stats) { (stats)->time_us += \
+    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - search_stats_start_time).count(); }
+#else
+#define SEARCH_STATS_ADD(stats, counter, amount) ((void)(stats))
+#define SEARCH_STATS_TIMER_START(stats) ((void)(stats))
+#define SEARCH_STATS_TIMER_STOP(stats) ((void)(stats))
+#endif
+
+// Counters accumulated over any number of searches. Every search
+// given a search_stats counts searches and frames evaluated.
+//
+// The box and surrounding frame counters are recorded by every search
+// over the boxes of the database, including the batch, parallel, PCA,
+// quantized and anytime searches. The batch search counts a box once
+// for each query tested against it. The hierarchy search counts boxes
+// of its last level as small boxes and of every other level as large
+// boxes, and the cluster and HNSW searches leave both at zero.
+//
+// frame_dims_visited is not counted by the blocked search, which finds
+// the cost of every dimension at once, and is counted in whole groups
+// of eight columns (including padding) by the half search. The time is
+// only recorded by motion_matching_search and the warm start, weighted
+// and parallel searches.
+/*
+    searches                     : 查询次数
+    frames_evaluated             : 计算了cost的帧数
+    frame_dims_visited           : 计算cost时累加的维度数，除以frames_evaluated即为early-out前平均访问的维度数
+    lr_boxes_tested/pruned       : 测试的大box数量，以及其中被剔除的数量
+    sm_boxes_tested/pruned       : 测试的小box数量，以及其中被剔除的数量
+    frames_skipped_surrounding   : 因为ignore_surrounding而跳过的帧数
+    time_us                      : 查询总共使用的时间(微秒)
+*/
+struct search_stats
+{
+    long long searches;
+    long long frames_evaluated;
+    long long frame_dims_visited;
+    long long lr_boxes_tested;
+    long long lr_boxes_pruned;
+    long long sm_boxes_tested;
+    long long sm_boxes_pruned;
+    long long frames_skipped_surrounding;
+    double time_us;
+    
+    search_stats() : 
+        searches(0), 
+        frames_evaluated(0), 
+        frame_dims_visited(0),
+        lr_boxes_tested(0),
+        lr_boxes_pruned(0),
+        sm_boxes_tested(0),
+        sm_boxes_pruned(0),
+        frames_skipped_surrounding(0),
+        time_us(0.0) {}
+};
+
+void search_stats_reset(search_stats& stats)
+{
+    stats = search_stats();
+}
+
+// Average number of feature dimensions summed for each frame
+// before its cost exceeded the best cost (or all of them)
+float search_stats_average_dims(const search_stats& stats)
+{
+    return stats.frames_evaluated > 0 ? (float)((double)stats.frame_dims_visited / stats.frames_evaluated) : 0.0f;
+}
+
+// Counters of the searches done between taking `before` and `after`,
+// for example of a single search when taken either side of it
+search_stats search_stats_difference(const search_stats& after, const search_stats& before)
+{
+    search_stats diff;
+    diff.searches = after.searches - before.searches;
+    diff.frames_evaluated = after.frames_evaluated - before.frames_evaluated;
+    diff.frame_dims_visited = after.frame_dims_visited - before.frame_dims_visited;
+    diff.lr_boxes_tested = after.lr_boxes_tested - before.lr_boxes_tested;
+    diff.lr_boxes_pruned = after.lr_boxes_pruned - before.lr_boxes_pruned;
+    diff.sm_boxes_tested = after.sm_boxes_tested - before.sm_boxes_tested;
+    diff.sm_boxes_pruned = after.sm_boxes_pruned - before.sm_boxes_pruned;
+    diff.frames_skipped_surrounding = after.frames_skipped_surrounding - before.frames_skipped_surrounding;
+    diff.time_us = after.time_us - before.time_us;
+    return diff;
+}
+
+// Add the counters of `stats` to `total`, for example to gather
+// those counted separately by each worker of a parallel search
+void search_stats_accumulate(search_stats& total, const search_stats& stats)
+{
+    total.searches += stats.searches;
+    total.frames_evaluated += stats.frames_evaluated;
+    total.frame_dims_visited += stats.frame_dims_visited;
+    total.lr_boxes_tested += stats.lr_boxes_tested;
+    total.lr_boxes_pruned += stats.lr_boxes_pruned;
+    total.sm_boxes_tested += stats.sm_boxes_tested;
+    total.sm_boxes_pruned += stats.sm_boxes_pruned;
+    total.frames_skipped_surrounding += stats.frames_skipped_surrounding;
+    total.time_us += stats.time_us;
+}
+
+void search_stats_csv_header(FILE* f)
+{
+    fprintf(f, "searches,frames_evaluated,average_dims,lr_boxes_tested,lr_boxes_pruned,"
+        "sm_boxes_tested,sm_boxes_pruned,frames_skipped_surrounding,time_us\n");
+}
+
+void search_stats_csv_row(FILE* f, const search_stats& stats)
+{
+    fprintf(f, "%lld,%lld,%.3f,%lld,%lld,%lld,%lld,%lld,%.3f\n",
+        stats.searches,
+        stats.frames_evaluated,
+        search_stats_average_dims(stats),
+        stats.lr_boxes_tested,
+        stats.lr_boxes_pruned,
+        stats.sm_boxes_tested,
+        stats.sm_boxes_pruned,
+        stats.frames_skipped_surrounding,
+        stats.time_us);
+}
+
+// Upper bound on the relative rounding error of a float result
+// computed with n operations in sequence, gamma(n) = n u / (1 - n u)
+// for unit roundoff u (Higham, Accuracy and Stability of Numerical
+// Algorithms, section 3.1). The lower bounds of the PCA and cluster
+// searches are shrunk by this so they stay below the cost the full
+// search would compute for the same frame.
+static inline float search_rounding_error(const int n)
+{
+    double u = 0.5 * FLT_EPSILON;
+    assert(n * u < 0.01);
+    return (float)((n * u) / (1.0 - n * u)) * (1.0f + FLT_EPSILON);
+}
+
+// Tags given to each clip by generate_database.py. Every frame
+// has the tags of the clip it comes from, see db.frame_tags.
+enum
+{
+    DATABASE_TAG_IDLE     = 1 << 0,
+    DATABASE_TAG_RUN      = 1 << 1,
+    DATABASE_TAG_WALK     = 1 << 2,
+    DATABASE_TAG_MIRRORED = 1 << 3,
+};
+
+// Groups of feature columns which share a weight, see database_search_weighted
+enum
+{
+    FEATURE_GROUP_FOOT_POSITION         = 0,
+    FEATURE_GROUP_FOOT_VELOCITY         = 1,
+    FEATURE_GROUP_HIP_VELOCITY          = 2,
+    FEATURE_GROUP_TRAJECTORY_POSITIONS  = 3,
+    FEATURE_GROUP_TRAJECTORY_DIRECTIONS = 4,
+    FEATURE_GROUP_COUNT                 = 5,
+    
+    // Most columns any group has
+    FEATURE_GROUP_COLUMNS_MAX           = 6,
+};
+
+struct database;
+void database_unmap(database& db);
+void database_unmap_features(database& db);
+
 struct database
 {
     /* 
@@ -31,8 +218,15 @@ struct database
        Frame3     {1,2,3}  {1,2,3}  {1,2,3} ... ...
        ... 
        FrameRows  {1,2,3}  {1,2,3}  {1,2,3} ... ...
+       
+       实际存储时，除了Root和Hips，大部分骨骼的位置在所有帧中都相同(就是骨骼的长度)，所以只有随时间变化的骨骼按帧存储在
+       bone_positions_animated中(rows为帧数，cols为变化的骨骼数量)，其余骨骼只在bone_positions_static中存储一次
+       bone_positions_column(bone)为骨骼在bone_positions_animated中的列，不变的骨骼为-1，见database_split_static_channels
+       读取时使用database_bone_position或者database_sample_bone_positions，不需要关心骨骼是否变化
     */
-    array2d<vec3> bone_positions;
+    array2d<vec3> bone_positions_animated;
+    array1d<vec3> bone_positions_static;
+    array1d<int> bone_positions_column;
      
     /*
        数据来源于database.bin
@@ -54,8 +248,13 @@ struct database
         角速度是矢量。按右手螺旋定则，大拇指方向为ω方向.当质点作逆时针旋转时，ω向上；作顺时针旋转时，ω向下
         设线速度为v，取圆心为原点，设位矢（位置矢量）为r，则
         v=ω×r
+        
+        与bone_positions相同，只有随时间变化的骨骼按帧存储在bone_velocities_animated中，其余(大部分为0)只在bone_velocities_static中存储一次
+        读取时使用database_bone_velocity或者database_sample_bone_velocities
     */ 
-    array2d<vec3> bone_velocities;
+    array2d<vec3> bone_velocities_animated;
+    array1d<vec3> bone_velocities_static;
+    array1d<int> bone_velocities_column;
 
     /* 
        数据来源于database.bin
@@ -99,6 +298,20 @@ struct database
     */
     array1d<int> range_stops;
     
+    /*
+        数组长度为Frames，frame_ranges(i)表示第i帧所在的range，不属于任何range的帧为-1
+        在database_load中由range_starts和range_stops生成，见database_build_frame_ranges
+        用于O(1)查找某一帧所在的range，代替对所有range的遍历
+    */
+    array1d<int> frame_ranges;
+    
+    /*
+        数据来源于database.bin，旧版本的database.bin中没有该数据，此时所有帧的tag都为0
+        数组长度为Frames，每一位表示一个类别(见DATABASE_TAG_*)，同一个动画文件中的帧tag相同
+        用于只在部分动画中查询，比如只查询idle，见motion_matching_search_tagged
+    */
+    array1d<unsigned int> frame_tags;
+    
     /*
                 Left Foot Position | Right Foot Position | Left Foot Velocity | Right Foot Velocity | Hip Velocity | Trajectory Positions 2D | Trajectory Directions 2D
        Frame1    {标准后的3个float}    {标准后的3个float}    {标准后的3个float}     {标准后的3个float} {标准后的3个float}    {标准后的6个float}        {标准后的6个float} 
@@ -115,6 +328,37 @@ struct database
     /* 数组长度为Features Number, 内容是标准差与weight的差，标准化和逆操作使用 */
     array1d<float> features_scale;
     
+    /* 
+        数组长度为Features Number, 每一列所属的group(见FEATURE_GROUP_*)，列顺序与features相同
+        在database_build_matching_features中设置，查询时按group设置权重使用，见database_feature_weights
+    */
+    array1d<int> features_group;
+    
+    /* 
+        数组长度为FEATURE_GROUP_COUNT, 构建features时每个group使用的权重
+        修改单个group的权重见database_rebuild_feature_group
+    */
+    array1d<float> features_group_weights;
+    
+    /* 
+        数组长度为Features Number, 查询时访问Feature的顺序，features_order(k)表示第k个访问的Feature在features中的列
+        按标准化后的方差从大到小排列，方差越大的维度对cost的贡献通常越大，越早访问越容易提前退出(early-out)
+        见database_build_feature_order，可以通过database_feature_order_save/load保存和读取
+    */
+    array1d<int> features_order;
+    
+    /* 
+        数组长度为FEATURE_GROUP_COUNT, 计算features_order时每个group使用的权重
+        通常为查询时使用的权重，见database_build_feature_order
+    */
+    array1d<float> features_order_weights;
+    
+    /* 
+        按features_order重新排列列顺序后的features，查询使用
+        features_ordered(i, k) = features(i, features_order(k))
+    */
+    array2d<float> features_ordered;
+    
     /*
         数据来源于database.bin
     */
@@ -124,6 +368,7 @@ struct database
         AABB加速查询使用
         n = Frames+Size-1/Size
         存储的内容为管辖范围(比如每16行一组或者每64行一组)内的最小或者最大值
+        注意列的顺序与features_ordered相同(即按features_order排列)，下图为features_order未排序时的情况
 
             Left Foot Position | Right Foot Position | Left Foot Velocity | Right Foot Velocity | Hip Velocity | Trajectory Positions 2D | Trajectory Directions 2D
        1         {3个float}           {3个float}           {3个float}            {3个float}         {3个float}          {6个float}                {6个float} 
@@ -137,20 +382,180 @@ struct database
     array2d<float> bound_lr_min;
     array2d<float> bound_lr_max;
     
-    int nframes() const { return bone_positions.rows; }
-    int nbones() const { return bone_positions.cols; }
+    /*
+        Tag加速查询使用，长度与bound_sm_*和bound_lr_*的行数相同
+        *_any 为box内所有帧frame_tags的按位或，*_all 为按位与
+        某个box的*_any不包含全部required tag，或者*_all包含任意excluded tag时，box内没有满足条件的帧，可以直接跳过
+    */
+    array1d<unsigned int> bound_sm_tags_any;
+    array1d<unsigned int> bound_sm_tags_all;
+    array1d<unsigned int> bound_lr_tags_any;
+    array1d<unsigned int> bound_lr_tags_all;
+
+    /*
+        SIMD查询使用，db.features_ordered按BOUND_SM_SIZE分块后转置存储，末尾不足一块的部分补0
+        rows = (Frames+BOUND_SM_SIZE-1)/BOUND_SM_SIZE，cols = Features Number * BOUND_SM_SIZE
+        第b块中第j个Feature第l帧的数据为 features_blocked(b, j * BOUND_SM_SIZE + l)，即 features_ordered(b * BOUND_SM_SIZE + l, j)
+
+                   Feature1 (16帧)    Feature2 (16帧)    ... Feature27 (16帧)
+       Block1      {16个float}        {16个float}        ... {16个float}
+       ...
+       BlockN      {16个float}        {16个float}        ... {16个float}
+    */
+    array2d<float> features_blocked;
+    
+    /*
+        可选的半精度(float16)数据，database_build_matching_features的build_half为true时构建，否则为空
+        内存和带宽都只有float的一半，查询使用motion_matching_search_half
+        列顺序与features_ordered相同，列数为Features Number向上取整到8的倍数，多出来的列为0
+        features_half 为features_ordered四舍五入到最近的half
+        bound_*_half 由bound_*向外取整得到(min向下，max向上)，所以box仍然包含features_half中的所有帧，剔除依然是保守的
+    */
+    array2d<half> features_half;
+    array2d<half> bound_sm_min_half;
+    array2d<half> bound_sm_max_half;
+    array2d<half> bound_lr_min_half;
+    array2d<half> bound_lr_max_half;
+    
+    /*
+        database_load_mapped时映射的文件，未映射时为空
+        映射后bone_*，range_*，contact_states和frame_tags直接指向文件中的数据，它们是只读的，不能修改也不能resize
+    */
+    container_mapping mapping;
+    
+    /*
+        database_features_cache_load时映射的缓存文件，未映射时为空
+        映射后features，features_offset，features_scale，features_ordered，features_blocked，bound_*和*_half直接指向文件中的数据
+        使用的是copy-on-write映射，可以修改(比如database_rebuild_feature_group)但不能resize，重新构建前需要database_unmap_features
+    */
+    container_mapping features_mapping;
+    
+    database() {}
+    ~database() { database_unmap(*this); }
+    
+    int nframes() const { return bone_rotations.rows; }
+    int nbones() const { return bone_rotations.cols; }
     int nranges() const { return range_starts.size; }
     int nfeatures() const { return features.cols; }
     int ncontacts() const { return contact_states.cols; }
 };
 
+// Store the channels (bones) of `values` which are the same in every
+// frame just once. Apart from the root and hips the local positions are
+// the constant skeleton offsets and the local velocities are zero, so
+// this removes most of the data. Values are compared bitwise so the
+// split is lossless.
+/*
+animated [out]         : 变化的骨骼的数据，rows为帧数，cols为变化的骨骼数量
+constant [out]         : 每个骨骼第一帧的数据
+column [out]           : 骨骼在animated中的列，不变的骨骼为-1
+values [in]            : 所有骨骼的数据，rows为帧数，cols为骨骼数量
+*/
+void database_split_static_channels(
+    array2d<vec3>& animated,
+    array1d<vec3>& constant,
+    array1d<int>& column,
+    const array2d<vec3>& values)
+{
+    array1d<bool> is_static(values.cols);
+    is_static.set(true);
+    
+    constant.resize(values.cols);
+    for (int j = 0; j < values.cols; j++)
+    {
+        constant(j) = values.rows > 0 ? values(0, j) : vec3();
+    }
+    
+    for (int i = 1; i < values.rows; i++)
+    {
+        for (int j = 0; j < values.cols; j++)
+        {
+            is_static(j) = is_static(j) && memcmp(&values(i, j), &constant(j), sizeof(vec3)) == 0;
+        }
+    }
+    
+    int nanimated = 0;
+    column.resize(values.cols);
+    for (int j = 0; j < values.cols; j++)
+    {
+        column(j) = is_static(j) ? -1 : nanimated++;
+    }
+    
+    animated.resize(values.rows, nanimated);
+    for (int i = 0; i < values.rows; i++)
+    {
+        for (int j = 0; j < values.cols; j++)
+        {
+            if (column(j) != -1)
+            {
+                animated(i, column(j)) = values(i, j);
+            }
+        }
+    }
+}
+
+static inline vec3 database_bone_position(const database& db, const int frame, const int bone)
+{
+    int column = db.bone_positions_column(bone);
+    return column == -1 ? db.bone_positions_static(bone) : db.bone_positions_animated(frame, column);
+}
+
+static inline vec3 database_bone_velocity(const database& db, const int frame, const int bone)
+{
+    int column = db.bone_velocities_column(bone);
+    return column == -1 ? db.bone_velocities_static(bone) : db.bone_velocities_animated(frame, column);
+}
+
+// Fill in the local positions of every bone for a frame, for passing
+// to forward kinematics or the inertializer
+void database_sample_bone_positions(slice1d<vec3> bone_positions, const database& db, const int frame)
+{
+    for (int j = 0; j < db.nbones(); j++)
+    {
+        bone_positions(j) = database_bone_position(db, frame, j);
+    }
+}
+
+void database_sample_bone_velocities(slice1d<vec3> bone_velocities, const database& db, const int frame)
+{
+    for (int j = 0; j < db.nbones(); j++)
+    {
+        bone_velocities(j) = database_bone_velocity(db, frame, j);
+    }
+}
+
+// Build the lookup from each frame to the range containing it so
+// that finding the range of a frame doesn't need a scan over every
+// range, which gets slow when the database has many clips.
+void database_build_frame_ranges(database& db)
+{
+    db.frame_ranges.resize(db.nframes());
+    db.frame_ranges.set(-1);
+    
+    for (int r = 0; r < db.nranges(); r++)
+    {
+        for (int i = db.range_starts(r); i < db.range_stops(r); i++)
+        {
+            db.frame_ranges(i) = r;
+        }
+    }
+}
+
 void database_load(database& db, const char* filename)
 {
+    // Arrays pointing into a mapping can't be resized
+    database_unmap(db);
+    
     FILE* f = fopen(filename, "rb");
     assert(f != NULL);
     
-    array2d_read(db.bone_positions, f);
-    array2d_read(db.bone_velocities, f);
+    // Positions and velocities are stored for every bone and frame in
+    // the file, most of which is split off as static channels below
+    array2d<vec3> bone_positions;
+    array2d<vec3> bone_velocities;
+    
+    array2d_read(bone_positions, f);
+    array2d_read(bone_velocities, f);
     array2d_read(db.bone_rotations, f);
     array2d_read(db.bone_angular_velocities, f);
     array1d_read(db.bone_parents, f);
@@ -160,7 +565,169 @@ void database_load(database& db, const char* filename)
     
     array2d_read(db.contact_states, f);
     
+    // Tags were added at the end so older databases still load
+    int c = fgetc(f);
+    if (c != EOF)
+    {
+        ungetc(c, f);
+        array1d_read(db.frame_tags, f);
+    }
+    else
+    {
+        db.frame_tags.resize(db.nframes());
+        db.frame_tags.zero();
+    }
+    
     fclose(f);
+    
+    database_split_static_channels(db.bone_positions_animated, db.bone_positions_static, db.bone_positions_column, bone_positions);
+    database_split_static_channels(db.bone_velocities_animated, db.bone_velocities_static, db.bone_velocities_column, bone_velocities);
+    
+    database_build_frame_ranges(db);
+}
+
+//--------------------------------------
+
+enum
+{
+    DATABASE_CONTAINER_MAGIC = 0x42444d4d, // "MMDB"
+    DATABASE_CONTAINER_VERSION = 2,
+};
+
+// Save the data loaded from database.bin as a container, see container.h,
+// which database_load_mapped can use without copying. Returns false if
+// the file could not be written, in which case any existing file is kept.
+bool database_save_mapped(const database& db, const char* filename)
+{
+    container_writer w;
+    if (!container_write_begin(w, filename, DATABASE_CONTAINER_MAGIC, DATABASE_CONTAINER_VERSION, 13))
+    {
+        return false;
+    }
+    
+    container_write_array2d(w, "bone_positions_animated", db.bone_positions_animated);
+    container_write_array1d(w, "bone_positions_static", db.bone_positions_static);
+    container_write_array1d(w, "bone_positions_column", db.bone_positions_column);
+    container_write_array2d(w, "bone_velocities_animated", db.bone_velocities_animated);
+    container_write_array1d(w, "bone_velocities_static", db.bone_velocities_static);
+    container_write_array1d(w, "bone_velocities_column", db.bone_velocities_column);
+    container_write_array2d(w, "bone_rotations", db.bone_rotations);
+    container_write_array2d(w, "bone_angular_velocities", db.bone_angular_velocities);
+    container_write_array1d(w, "bone_parents", db.bone_parents);
+    container_write_array1d(w, "range_starts", db.range_starts);
+    container_write_array1d(w, "range_stops", db.range_stops);
+    container_write_array2d(w, "contact_states", db.contact_states);
+    container_write_array1d(w, "frame_tags", db.frame_tags);
+    
+    return container_write_end(w);
+}
+
+// Release the arrays pointing into the mapping and unmap it. Called
+// by the destructor of database so usually doesn't need calling.
+// The features are built from the animation data so any mapped
+// features cache is unmapped too.
+void database_unmap(database& db)
+{
+    database_unmap_features(db);
+    
+    if (db.mapping.data == NULL) { return; }
+    
+    container_release_array(db.bone_positions_animated);
+    container_release_array(db.bone_positions_static);
+    container_release_array(db.bone_positions_column);
+    container_release_array(db.bone_velocities_animated);
+    container_release_array(db.bone_velocities_static);
+    container_release_array(db.bone_velocities_column);
+    container_release_array(db.bone_rotations);
+    container_release_array(db.bone_angular_velocities);
+    container_release_array(db.bone_parents);
+    container_release_array(db.range_starts);
+    container_release_array(db.range_stops);
+    container_release_array(db.contact_states);
+    container_release_array(db.frame_tags);
+    
+    container_unmap(db.mapping);
+}
+
+// Same as database_load but mapping a container written by
+// database_save_mapped, so the animation data is never copied and
+// processes loading the same file share its memory. Returns false
+// if the file does not exist or is not a valid container, in which
+// case the database is left empty.
+bool database_load_mapped(database& db, const char* filename)
+{
+    database_unmap(db);
+    
+    // Free any data loaded by database_load
+    db.bone_positions_animated.resize(0, 0);
+    db.bone_positions_static.resize(0);
+    db.bone_positions_column.resize(0);
+    db.bone_velocities_animated.resize(0, 0);
+    db.bone_velocities_static.resize(0);
+    db.bone_velocities_column.resize(0);
+    db.bone_rotations.resize(0, 0);
+    db.bone_angular_velocities.resize(0, 0);
+    db.bone_parents.resize(0);
+    db.range_starts.resize(0);
+    db.range_stops.resize(0);
+    db.contact_states.resize(0, 0);
+    db.frame_tags.resize(0);
+    
+    if (!container_map(db.mapping, filename, DATABASE_CONTAINER_MAGIC, DATABASE_CONTAINER_VERSION))
+    {
+        return false;
+    }
+    
+    bool valid = 
+        container_view_array2d(db.bone_positions_animated, db.mapping, "bone_positions_animated") &&
+        container_view_array1d(db.bone_positions_static, db.mapping, "bone_positions_static") &&
+        container_view_array1d(db.bone_positions_column, db.mapping, "bone_positions_column") &&
+        container_view_array2d(db.bone_velocities_animated, db.mapping, "bone_velocities_animated") &&
+        container_view_array1d(db.bone_velocities_static, db.mapping, "bone_velocities_static") &&
+        container_view_array1d(db.bone_velocities_column, db.mapping, "bone_velocities_column") &&
+        container_view_array2d(db.bone_rotations, db.mapping, "bone_rotations") &&
+        container_view_array2d(db.bone_angular_velocities, db.mapping, "bone_angular_velocities") &&
+        container_view_array1d(db.bone_parents, db.mapping, "bone_parents") &&
+        container_view_array1d(db.range_starts, db.mapping, "range_starts") &&
+        container_view_array1d(db.range_stops, db.mapping, "range_stops") &&
+        container_view_array2d(db.contact_states, db.mapping, "contact_states") &&
+        container_view_array1d(db.frame_tags, db.mapping, "frame_tags");
+    
+    // Check arrays agree on the number of frames and ranges
+    valid = valid &&
+        db.bone_positions_animated.rows == db.nframes() &&
+        db.bone_positions_static.size == db.nbones() &&
+        db.bone_positions_column.size == db.nbones() &&
+        db.bone_velocities_animated.rows == db.nframes() &&
+        db.bone_velocities_static.size == db.nbones() &&
+        db.bone_velocities_column.size == db.nbones() &&
+        db.bone_angular_velocities.rows == db.nframes() && db.bone_angular_velocities.cols == db.nbones() &&
+        db.bone_parents.size == db.nbones() &&
+        db.range_stops.size == db.nranges() &&
+        db.contact_states.rows == db.nframes() &&
+        db.frame_tags.size == db.nframes();
+    
+    for (int j = 0; valid && j < db.nbones(); j++)
+    {
+        valid = 
+            db.bone_positions_column(j) >= -1 && db.bone_positions_column(j) < db.bone_positions_animated.cols &&
+            db.bone_velocities_column(j) >= -1 && db.bone_velocities_column(j) < db.bone_velocities_animated.cols;
+    }
+    
+    for (int r = 0; valid && r < db.nranges(); r++)
+    {
+        valid = db.range_starts(r) >= 0 && db.range_starts(r) <= db.range_stops(r) && db.range_stops(r) <= db.nframes();
+    }
+    
+    if (!valid)
+    {
+        database_unmap(db);
+        return false;
+    }
+    
+    database_build_frame_ranges(db);
+    
+    return true;
 }
 
 // When we add an offset to a frame in the database there is a chance
@@ -170,16 +737,10 @@ void database_load(database& db, const char* filename)
 // todo range_starts range_stops 与 Frames数量的关系？
 int database_trajectory_index_clamp(database& db, int frame, int offset)
 {
-    for (int i = 0; i < db.nranges(); i++)
-    {
-        if (frame >= db.range_starts(i) && frame < db.range_stops(i))
-        {
-            return clamp(frame + offset, db.range_starts(i), db.range_stops(i) - 1);
-        }
-    }
+    int r = db.frame_ranges(frame);
+    assert(r != -1);
     
-    assert(false);
-    return -1;
+    return clamp(frame + offset, db.range_starts(r), db.range_stops(r) - 1);
 }
 
 //--------------------------------------
@@ -512,21 +1073,25 @@ void forward_kinematics_velocity_partial(
 */
 void compute_bone_position_feature(database& db, int& offset, int bone, float weight = 1.0f)
 {
+    array1d<vec3> bone_positions(db.nbones());
+    
     for (int i = 0; i < db.nframes(); i++)
     {
         vec3 bone_position;
         quat bone_rotation;
         
+        database_sample_bone_positions(bone_positions, db, i);
+        
         forward_kinematics(
             bone_position,
             bone_rotation,
-            db.bone_positions(i),
+            bone_positions,
             db.bone_rotations(i),
             db.bone_parents,
             bone);
         
         // 计算如果root-bone 的rotations，positions全部重置为0后的bone-position位置
-        bone_position = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), bone_position - db.bone_positions(i, 0));
+        bone_position = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), bone_position - bone_positions(0));
         
         db.features(i, offset + 0) = bone_position.x;
         db.features(i, offset + 1) = bone_position.y;
@@ -548,6 +1113,9 @@ void compute_bone_position_feature(database& db, int& offset, int bone, float we
 */
 void compute_bone_velocity_feature(database& db, int& offset, int bone, float weight = 1.0f)
 {
+    array1d<vec3> bone_positions(db.nbones());
+    array1d<vec3> bone_velocities(db.nbones());
+    
     for (int i = 0; i < db.nframes(); i++)
     {
         vec3 bone_position;
@@ -555,13 +1123,16 @@ void compute_bone_velocity_feature(database& db, int& offset, int bone, float we
         quat bone_rotation;
         vec3 bone_angular_velocity;
         
+        database_sample_bone_positions(bone_positions, db, i);
+        database_sample_bone_velocities(bone_velocities, db, i);
+        
         forward_kinematics_velocity(
             bone_position,
             bone_velocity,
             bone_rotation,
             bone_angular_velocity,
-            db.bone_positions(i),
-            db.bone_velocities(i),
+            bone_positions,
+            bone_velocities,
             db.bone_rotations(i),
             db.bone_angular_velocities(i),
             db.bone_parents,
@@ -596,9 +1167,9 @@ void compute_trajectory_position_feature(database& db, int& offset, float weight
         int t1 = database_trajectory_index_clamp(db, i, 40);
         int t2 = database_trajectory_index_clamp(db, i, 60);
         
-        vec3 trajectory_pos0 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), db.bone_positions(t0, 0) - db.bone_positions(i, 0));
-        vec3 trajectory_pos1 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), db.bone_positions(t1, 0) - db.bone_positions(i, 0));
-        vec3 trajectory_pos2 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), db.bone_positions(t2, 0) - db.bone_positions(i, 0));
+        vec3 trajectory_pos0 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), database_bone_position(db, t0, 0) - database_bone_position(db, i, 0));
+        vec3 trajectory_pos1 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), database_bone_position(db, t1, 0) - database_bone_position(db, i, 0));
+        vec3 trajectory_pos2 = quat_mul_vec3(quat_inv(db.bone_rotations(i, 0)), database_bone_position(db, t2, 0) - database_bone_position(db, i, 0));
         
         db.features(i, offset + 0) = trajectory_pos0.x;
         db.features(i, offset + 1) = trajectory_pos0.z;
@@ -689,9 +1260,9 @@ void database_build_bounds(database& db)
     db.bound_lr_max.resize(nbound_lr, db.nfeatures()); 
     
     db.bound_sm_min.set(FLT_MAX);
-    db.bound_sm_max.set(FLT_MIN);
+    db.bound_sm_max.set(-FLT_MAX);
     db.bound_lr_min.set(FLT_MAX);
-    db.bound_lr_max.set(FLT_MIN);
+    db.bound_lr_max.set(-FLT_MAX);
     
     for (int i = 0; i < db.nframes(); i++)
     {
@@ -700,62 +1271,1358 @@ void database_build_bounds(database& db)
         
         for (int j = 0; j < db.nfeatures(); j++)
         {
-            db.bound_sm_min(i_sm, j) = minf(db.bound_sm_min(i_sm, j), db.features(i, j));
-            db.bound_sm_max(i_sm, j) = maxf(db.bound_sm_min(i_sm, j), db.features(i, j));
-            db.bound_lr_min(i_lr, j) = minf(db.bound_lr_min(i_lr, j), db.features(i, j));
-            db.bound_lr_max(i_lr, j) = maxf(db.bound_lr_min(i_lr, j), db.features(i, j));
+            db.bound_sm_min(i_sm, j) = minf(db.bound_sm_min(i_sm, j), db.features_ordered(i, j));
+            db.bound_sm_max(i_sm, j) = maxf(db.bound_sm_max(i_sm, j), db.features_ordered(i, j));
+            db.bound_lr_min(i_lr, j) = minf(db.bound_lr_min(i_lr, j), db.features_ordered(i, j));
+            db.bound_lr_max(i_lr, j) = maxf(db.bound_lr_max(i_lr, j), db.features_ordered(i, j));
         }
     }
+    
+    db.bound_sm_tags_any.resize(nbound_sm);
+    db.bound_sm_tags_all.resize(nbound_sm);
+    db.bound_lr_tags_any.resize(nbound_lr);
+    db.bound_lr_tags_all.resize(nbound_lr);
+    
+    db.bound_sm_tags_any.set(0);
+    db.bound_sm_tags_all.set(~0u);
+    db.bound_lr_tags_any.set(0);
+    db.bound_lr_tags_all.set(~0u);
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        int i_sm = i / BOUND_SM_SIZE;
+        int i_lr = i / BOUND_LR_SIZE;
+        
+        db.bound_sm_tags_any(i_sm) |= db.frame_tags(i);
+        db.bound_sm_tags_all(i_sm) &= db.frame_tags(i);
+        db.bound_lr_tags_any(i_lr) |= db.frame_tags(i);
+        db.bound_lr_tags_all(i_lr) &= db.frame_tags(i);
+    }
 }
 
-// Build all motion matching features and acceleration structure
+// Boxes that start at the start of each range and only cover the
+// frames which can actually be returned by the search, i.e. not the
+// last `ignore_range_end` frames of each range. Since no box spans
+// two ranges or includes the ignored tail frames they are generally
+// tighter than the boxes of database_build_bounds.
 /*
-   从database的数据中提取Feature并且标准化处理存入db.features 中，并且构建AABB加速结构
+    sm_offsets(r), lr_offsets(r)   : 第r个range的第一个box的索引，第r个range中第i帧所在的box为
+                                     sm_offsets(r) + (i - range_starts(r)) / BOUND_SM_SIZE
+    ignore_range_end               : 构建时使用的ignore_range_end，查询时的ignore_range_end不能比它小
+    其余与database中的bound_*相同，列顺序与features_ordered相同
 */
-void database_build_matching_features(
-    database& db,
-    const float feature_weight_foot_position,
-    const float feature_weight_foot_velocity,
-    const float feature_weight_hip_velocity,
-    const float feature_weight_trajectory_positions,
-    const float feature_weight_trajectory_directions)
+struct aligned_bounds
 {
-    int nfeatures = 
-        3 + // Left Foot Position
-        3 + // Right Foot Position 
-        3 + // Left Foot Velocity
-        3 + // Right Foot Velocity
-        3 + // Hip Velocity
-        6 + // Trajectory Positions 2D
-        6 ; // Trajectory Directions 2D
+    int ignore_range_end;
+    array1d<int> sm_offsets;
+    array1d<int> lr_offsets;
+    array2d<float> sm_min;
+    array2d<float> sm_max;
+    array2d<float> lr_min;
+    array2d<float> lr_max;
+    
+    aligned_bounds() : ignore_range_end(0) {}
+};
+
+int database_validate_aligned_bounds(const aligned_bounds& bounds, const database& db);
+
+void database_build_aligned_bounds(aligned_bounds& bounds, const database& db, const int ignore_range_end = 20)
+{
+    bounds.ignore_range_end = ignore_range_end;
+    bounds.sm_offsets.resize(db.nranges());
+    bounds.lr_offsets.resize(db.nranges());
+    
+    // Count boxes needed for the searchable part of each range
+    int nbound_sm = 0;
+    int nbound_lr = 0;
+    for (int r = 0; r < db.nranges(); r++)
+    {
+        int nsearchable = db.range_stops(r) - ignore_range_end - db.range_starts(r);
+        nsearchable = nsearchable > 0 ? nsearchable : 0;
         
-    db.features.resize(db.nframes(), nfeatures);
-    db.features_offset.resize(nfeatures);
-    db.features_scale.resize(nfeatures);
+        bounds.sm_offsets(r) = nbound_sm;
+        bounds.lr_offsets(r) = nbound_lr;
+        nbound_sm += (nsearchable + BOUND_SM_SIZE - 1) / BOUND_SM_SIZE;
+        nbound_lr += (nsearchable + BOUND_LR_SIZE - 1) / BOUND_LR_SIZE;
+    }
     
-    int offset = 0;
-    compute_bone_position_feature(db, offset, Bone_LeftFoot, feature_weight_foot_position);
-    compute_bone_position_feature(db, offset, Bone_RightFoot, feature_weight_foot_position);
-    compute_bone_velocity_feature(db, offset, Bone_LeftFoot, feature_weight_foot_velocity);
-    compute_bone_velocity_feature(db, offset, Bone_RightFoot, feature_weight_foot_velocity);
-    compute_bone_velocity_feature(db, offset, Bone_Hips, feature_weight_hip_velocity);
-    compute_trajectory_position_feature(db, offset, feature_weight_trajectory_positions);
-    compute_trajectory_direction_feature(db, offset, feature_weight_trajectory_directions);
+    bounds.sm_min.resize(nbound_sm, db.nfeatures());
+    bounds.sm_max.resize(nbound_sm, db.nfeatures());
+    bounds.lr_min.resize(nbound_lr, db.nfeatures());
+    bounds.lr_max.resize(nbound_lr, db.nfeatures());
     
-    assert(offset == nfeatures);
+    bounds.sm_min.set(FLT_MAX);
+    bounds.sm_max.set(-FLT_MAX);
+    bounds.lr_min.set(FLT_MAX);
+    bounds.lr_max.set(-FLT_MAX);
     
-    database_build_bounds(db);
+    for (int r = 0; r < db.nranges(); r++)
+    {
+        int range_end = db.range_stops(r) - ignore_range_end;
+        
+        for (int i = db.range_starts(r); i < range_end; i++)
+        {
+            int i_sm = bounds.sm_offsets(r) + (i - db.range_starts(r)) / BOUND_SM_SIZE;
+            int i_lr = bounds.lr_offsets(r) + (i - db.range_starts(r)) / BOUND_LR_SIZE;
+            
+            for (int j = 0; j < db.nfeatures(); j++)
+            {
+                bounds.sm_min(i_sm, j) = minf(bounds.sm_min(i_sm, j), db.features_ordered(i, j));
+                bounds.sm_max(i_sm, j) = maxf(bounds.sm_max(i_sm, j), db.features_ordered(i, j));
+                bounds.lr_min(i_lr, j) = minf(bounds.lr_min(i_lr, j), db.features_ordered(i, j));
+                bounds.lr_max(i_lr, j) = maxf(bounds.lr_max(i_lr, j), db.features_ordered(i, j));
+            }
+        }
+    }
+    
+#if VALIDATE_BOUNDS
+    assert(database_validate_aligned_bounds(bounds, db) == 0);
+#endif
 }
 
-// Motion Matching search function essentially consists
-// of comparing every feature vector in the database, 
-// against the query feature vector, first checking the 
-// query distance to the axis aligned bounding boxes used 
-// for the acceleration structure.
-/*
-MotionMatching的查询实现部分
-best_index [in/out]    : 一般情况下传入当前frame_index即可，假如当前frame已经是末尾帧了，传入-1即可
-best_cost [in/out]     : 传入FLT_MAX即可
+// Count the features which lie outside a box that should contain
+// them. This should always be zero, otherwise the search could
+// wrongly prune the best match.
+int database_validate_bounds(const database& db)
+{
+    int nviolations = 0;
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        int i_sm = i / BOUND_SM_SIZE;
+        int i_lr = i / BOUND_LR_SIZE;
+        
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            float x = db.features_ordered(i, j);
+            nviolations += x < db.bound_sm_min(i_sm, j) || x > db.bound_sm_max(i_sm, j);
+            nviolations += x < db.bound_lr_min(i_lr, j) || x > db.bound_lr_max(i_lr, j);
+        }
+    }
+    
+    return nviolations;
+}
+
+// Same for aligned bounds, only checking searchable frames
+int database_validate_aligned_bounds(const aligned_bounds& bounds, const database& db)
+{
+    int nviolations = 0;
+    
+    for (int r = 0; r < db.nranges(); r++)
+    {
+        int range_end = db.range_stops(r) - bounds.ignore_range_end;
+        
+        for (int i = db.range_starts(r); i < range_end; i++)
+        {
+            int i_sm = bounds.sm_offsets(r) + (i - db.range_starts(r)) / BOUND_SM_SIZE;
+            int i_lr = bounds.lr_offsets(r) + (i - db.range_starts(r)) / BOUND_LR_SIZE;
+            
+            for (int j = 0; j < db.nfeatures(); j++)
+            {
+                float x = db.features_ordered(i, j);
+                nviolations += x < bounds.sm_min(i_sm, j) || x > bounds.sm_max(i_sm, j);
+                nviolations += x < bounds.lr_min(i_lr, j) || x > bounds.lr_max(i_lr, j);
+            }
+        }
+    }
+    
+    return nviolations;
+}
+
+// Build the transposed copy of the features used by the vectorized
+// search. Each block holds BOUND_SM_SIZE frames (the same frames
+// as the matching small box) with the frames for one feature
+// dimension stored contiguously.
+void database_build_blocked_features(database& db)
+{
+    int nblocks = ((db.nframes() + BOUND_SM_SIZE - 1) / BOUND_SM_SIZE);
+    
+    db.features_blocked.resize(nblocks, db.nfeatures() * BOUND_SM_SIZE);
+    db.features_blocked.zero();
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        int i_sm = i / BOUND_SM_SIZE;
+        int lane = i % BOUND_SM_SIZE;
+        
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            db.features_blocked(i_sm, j * BOUND_SM_SIZE + lane) = db.features_ordered(i, j);
+        }
+    }
+}
+
+// Order the feature dimensions by how much they are expected to
+// contribute to the cost, which after normalization (and weighting)
+// is just the variance of each column. Visiting these first means
+// the early-out in the search happens after fewer dimensions. When
+// searching with runtime weights (database_search_weighted) pass the
+// weights usually used so the variance of each column is multiplied
+// by its squared weight.
+/*
+group_weights [in]     : 长度为FEATURE_GROUP_COUNT，查询时每个group通常使用的权重，见database_feature_weights
+*/
+void database_build_feature_order(database& db, const slice1d<float> group_weights)
+{
+    assert(group_weights.size == FEATURE_GROUP_COUNT);
+    
+    array1d<double> vars(db.nfeatures());
+    vars.zero();
+    
+    for (int j = 0; j < db.nfeatures(); j++)
+    {
+        double mean = 0.0;
+        for (int i = 0; i < db.nframes(); i++)
+        {
+            mean += db.features(i, j);
+        }
+        mean /= db.nframes();
+        
+        for (int i = 0; i < db.nframes(); i++)
+        {
+            vars(j) += (db.features(i, j) - mean) * (db.features(i, j) - mean);
+        }
+        vars(j) /= db.nframes();
+        vars(j) *= squaref(group_weights(db.features_group(j)));
+    }
+    
+    // Insertion sort by decreasing variance, keeping the
+    // original order for dimensions with equal variance
+    db.features_order.resize(db.nfeatures());
+    for (int j = 0; j < db.nfeatures(); j++)
+    {
+        int k = j;
+        while (k > 0 && vars(db.features_order(k - 1)) < vars(j))
+        {
+            db.features_order(k) = db.features_order(k - 1);
+            k--;
+        }
+        db.features_order(k) = j;
+    }
+    
+    db.features_order_weights = group_weights;
+}
+
+void database_build_feature_order(database& db)
+{
+    array1d<float> group_weights(FEATURE_GROUP_COUNT);
+    group_weights.set(1.0f);
+    database_build_feature_order(db, group_weights);
+}
+
+// Copy the features into the column order given by features_order
+void database_build_ordered_features(database& db)
+{
+    assert(db.features_order.size == db.nfeatures());
+    
+    db.features_ordered.resize(db.nframes(), db.nfeatures());
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int k = 0; k < db.nfeatures(); k++)
+        {
+            db.features_ordered(i, k) = db.features(i, db.features_order(k));
+        }
+    }
+}
+
+// True if `order` visits each of `nfeatures` columns exactly once
+bool database_feature_order_valid(const slice1d<int> order, const int nfeatures)
+{
+    if (order.size != nfeatures) { return false; }
+    
+    array1d<int> visited(nfeatures);
+    visited.zero();
+    
+    for (int k = 0; k < nfeatures; k++)
+    {
+        if (order(k) < 0 || order(k) >= nfeatures || visited(order(k))) { return false; }
+        visited(order(k)) = 1;
+    }
+    
+    return true;
+}
+
+// Build the half precision copy of the features and bounds
+void database_build_half_features(database& db)
+{
+    int ncols = ((db.nfeatures() + 7) / 8) * 8;
+    
+    db.features_half.resize(db.nframes(), ncols);
+    db.bound_sm_min_half.resize(db.bound_sm_min.rows, ncols);
+    db.bound_sm_max_half.resize(db.bound_sm_max.rows, ncols);
+    db.bound_lr_min_half.resize(db.bound_lr_min.rows, ncols);
+    db.bound_lr_max_half.resize(db.bound_lr_max.rows, ncols);
+    
+    db.features_half.zero();
+    db.bound_sm_min_half.zero();
+    db.bound_sm_max_half.zero();
+    db.bound_lr_min_half.zero();
+    db.bound_lr_max_half.zero();
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            db.features_half(i, j) = half_from_float(db.features_ordered(i, j));
+        }
+    }
+    
+    // Round bounds outward so they still contain the rounded features
+    for (int i = 0; i < db.bound_sm_min.rows; i++)
+    {
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            db.bound_sm_min_half(i, j) = half_from_float_down(db.bound_sm_min(i, j));
+            db.bound_sm_max_half(i, j) = half_from_float_up(db.bound_sm_max(i, j));
+        }
+    }
+    
+    for (int i = 0; i < db.bound_lr_min.rows; i++)
+    {
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            db.bound_lr_min_half(i, j) = half_from_float_down(db.bound_lr_min(i, j));
+            db.bound_lr_max_half(i, j) = half_from_float_up(db.bound_lr_max(i, j));
+        }
+    }
+}
+
+// Build all motion matching features and acceleration structure
+/*
+   从database的数据中提取Feature并且标准化处理存入db.features 中，并且构建AABB加速结构
+   build_half : 是否同时构建半精度的features和box，见db.features_half
+   order_weights : 长度为FEATURE_GROUP_COUNT，查询时通常使用的每个group的权重，没有已有的features_order时
+                   用于database_build_feature_order，NULL表示权重都为1
+*/
+void database_build_matching_features(
+    database& db,
+    const float feature_weight_foot_position,
+    const float feature_weight_foot_velocity,
+    const float feature_weight_hip_velocity,
+    const float feature_weight_trajectory_positions,
+    const float feature_weight_trajectory_directions,
+    const bool build_half = false,
+    const float* order_weights = NULL)
+{
+    // Arrays pointing into a features cache can't be resized
+    database_unmap_features(db);
+    
+    int nfeatures = 
+        3 + // Left Foot Position
+        3 + // Right Foot Position 
+        3 + // Left Foot Velocity
+        3 + // Right Foot Velocity
+        3 + // Hip Velocity
+        6 + // Trajectory Positions 2D
+        6 ; // Trajectory Directions 2D
+        
+    db.features.resize(db.nframes(), nfeatures);
+    db.features_offset.resize(nfeatures);
+    db.features_scale.resize(nfeatures);
+    
+    int offset = 0;
+    compute_bone_position_feature(db, offset, Bone_LeftFoot, feature_weight_foot_position);
+    compute_bone_position_feature(db, offset, Bone_RightFoot, feature_weight_foot_position);
+    compute_bone_velocity_feature(db, offset, Bone_LeftFoot, feature_weight_foot_velocity);
+    compute_bone_velocity_feature(db, offset, Bone_RightFoot, feature_weight_foot_velocity);
+    compute_bone_velocity_feature(db, offset, Bone_Hips, feature_weight_hip_velocity);
+    compute_trajectory_position_feature(db, offset, feature_weight_trajectory_positions);
+    compute_trajectory_direction_feature(db, offset, feature_weight_trajectory_directions);
+    
+    assert(offset == nfeatures);
+    
+    // Record which group each column belongs to, in the same order as above
+    const int group_sizes[FEATURE_GROUP_COUNT] = { 6, 6, 3, 6, 6 };
+    
+    db.features_group.resize(nfeatures);
+    offset = 0;
+    for (int g = 0; g < FEATURE_GROUP_COUNT; g++)
+    {
+        for (int j = 0; j < group_sizes[g]; j++)
+        {
+            db.features_group(offset + j) = g;
+        }
+        offset += group_sizes[g];
+    }
+    
+    assert(offset == nfeatures);
+    
+    db.features_group_weights.resize(FEATURE_GROUP_COUNT);
+    db.features_group_weights(FEATURE_GROUP_FOOT_POSITION) = feature_weight_foot_position;
+    db.features_group_weights(FEATURE_GROUP_FOOT_VELOCITY) = feature_weight_foot_velocity;
+    db.features_group_weights(FEATURE_GROUP_HIP_VELOCITY) = feature_weight_hip_velocity;
+    db.features_group_weights(FEATURE_GROUP_TRAJECTORY_POSITIONS) = feature_weight_trajectory_positions;
+    db.features_group_weights(FEATURE_GROUP_TRAJECTORY_DIRECTIONS) = feature_weight_trajectory_directions;
+    
+    // Keep any existing (e.g. loaded) order, otherwise compute it
+    if (db.features_order.size != nfeatures)
+    {
+        array1d<float> group_weights(FEATURE_GROUP_COUNT);
+        for (int g = 0; g < FEATURE_GROUP_COUNT; g++)
+        {
+            group_weights(g) = order_weights ? order_weights[g] : 1.0f;
+        }
+        
+        database_build_feature_order(db, group_weights);
+    }
+    
+    database_build_ordered_features(db);
+    database_build_bounds(db);
+    database_build_blocked_features(db);
+    
+    if (build_half)
+    {
+        database_build_half_features(db);
+    }
+    else
+    {
+        db.features_half.resize(0, 0);
+        db.bound_sm_min_half.resize(0, 0);
+        db.bound_sm_max_half.resize(0, 0);
+        db.bound_lr_min_half.resize(0, 0);
+        db.bound_lr_max_half.resize(0, 0);
+    }
+    
+#if VALIDATE_BOUNDS
+    assert(database_validate_bounds(db) == 0);
+#endif
+}
+
+// Change the weight of a single feature group without rebuilding the
+// whole database. Normalized features are divided by features_scale,
+// the standard deviation divided by the weight, so changing the weight
+// only scales the columns of the group by the ratio of the new and old
+// weight. Their scale and bounds are scaled by the same ratio, which
+// keeps the bounds containing the features, so no forward kinematics
+// or trajectory extraction is repeated and all other dimensions are
+// untouched. The result matches a full build with the new weight up to
+// rounding.
+//
+// This is for searches using weights built into the features. The
+// controller instead builds unit weights and gives the weights of its
+// sliders at search time, see database_search_weighted.
+//
+// The feature order is kept as it is, as the build does with an
+// existing order, so it no longer reflects the new weight. It only
+// affects how quickly the search exits early, callers wanting it
+// refreshed can call database_build_feature_order followed by
+// database_build_matching_features.
+/*
+group [in]             : 需要修改权重的group，见FEATURE_GROUP_*
+weight [in]            : 新的权重
+*/
+void database_rebuild_feature_group(database& db, const int group, const float weight)
+{
+    assert(group >= 0 && group < FEATURE_GROUP_COUNT);
+    assert(weight > 0.0f);
+    assert(db.features_group_weights(group) > 0.0f);
+    
+    float ratio = weight / db.features_group_weights(group);
+    
+    db.features_group_weights(group) = weight;
+    
+    // Find columns of the group in features and in features_ordered
+    int columns[FEATURE_GROUP_COLUMNS_MAX];
+    int columns_ordered[FEATURE_GROUP_COLUMNS_MAX];
+    int ncolumns = 0;
+    int ncolumns_ordered = 0;
+    
+    for (int j = 0; j < db.nfeatures(); j++)
+    {
+        if (db.features_group(j) == group)
+        {
+            assert(ncolumns < FEATURE_GROUP_COLUMNS_MAX);
+            columns[ncolumns] = j;
+            ncolumns++;
+        }
+        
+        if (db.features_group(db.features_order(j)) == group)
+        {
+            columns_ordered[ncolumns_ordered] = j;
+            ncolumns_ordered++;
+        }
+    }
+    
+    // Features and scale of the group, the offset is unchanged
+    for (int c = 0; c < ncolumns; c++)
+    {
+        db.features_scale(columns[c]) /= ratio;
+    }
+    
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int c = 0; c < ncolumns; c++)
+        {
+            db.features(i, columns[c]) *= ratio;
+        }
+    }
+    
+    // Ordered and blocked features
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int c = 0; c < ncolumns_ordered; c++)
+        {
+            int k = columns_ordered[c];
+            db.features_ordered(i, k) = db.features(i, db.features_order(k));
+        }
+    }
+    
+    if (db.features_blocked.rows > 0)
+    {
+        for (int i = 0; i < db.nframes(); i++)
+        {
+            for (int c = 0; c < ncolumns_ordered; c++)
+            {
+                int k = columns_ordered[c];
+                db.features_blocked(i / BOUND_SM_SIZE, k * BOUND_SM_SIZE + i % BOUND_SM_SIZE) = db.features_ordered(i, k);
+            }
+        }
+    }
+    
+    // Scale the bounds of the dimensions of the group. The ratio is
+    // positive and rounding is monotonic so they still contain the features
+    for (int c = 0; c < ncolumns_ordered; c++)
+    {
+        int k = columns_ordered[c];
+        
+        for (int i = 0; i < db.bound_sm_min.rows; i++)
+        {
+            db.bound_sm_min(i, k) *= ratio;
+            db.bound_sm_max(i, k) *= ratio;
+        }
+        
+        for (int i = 0; i < db.bound_lr_min.rows; i++)
+        {
+            db.bound_lr_min(i, k) *= ratio;
+            db.bound_lr_max(i, k) *= ratio;
+        }
+    }
+    
+    // Half precision columns are re-rounded from the float ones
+    if (db.features_half.rows == db.nframes())
+    {
+        for (int i = 0; i < db.nframes(); i++)
+        {
+            for (int c = 0; c < ncolumns_ordered; c++)
+            {
+                int k = columns_ordered[c];
+                db.features_half(i, k) = half_from_float(db.features_ordered(i, k));
+            }
+        }
+        
+        for (int i = 0; i < db.bound_sm_min.rows; i++)
+        {
+            for (int c = 0; c < ncolumns_ordered; c++)
+            {
+                int k = columns_ordered[c];
+                db.bound_sm_min_half(i, k) = half_from_float_down(db.bound_sm_min(i, k));
+                db.bound_sm_max_half(i, k) = half_from_float_up(db.bound_sm_max(i, k));
+            }
+        }
+        
+        for (int i = 0; i < db.bound_lr_min.rows; i++)
+        {
+            for (int c = 0; c < ncolumns_ordered; c++)
+            {
+                int k = columns_ordered[c];
+                db.bound_lr_min_half(i, k) = half_from_float_down(db.bound_lr_min(i, k));
+                db.bound_lr_max_half(i, k) = half_from_float_up(db.bound_lr_max(i, k));
+            }
+        }
+    }
+    
+#if VALIDATE_BOUNDS
+    assert(database_validate_bounds(db) == 0);
+#endif
+}
+
+//--------------------------------------
+
+enum
+{
+    DATABASE_FEATURES_CACHE_MAGIC = 0x46434d4d, // "MMCF"
+    DATABASE_FEATURES_CACHE_VERSION = 2,
+    
+    DATABASE_FEATURE_ORDER_MAGIC = 0x4f464d4d, // "MMFO"
+    DATABASE_FEATURE_ORDER_VERSION = 2,
+};
+
+// Everything the features built by database_build_matching_features
+// depend on. A cache is only used if its key matches exactly.
+/*
+    database_hash  : database_hash得到的动画数据的hash
+    weights        : 每个group的权重，见FEATURE_GROUP_*
+    order_weights  : 计算features_order时每个group的权重，见database_build_feature_order
+    build_half     : 是否包含半精度的features和box
+    bound_sm_size  : 构建时的BOUND_SM_SIZE
+    bound_lr_size  : 构建时的BOUND_LR_SIZE
+*/
+struct database_features_cache_key
+{
+    unsigned long long database_hash;
+    float weights[FEATURE_GROUP_COUNT];
+    float order_weights[FEATURE_GROUP_COUNT];
+    int build_half;
+    int bound_sm_size;
+    int bound_lr_size;
+};
+
+static inline unsigned long long database_hash_bytes(unsigned long long hash, const void* data, const size_t size)
+{
+    // FNV-1a over 8 byte words rather than single bytes, which is
+    // fast enough to hash a few hundred MB of animation data
+    const unsigned char* bytes = (const unsigned char*)data;
+    
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    
+    return hash;
+}
+
+// Hash of the data loaded from database.bin, the same however the
+// database was loaded (database_load or database_load_mapped)
+unsigned long long database_hash(const database& db)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    hash = database_hash_bytes(hash, db.bone_positions_animated.data, sizeof(vec3) * db.nframes() * db.bone_positions_animated.cols);
+    hash = database_hash_bytes(hash, db.bone_positions_static.data, sizeof(vec3) * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_positions_column.data, sizeof(int) * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_velocities_animated.data, sizeof(vec3) * db.nframes() * db.bone_velocities_animated.cols);
+    hash = database_hash_bytes(hash, db.bone_velocities_static.data, sizeof(vec3) * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_velocities_column.data, sizeof(int) * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_rotations.data, sizeof(quat) * db.nframes() * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_angular_velocities.data, sizeof(vec3) * db.nframes() * db.nbones());
+    hash = database_hash_bytes(hash, db.bone_parents.data, sizeof(int) * db.bone_parents.size);
+    hash = database_hash_bytes(hash, db.range_starts.data, sizeof(int) * db.nranges());
+    hash = database_hash_bytes(hash, db.range_stops.data, sizeof(int) * db.nranges());
+    hash = database_hash_bytes(hash, db.contact_states.data, sizeof(bool) * db.contact_states.rows * db.contact_states.cols);
+    hash = database_hash_bytes(hash, db.frame_tags.data, sizeof(unsigned int) * db.frame_tags.size);
+    return hash;
+}
+
+// The order is saved with the hash of the database it was built for,
+// so that it is not used once database.bin has been generated again,
+// and with the weights it was built with
+/*
+hash [in]              : database_hash(db)，没有传入时重新计算
+*/
+void database_feature_order_save(const database& db, const char* filename, const unsigned long long hash)
+{
+    FILE* f = fopen(filename, "wb");
+    assert(f != NULL);
+    
+    int header[2] = { DATABASE_FEATURE_ORDER_MAGIC, DATABASE_FEATURE_ORDER_VERSION };
+    fwrite(header, sizeof(int), 2, f);
+    fwrite(&hash, sizeof(unsigned long long), 1, f);
+    
+    assert(db.features_order_weights.size == FEATURE_GROUP_COUNT);
+    fwrite(db.features_order_weights.data, sizeof(float), FEATURE_GROUP_COUNT, f);
+    
+    array1d_write(db.features_order, f);
+    
+    fclose(f);
+}
+
+void database_feature_order_save(const database& db, const char* filename)
+{
+    database_feature_order_save(db, filename, database_hash(db));
+}
+
+// Returns false if there is no saved order, it was saved for a
+// different database, or it is not a valid order for the features.
+// When loaded before the features are built only the size is unknown,
+// database_build_matching_features then replaces an order of the
+// wrong size.
+/*
+hash [in]              : database_hash(db)，没有传入时重新计算
+*/
+bool database_feature_order_load(database& db, const char* filename, const unsigned long long hash)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { return false; }
+    
+    // Every column belongs to a group so there can't be more than this
+    int nfeatures_max = FEATURE_GROUP_COUNT * FEATURE_GROUP_COLUMNS_MAX;
+    
+    int header[2];
+    unsigned long long file_hash;
+    array1d<float> weights(FEATURE_GROUP_COUNT);
+    int size;
+    array1d<int> order;
+    bool valid = 
+        fread(header, sizeof(int), 2, f) == 2 &&
+        header[0] == DATABASE_FEATURE_ORDER_MAGIC &&
+        header[1] == DATABASE_FEATURE_ORDER_VERSION &&
+        fread(&file_hash, sizeof(unsigned long long), 1, f) == 1 &&
+        file_hash == hash &&
+        (int)fread(weights.data, sizeof(float), FEATURE_GROUP_COUNT, f) == FEATURE_GROUP_COUNT &&
+        fread(&size, sizeof(int), 1, f) == 1 && size > 0 && size <= nfeatures_max;
+    
+    if (valid)
+    {
+        order.resize(size);
+        valid = (int)fread(order.data, sizeof(int), size, f) == size && 
+            database_feature_order_valid(order, db.nfeatures() > 0 ? db.nfeatures() : size);
+    }
+    
+    fclose(f);
+    
+    if (valid)
+    {
+        db.features_order = order;
+        db.features_order_weights = weights;
+    }
+    
+    return valid;
+}
+
+bool database_feature_order_load(database& db, const char* filename)
+{
+    return database_feature_order_load(db, filename, database_hash(db));
+}
+
+static inline database_features_cache_key database_features_cache_make_key(
+    const unsigned long long hash,
+    const float feature_weight_foot_position,
+    const float feature_weight_foot_velocity,
+    const float feature_weight_hip_velocity,
+    const float feature_weight_trajectory_positions,
+    const float feature_weight_trajectory_directions,
+    const bool build_half,
+    const float* order_weights)
+{
+    database_features_cache_key key;
+    memset(&key, 0, sizeof(key));
+    key.database_hash = hash;
+    key.weights[FEATURE_GROUP_FOOT_POSITION] = feature_weight_foot_position;
+    key.weights[FEATURE_GROUP_FOOT_VELOCITY] = feature_weight_foot_velocity;
+    key.weights[FEATURE_GROUP_HIP_VELOCITY] = feature_weight_hip_velocity;
+    key.weights[FEATURE_GROUP_TRAJECTORY_POSITIONS] = feature_weight_trajectory_positions;
+    key.weights[FEATURE_GROUP_TRAJECTORY_DIRECTIONS] = feature_weight_trajectory_directions;
+    for (int g = 0; g < FEATURE_GROUP_COUNT; g++)
+    {
+        key.order_weights[g] = order_weights ? order_weights[g] : 1.0f;
+    }
+    key.build_half = build_half ? 1 : 0;
+    key.bound_sm_size = BOUND_SM_SIZE;
+    key.bound_lr_size = BOUND_LR_SIZE;
+    return key;
+}
+
+// Save the features and acceleration structure built by
+// database_build_matching_features so they can be loaded with
+// database_features_cache_load instead of being built again. The
+// cache is replaced atomically (see container_write_end) so other
+// processes with the old cache mapped are not affected. Returns
+// false if the file could not be written.
+/*
+hash [in]              : database_hash(db)，没有传入时重新计算
+*/
+bool database_features_cache_save(const database& db, const char* filename, const unsigned long long hash)
+{
+    database_features_cache_key key = database_features_cache_make_key(
+        hash,
+        db.features_group_weights(FEATURE_GROUP_FOOT_POSITION),
+        db.features_group_weights(FEATURE_GROUP_FOOT_VELOCITY),
+        db.features_group_weights(FEATURE_GROUP_HIP_VELOCITY),
+        db.features_group_weights(FEATURE_GROUP_TRAJECTORY_POSITIONS),
+        db.features_group_weights(FEATURE_GROUP_TRAJECTORY_DIRECTIONS),
+        db.features_half.rows == db.nframes() && db.nframes() > 0,
+        db.features_order_weights.data);
+    
+    container_writer w;
+    if (!container_write_begin(w, filename, DATABASE_FEATURES_CACHE_MAGIC, DATABASE_FEATURES_CACHE_VERSION, 22))
+    {
+        return false;
+    }
+    
+    container_write(w, "key", &key, sizeof(key), 1, 1);
+    container_write_array2d(w, "features", db.features);
+    container_write_array1d(w, "features_offset", db.features_offset);
+    container_write_array1d(w, "features_scale", db.features_scale);
+    container_write_array1d(w, "features_group", db.features_group);
+    container_write_array1d(w, "features_order", db.features_order);
+    container_write_array2d(w, "features_ordered", db.features_ordered);
+    container_write_array2d(w, "bound_sm_min", db.bound_sm_min);
+    container_write_array2d(w, "bound_sm_max", db.bound_sm_max);
+    container_write_array2d(w, "bound_lr_min", db.bound_lr_min);
+    container_write_array2d(w, "bound_lr_max", db.bound_lr_max);
+    container_write_array1d(w, "bound_sm_tags_any", db.bound_sm_tags_any);
+    container_write_array1d(w, "bound_sm_tags_all", db.bound_sm_tags_all);
+    container_write_array1d(w, "bound_lr_tags_any", db.bound_lr_tags_any);
+    container_write_array1d(w, "bound_lr_tags_all", db.bound_lr_tags_all);
+    container_write_array2d(w, "features_blocked", db.features_blocked);
+    container_write_array2d(w, "features_half", db.features_half);
+    container_write_array2d(w, "bound_sm_min_half", db.bound_sm_min_half);
+    container_write_array2d(w, "bound_sm_max_half", db.bound_sm_max_half);
+    container_write_array2d(w, "bound_lr_min_half", db.bound_lr_min_half);
+    container_write_array2d(w, "bound_lr_max_half", db.bound_lr_max_half);
+    
+    return container_write_end(w);
+}
+
+bool database_features_cache_save(const database& db, const char* filename)
+{
+    return database_features_cache_save(db, filename, database_hash(db));
+}
+
+// Release the arrays pointing into the features cache and unmap it
+void database_unmap_features(database& db)
+{
+    if (db.features_mapping.data == NULL) { return; }
+    
+    container_release_array(db.features);
+    container_release_array(db.features_offset);
+    container_release_array(db.features_scale);
+    container_release_array(db.features_ordered);
+    container_release_array(db.bound_sm_min);
+    container_release_array(db.bound_sm_max);
+    container_release_array(db.bound_lr_min);
+    container_release_array(db.bound_lr_max);
+    container_release_array(db.bound_sm_tags_any);
+    container_release_array(db.bound_sm_tags_all);
+    container_release_array(db.bound_lr_tags_any);
+    container_release_array(db.bound_lr_tags_all);
+    container_release_array(db.features_blocked);
+    container_release_array(db.features_half);
+    container_release_array(db.bound_sm_min_half);
+    container_release_array(db.bound_sm_max_half);
+    container_release_array(db.bound_lr_min_half);
+    container_release_array(db.bound_lr_max_half);
+    
+    container_unmap(db.features_mapping);
+}
+
+// Map a features cache written by database_features_cache_save in
+// place of calling database_build_matching_features. Returns false,
+// leaving the features empty, if the file does not exist or was built
+// from different animation data, weights, order weights or settings.
+// As in database_build_matching_features an existing features_order is
+// kept, so a cache built with a different order is not used either.
+// The mapping is copy-on-write so database_rebuild_feature_group still
+// works, only copying the pages it touches.
+/*
+hash [in]              : database_hash(db)
+其他参数同database_build_matching_features
+*/
+bool database_features_cache_load(
+    database& db,
+    const char* filename,
+    const unsigned long long hash,
+    const float feature_weight_foot_position,
+    const float feature_weight_foot_velocity,
+    const float feature_weight_hip_velocity,
+    const float feature_weight_trajectory_positions,
+    const float feature_weight_trajectory_directions,
+    const bool build_half = false,
+    const float* order_weights = NULL)
+{
+    database_unmap_features(db);
+    
+    // Free any features built by database_build_matching_features
+    db.features.resize(0, 0);
+    db.features_offset.resize(0);
+    db.features_scale.resize(0);
+    db.features_ordered.resize(0, 0);
+    db.bound_sm_min.resize(0, 0);
+    db.bound_sm_max.resize(0, 0);
+    db.bound_lr_min.resize(0, 0);
+    db.bound_lr_max.resize(0, 0);
+    db.bound_sm_tags_any.resize(0);
+    db.bound_sm_tags_all.resize(0);
+    db.bound_lr_tags_any.resize(0);
+    db.bound_lr_tags_all.resize(0);
+    db.features_blocked.resize(0, 0);
+    db.features_half.resize(0, 0);
+    db.bound_sm_min_half.resize(0, 0);
+    db.bound_sm_max_half.resize(0, 0);
+    db.bound_lr_min_half.resize(0, 0);
+    db.bound_lr_max_half.resize(0, 0);
+    
+    if (!container_map(db.features_mapping, filename, DATABASE_FEATURES_CACHE_MAGIC, DATABASE_FEATURES_CACHE_VERSION, true))
+    {
+        return false;
+    }
+    
+    database_features_cache_key key = database_features_cache_make_key(
+        hash,
+        feature_weight_foot_position,
+        feature_weight_foot_velocity,
+        feature_weight_hip_velocity,
+        feature_weight_trajectory_positions,
+        feature_weight_trajectory_directions,
+        build_half,
+        order_weights);
+    
+    const container_entry* key_entry = container_find(db.features_mapping, "key", sizeof(key));
+    
+    bool valid = 
+        key_entry != NULL && key_entry->rows == 1 && key_entry->cols == 1 &&
+        memcmp((const char*)db.features_mapping.data + key_entry->offset, &key, sizeof(key)) == 0;
+    
+    // Small arrays are copied so they stay owned by the database
+    array1d<int> features_group;
+    array1d<int> features_order;
+    
+    valid = valid &&
+        container_view_array2d(db.features, db.features_mapping, "features") &&
+        container_view_array1d(db.features_offset, db.features_mapping, "features_offset") &&
+        container_view_array1d(db.features_scale, db.features_mapping, "features_scale") &&
+        container_view_array1d(features_group, db.features_mapping, "features_group") &&
+        container_view_array1d(features_order, db.features_mapping, "features_order") &&
+        container_view_array2d(db.features_ordered, db.features_mapping, "features_ordered") &&
+        container_view_array2d(db.bound_sm_min, db.features_mapping, "bound_sm_min") &&
+        container_view_array2d(db.bound_sm_max, db.features_mapping, "bound_sm_max") &&
+        container_view_array2d(db.bound_lr_min, db.features_mapping, "bound_lr_min") &&
+        container_view_array2d(db.bound_lr_max, db.features_mapping, "bound_lr_max") &&
+        container_view_array1d(db.bound_sm_tags_any, db.features_mapping, "bound_sm_tags_any") &&
+        container_view_array1d(db.bound_sm_tags_all, db.features_mapping, "bound_sm_tags_all") &&
+        container_view_array1d(db.bound_lr_tags_any, db.features_mapping, "bound_lr_tags_any") &&
+        container_view_array1d(db.bound_lr_tags_all, db.features_mapping, "bound_lr_tags_all") &&
+        container_view_array2d(db.features_blocked, db.features_mapping, "features_blocked") &&
+        container_view_array2d(db.features_half, db.features_mapping, "features_half") &&
+        container_view_array2d(db.bound_sm_min_half, db.features_mapping, "bound_sm_min_half") &&
+        container_view_array2d(db.bound_sm_max_half, db.features_mapping, "bound_sm_max_half") &&
+        container_view_array2d(db.bound_lr_min_half, db.features_mapping, "bound_lr_min_half") &&
+        container_view_array2d(db.bound_lr_max_half, db.features_mapping, "bound_lr_max_half");
+    
+    // Check every array has the size database_build_matching_features gives it
+    int nfeatures = db.nfeatures();
+    int nbound_sm = ((db.nframes() + BOUND_SM_SIZE - 1) / BOUND_SM_SIZE);
+    int nbound_lr = ((db.nframes() + BOUND_LR_SIZE - 1) / BOUND_LR_SIZE);
+    int nhalf = build_half ? db.nframes() : 0;
+    int ncols_half = build_half ? ((nfeatures + 7) / 8) * 8 : 0;
+    
+    valid = valid &&
+        db.features.rows == db.nframes() &&
+        db.features_offset.size == nfeatures &&
+        db.features_scale.size == nfeatures &&
+        features_group.size == nfeatures &&
+        features_order.size == nfeatures &&
+        db.features_ordered.rows == db.nframes() && db.features_ordered.cols == nfeatures &&
+        db.bound_sm_min.rows == nbound_sm && db.bound_sm_min.cols == nfeatures &&
+        db.bound_sm_max.rows == nbound_sm && db.bound_sm_max.cols == nfeatures &&
+        db.bound_lr_min.rows == nbound_lr && db.bound_lr_min.cols == nfeatures &&
+        db.bound_lr_max.rows == nbound_lr && db.bound_lr_max.cols == nfeatures &&
+        db.bound_sm_tags_any.size == nbound_sm && db.bound_sm_tags_all.size == nbound_sm &&
+        db.bound_lr_tags_any.size == nbound_lr && db.bound_lr_tags_all.size == nbound_lr &&
+        db.features_blocked.rows == nbound_sm && db.features_blocked.cols == nfeatures * BOUND_SM_SIZE &&
+        db.features_half.rows == nhalf && db.features_half.cols == ncols_half &&
+        db.bound_sm_min_half.rows == (build_half ? nbound_sm : 0) && db.bound_sm_min_half.cols == ncols_half &&
+        db.bound_sm_max_half.rows == (build_half ? nbound_sm : 0) && db.bound_sm_max_half.cols == ncols_half &&
+        db.bound_lr_min_half.rows == (build_half ? nbound_lr : 0) && db.bound_lr_min_half.cols == ncols_half &&
+        db.bound_lr_max_half.rows == (build_half ? nbound_lr : 0) && db.bound_lr_max_half.cols == ncols_half;
+    
+    for (int j = 0; valid && j < nfeatures; j++)
+    {
+        valid = 
+            features_group(j) >= 0 && features_group(j) < FEATURE_GROUP_COUNT &&
+            (db.features_order.size != nfeatures || db.features_order(j) == features_order(j));
+    }
+    
+    valid = valid && database_feature_order_valid(features_order, nfeatures);
+    
+    if (valid)
+    {
+        db.features_group = features_group;
+        db.features_order = features_order;
+        
+        db.features_group_weights.resize(FEATURE_GROUP_COUNT);
+        db.features_order_weights.resize(FEATURE_GROUP_COUNT);
+        for (int g = 0; g < FEATURE_GROUP_COUNT; g++)
+        {
+            db.features_group_weights(g) = key.weights[g];
+            db.features_order_weights(g) = key.order_weights[g];
+        }
+    }
+    
+    container_release_array(features_group);
+    container_release_array(features_order);
+    
+    if (!valid)
+    {
+        database_unmap_features(db);
+        return false;
+    }
+    
+#if VALIDATE_BOUNDS
+    assert(database_validate_bounds(db) == 0);
+#endif
+    
+    return true;
+}
+
+enum
+{
+    DATABASE_FEATURES_CACHE_LOADED = 0,     // The cache was up to date and used
+    DATABASE_FEATURES_CACHE_SAVED = 1,      // The features were built and the cache written
+    DATABASE_FEATURES_CACHE_SAVE_FAILED = 2 // The features were built but the cache could not be written
+};
+
+// Same as database_build_matching_features but using the features
+// cache in `filename` when it is up to date, and otherwise building
+// the features and writing the cache for next time. Returns one of
+// DATABASE_FEATURES_CACHE_*. The features are usable in every case.
+/*
+filename [in]          : 缓存文件
+其他参数同database_build_matching_features
+*/
+int database_build_matching_features_cached(
+    database& db,
+    const char* filename,
+    const float feature_weight_foot_position,
+    const float feature_weight_foot_velocity,
+    const float feature_weight_hip_velocity,
+    const float feature_weight_trajectory_positions,
+    const float feature_weight_trajectory_directions,
+    const bool build_half = false,
+    const float* order_weights = NULL)
+{
+    unsigned long long hash = database_hash(db);
+    
+    if (database_features_cache_load(
+        db,
+        filename,
+        hash,
+        feature_weight_foot_position,
+        feature_weight_foot_velocity,
+        feature_weight_hip_velocity,
+        feature_weight_trajectory_positions,
+        feature_weight_trajectory_directions,
+        build_half,
+        order_weights))
+    {
+        return DATABASE_FEATURES_CACHE_LOADED;
+    }
+    
+    database_build_matching_features(
+        db,
+        feature_weight_foot_position,
+        feature_weight_foot_velocity,
+        feature_weight_hip_velocity,
+        feature_weight_trajectory_positions,
+        feature_weight_trajectory_directions,
+        build_half,
+        order_weights);
+    
+    return database_features_cache_save(db, filename, hash) ?
+        DATABASE_FEATURES_CACHE_SAVED :
+        DATABASE_FEATURES_CACHE_SAVE_FAILED;
+}
+
+// Normalize a query and put it in the same column order as
+// features_ordered, which is the order all searches use
+void database_normalize_query(
+    slice1d<float> query_normalized,
+    const database& db,
+    const slice1d<float> query)
+{
+    for (int k = 0; k < db.nfeatures(); k++)
+    {
+        int j = db.features_order(k);
+        query_normalized(k) = (query(j) - db.features_offset(j)) / db.features_scale(j);
+    }
+}
+
+//--------------------------------------
+
+// Squared distance from the query to a box plus `transition_cost`,
+// which stops summing once it reaches `bound` as the box can then be
+// pruned whatever the remaining dimensions add. Each dimension is
+// multiplied by its squared weight when `weights_squared` is given,
+// see database_feature_weights.
+static inline float search_box_cost(
+    const slice1d<float> query_normalized,
+    const slice1d<float> box_min,
+    const slice1d<float> box_max,
+    const float transition_cost,
+    const float bound,
+    const float* weights_squared = NULL)
+{
+    float cost = transition_cost;
+    for (int j = 0; j < query_normalized.size; j++)
+    {
+        float dist = squaref(query_normalized(j) - clampf(query_normalized(j), box_min(j), box_max(j)));
+        cost += weights_squared ? weights_squared[j] * dist : dist;
+        
+        if (cost >= bound)
+        {
+            break;
+        }
+    }
+    
+    return cost;
+}
+
+// Same for a frame, also counting it in `stats`
+static inline float search_frame_cost(
+    const slice1d<float> query_normalized,
+    const slice1d<float> frame,
+    const float transition_cost,
+    const float bound,
+    search_stats* stats,
+    const float* weights_squared = NULL)
+{
+    SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+    
+    float cost = transition_cost;
+    int j = 0;
+    while (j < query_normalized.size)
+    {
+        float dist = squaref(query_normalized(j) - frame(j));
+        cost += weights_squared ? weights_squared[j] * dist : dist;
+        j++;
+        
+        if (cost >= bound)
+        {
+            break;
+        }
+    }
+    
+    // Counted once per frame so the loop itself stays free of stats
+    SEARCH_STATS_ADD(stats, frame_dims_visited, j);
+    
+    return cost;
+}
+
+// Where the boxes of a part of the database start. Boxes cover
+// BOUND_LR_SIZE and BOUND_SM_SIZE frames counted from frame `origin`
+// and are numbered from `lr_first` and `sm_first`. The boxes built by
+// database_build_bounds start at frame 0, see aligned_bounds for boxes
+// which start at each range.
+struct search_box_layout
+{
+    int origin;
+    int lr_first;
+    int sm_first;
+};
+
+static const search_box_layout search_box_layout_default = { 0, 0, 0 };
+
+// Every box search walks the database in the same way, and these
+// templates are that walk, written once. A search gives a `Sweep`
+// type deciding how boxes are pruned and how frames are checked:
+//
+//     bool prune_lr(const int i_lr) : true if no frame in the large box can be accepted
+//     bool prune_sm(const int i_sm) : same for a small box
+//     void frame(const int i)       : check a frame and keep it if good enough
+//
+// The walk skips frames around the current one and counts boxes and
+// skipped frames in `stats`, the sweep counts the frames it checks.
+
+// Check the frames `start` to `stop` of a small box
+template<typename Sweep>
+static inline void search_sweep_frames(
+    Sweep& sweep,
+    const int start,
+    const int stop,
+    const int curr_index,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    for (int i = start; i < stop; i++)
+    {
+        // Skip surrounding frames
+        if (curr_index != -1 && abs(i - curr_index) < ignore_surrounding)
+        {
+            SEARCH_STATS_ADD(stats, frames_skipped_surrounding, 1);
+            continue;
+        }
+        
+        sweep.frame(i);
+    }
+}
+
+// Check the small boxes covering frames `start` to `stop`, which
+// never crosses a large box
+template<typename Sweep>
+static inline void search_sweep_small_boxes(
+    Sweep& sweep,
+    const int start,
+    const int stop,
+    const search_box_layout layout,
+    const int curr_index,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    int i = start;
+    
+    while (i < stop)
+    {
+        // Find index of current and next small box
+        int i_sm = layout.sm_first + (i - layout.origin) / BOUND_SM_SIZE;
+        int i_sm_next = layout.origin + ((i - layout.origin) / BOUND_SM_SIZE + 1) * BOUND_SM_SIZE;
+        int i_sm_end = i_sm_next < stop ? i_sm_next : stop;
+        
+        // If distance is greater than current best jump to next box
+        SEARCH_STATS_ADD(stats, sm_boxes_tested, 1);
+        if (sweep.prune_sm(i_sm))
+        {
+            SEARCH_STATS_ADD(stats, sm_boxes_pruned, 1);
+        }
+        else
+        {
+            search_sweep_frames(sweep, i, i_sm_end, curr_index, ignore_surrounding, stats);
+        }
+        
+        i = i_sm_end;
+    }
+}
+
+// Search frames `start` to `stop`, first checking against large
+// boxes, then small boxes, then each frame
+template<typename Sweep>
+static inline void search_sweep(
+    Sweep& sweep,
+    const int start,
+    const int stop,
+    const search_box_layout layout,
+    const int curr_index,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    int i = start;
+    
+    while (i < stop)
+    {
+        // Find index of current and next large box
+        int i_lr = layout.lr_first + (i - layout.origin) / BOUND_LR_SIZE;
+        int i_lr_next = layout.origin + ((i - layout.origin) / BOUND_LR_SIZE + 1) * BOUND_LR_SIZE;
+        int i_lr_end = i_lr_next < stop ? i_lr_next : stop;
+        
+        // If distance is greater than current best jump to next box
+        SEARCH_STATS_ADD(stats, lr_boxes_tested, 1);
+        if (sweep.prune_lr(i_lr))
+        {
+            SEARCH_STATS_ADD(stats, lr_boxes_pruned, 1);
+        }
+        else
+        {
+            search_sweep_small_boxes(sweep, i, i_lr_end, layout, curr_index, ignore_surrounding, stats);
+        }
+        
+        i = i_lr_end;
+    }
+}
+
+// Search every range, excluding the end of each
+template<typename Sweep>
+static inline void search_sweep_ranges(
+    Sweep& sweep,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const int ignore_range_end,
+    const int curr_index,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    for (int r = 0; r < range_starts.size; r++)
+    {
+        search_sweep(sweep, range_starts(r), range_stops(r) - ignore_range_end, 
+            search_box_layout_default, curr_index, ignore_surrounding, stats);
+    }
+}
+
+// Sweep keeping the single best frame, as motion_matching_search does,
+// weighting the cost when `weights_squared` is not NULL
+struct search_sweep_best
+{
+    int& best_index;
+    float& best_cost;
+    const slice2d<float> features;
+    const slice2d<float> bound_sm_min;
+    const slice2d<float> bound_sm_max;
+    const slice2d<float> bound_lr_min;
+    const slice2d<float> bound_lr_max;
+    const slice1d<float> query_normalized;
+    const float* weights_squared;
+    const float transition_cost;
+    search_stats* stats;
+    
+    bool prune_lr(const int i_lr) const
+    {
+        return search_box_cost(query_normalized, bound_lr_min(i_lr), bound_lr_max(i_lr), transition_cost, best_cost, weights_squared) >= best_cost;
+    }
+    
+    bool prune_sm(const int i_sm) const
+    {
+        return search_box_cost(query_normalized, bound_sm_min(i_sm), bound_sm_max(i_sm), transition_cost, best_cost, weights_squared) >= best_cost;
+    }
+    
+    void frame(const int i)
+    {
+        float cost = search_frame_cost(query_normalized, features(i), transition_cost, best_cost, stats, weights_squared);
+        
+        // If cost is lower than current best then update best
+        if (cost < best_cost)
+        {
+            best_index = i;
+            best_cost = cost;
+        }
+    }
+};
+
+//--------------------------------------
+
+// Search the database given a best frame and cost to beat. This
+// is the main loop of motion_matching_search, split out so other
+// search modes can seed `best_index` and `best_cost` themselves.
+/*
+best_index [in/out]    : 目前最好的帧，可以为-1
+best_cost [in/out]     : 目前最好的帧的cost，只有cost比它小的帧才会被选中
+curr_index [in]        : 当前帧，用于ignore_surrounding，假如当前frame已经是末尾帧了，传入-1即可
+weights_squared [in]   : 按features_order排列的每一列权重的平方，见database_feature_weights，NULL表示权重都为1
+其他参数同motion_matching_search
+*/
+void motion_matching_search_sweep(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const int curr_index,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL,
+    const float* weights_squared = NULL)
+{
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_best sweep = {
+        best_index, best_cost, features,
+        bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+        query_normalized, weights_squared, transition_cost, stats };
+    
+    // Search rest of database
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Motion Matching search function essentially consists
+// of comparing every feature vector in the database, 
+// against the query feature vector, first checking the 
+// query distance to the axis aligned bounding boxes used 
+// for the acceleration structure.
+/*
+MotionMatching的查询实现部分
+best_index [in/out]    : 一般情况下传入当前frame_index即可，假如当前frame已经是末尾帧了，传入-1即可
+best_cost [in/out]     : 传入FLT_MAX即可
 range_starts [in]      : 动画帧遍历使用，之所以没有直接使用features.rows是因为动画由几个动画文件组成，而并非一个大的动画文件，range_starts和range_stops提供了每个动画文件的范围
 range_stops [in]       : 动画帧遍历使用，同上
 features [in]          :
@@ -763,43 +2630,1362 @@ features_offset [in]   : 本函数没有用到
 features_scale [in]    : 本函数没有用到
 bound_sm_min [in]      : 加速结构，可快速剔除不符合条件的帧，加速查询，这里的算法也特别有意思：
 
-curr_cost += squaref(query_normalized(j) - clampf(query_normalized(j), 
-                    bound_lr_min(i_lr, j), bound_lr_max(i_lr, j)));
+curr_cost += squaref(query_normalized(j) - clampf(query_normalized(j), 
+                    bound_lr_min(i_lr, j), bound_lr_max(i_lr, j)));
+
+可以看到，query_normalized(j)仅仅和clampf上的自己做了一个比较，如果连这种方式计算出的cost比当前best_cost还大的话，那么bound里面的任何一个feature都比当前的都要大，就没有比较的必要了
+
+bound_sm_max [in]      : 同上
+bound_lr_min [in]      : 同上
+bound_lr_max [in]      : 同上
+query_normalized [in]  : 当前Pose和Trajectory的标准化数据
+transition_cost [in]   : Pose发生改变的固定消耗
+ignore_range_end [in]  : range末尾忽略的帧数，比如range范围为1-50，该参数20表示只考虑1-30的帧
+ignore_surrounding [in]: 忽略附近的帧数，比如当前帧使用的是50，该参数20表示30-70之间的帧都不考虑，这种方式能保证返回的帧肯定不是当前帧
+*/
+void motion_matching_search(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice1d<float> features_offset,
+    const slice1d<float> features_scale,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    int nfeatures = query_normalized.size;
+    
+    SEARCH_STATS_TIMER_START(stats);
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+    
+    // Search rest of database
+    motion_matching_search_sweep(
+        best_index,
+        best_cost,
+        curr_index,
+        range_starts,
+        range_stops,
+        features,
+        bound_sm_min,
+        bound_sm_max,
+        bound_lr_min,
+        bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+    
+    SEARCH_STATS_TIMER_STOP(stats);
+}
+
+// Sweep for motion_matching_search_blocked, which finds the cost of
+// every frame of a small box once the box is not pruned and then
+// selects from them in order exactly as the scalar search does
+struct search_sweep_blocked
+{
+    int& best_index;
+    float& best_cost;
+    const slice2d<float> features_blocked;
+    const slice2d<float> bound_sm_min;
+    const slice2d<float> bound_sm_max;
+    const slice2d<float> bound_lr_min;
+    const slice2d<float> bound_lr_max;
+    const slice1d<float> query_normalized;
+    const float transition_cost;
+    const simd_level level;
+    search_stats* stats;
+    int block_start;
+    float block_costs[BOUND_SM_SIZE];
+    
+    bool prune_lr(const int i_lr) const
+    {
+        return search_box_cost(query_normalized, bound_lr_min(i_lr), bound_lr_max(i_lr), transition_cost, best_cost) >= best_cost;
+    }
+    
+    bool prune_sm(const int i_sm)
+    {
+        if (search_box_cost(query_normalized, bound_sm_min(i_sm), bound_sm_max(i_sm), transition_cost, best_cost) >= best_cost)
+        {
+            return true;
+        }
+        
+        // Find the cost of every frame in the small box at once
+        frame_costs_block(
+            block_costs,
+            &features_blocked(i_sm, 0),
+            query_normalized.data,
+            BOUND_SM_SIZE,
+            query_normalized.size,
+            transition_cost,
+            best_cost,
+            level);
+        
+        block_start = i_sm * BOUND_SM_SIZE;
+        return false;
+    }
+    
+    void frame(const int i)
+    {
+        SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+        float cost = block_costs[i - block_start];
+        
+        // If cost is lower than current best then update best
+        if (cost < best_cost)
+        {
+            best_index = i;
+            best_cost = cost;
+        }
+    }
+};
+
+// Same as motion_matching_search but the cost of every frame in
+// a small box is evaluated at once over `features_blocked` using
+// the widest instruction set given by `level`. Boxes are tested
+// and frames are selected in the same order as the scalar search
+// so the chosen index is identical.
+/*
+features_blocked [in]  : 按BOUND_SM_SIZE分块转置后的features，见database_build_blocked_features
+level [in]             : 使用的指令集，一般传入simd_level_detect()即可
+其他参数同motion_matching_search
+*/
+void motion_matching_search_blocked(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> features_blocked,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    const simd_level level,
+    search_stats* stats = NULL)
+{
+    int nfeatures = query_normalized.size;
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+    
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_blocked sweep = {
+        best_index, best_cost, features_blocked,
+        bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+        query_normalized, transition_cost, level, stats, 0, {} };
+    
+    // Search rest of database
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Search database
+/*
+MotionMatching的核心，查询相似帧并且返回
+best_index [in/out]    : 一般情况下传入当前frame_index即可，假如当前frame已经是末尾帧了，传入-1即可
+best_cost [in/out]     : 传入FLT_MAX即可
+db [in]
+query [in]             : 当前Pose和Trajectory的未标准化数据
+transition_cost [in]   : Pose发生改变的固定消耗
+ignore_range_end [in]  : range末尾忽略的帧数，比如range范围为1-50，该参数20表示只考虑1-30的帧
+ignore_surrounding [in]: 忽略附近的帧数，比如当前帧使用的是50，该参数20表示30-70之间的帧都不考虑，这种方式能保证返回的帧肯定不是当前帧
+*/
+void database_search(
+    int& best_index, 
+    float& best_cost, 
+    const database& db, 
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    // Search
+    motion_matching_search(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.features_offset,
+        db.features_scale,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+// Make queries for benchmarking from random frames of the database,
+// with the trajectory features perturbed so they don't exactly match
+// an existing frame. Every fifth query has no current frame.
+/*
+queries [out]          : rows为query数量，每行为一个未标准化的query
+starts [out]           : 每个query对应的当前帧，-1表示没有
+*/
+void database_random_queries(
+    slice2d<float> queries,
+    slice1d<int> starts,
+    const database& db,
+    unsigned int seed = 12345)
+{
+    assert(queries.rows == starts.size && queries.cols == db.nfeatures());
+    assert(db.features_group.size == db.nfeatures());
+    
+    for (int q = 0; q < queries.rows; q++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int frame = (int)(seed % (unsigned int)db.nframes());
+        starts(q) = q % 5 == 0 ? -1 : frame;
+        
+        for (int j = 0; j < db.nfeatures(); j++)
+        {
+            int group = db.features_group(j);
+            bool trajectory = group == FEATURE_GROUP_TRAJECTORY_POSITIONS || group == FEATURE_GROUP_TRAJECTORY_DIRECTIONS;
+            
+            seed = seed * 1664525u + 1013904223u;
+            float noise = trajectory ? ((seed >> 8) / 16777216.0f - 0.5f) : 0.0f;
+            queries(q, j) = (db.features(frame, j) + noise) * db.features_scale(j) + db.features_offset(j);
+        }
+    }
+}
+
+// Sweep for motion_matching_search_batch. Boxes are tested for
+// every query still alive in the enclosing box and frames only for
+// the queries alive in their small box. Statistics are counted per
+// query as if each had been searched alone.
+struct search_sweep_batch
+{
+    slice1d<int> best_indices;
+    slice1d<float> best_costs;
+    const slice1d<int> curr_indices;
+    slice1d<int> live_lr;
+    slice1d<int> live_sm;
+    int nlive_lr;
+    int nlive_sm;
+    const slice2d<float> features;
+    const slice2d<float> bound_sm_min;
+    const slice2d<float> bound_sm_max;
+    const slice2d<float> bound_lr_min;
+    const slice2d<float> bound_lr_max;
+    const slice2d<float> queries_normalized;
+    const slice1d<float> transition_costs;
+    const slice1d<int> ignore_surroundings;
+    search_stats* stats;
+    
+    // Find the queries for which the large box is close enough
+    bool prune_lr(const int i_lr)
+    {
+        nlive_lr = 0;
+        for (int q = 0; q < queries_normalized.rows; q++)
+        {
+            if (search_box_cost(queries_normalized(q), bound_lr_min(i_lr), bound_lr_max(i_lr), 
+                transition_costs(q), best_costs(q)) < best_costs(q))
+            {
+                live_lr(nlive_lr) = q;
+                nlive_lr++;
+            }
+        }
+        
+        SEARCH_STATS_ADD(stats, lr_boxes_tested, queries_normalized.rows);
+        SEARCH_STATS_ADD(stats, lr_boxes_pruned, queries_normalized.rows - nlive_lr);
+        
+        return nlive_lr == 0;
+    }
+    
+    // Find the queries for which the small box is close enough
+    bool prune_sm(const int i_sm)
+    {
+        nlive_sm = 0;
+        for (int l = 0; l < nlive_lr; l++)
+        {
+            int q = live_lr(l);
+            
+            if (search_box_cost(queries_normalized(q), bound_sm_min(i_sm), bound_sm_max(i_sm), 
+                transition_costs(q), best_costs(q)) < best_costs(q))
+            {
+                live_sm(nlive_sm) = q;
+                nlive_sm++;
+            }
+        }
+        
+        SEARCH_STATS_ADD(stats, sm_boxes_tested, nlive_lr);
+        SEARCH_STATS_ADD(stats, sm_boxes_pruned, nlive_lr - nlive_sm);
+        
+        return nlive_sm == 0;
+    }
+    
+    void frame(const int i)
+    {
+        for (int l = 0; l < nlive_sm; l++)
+        {
+            int q = live_sm(l);
+            
+            // Skip surrounding frames
+            if (curr_indices(q) != -1 && abs(i - curr_indices(q)) < ignore_surroundings(q))
+            {
+                SEARCH_STATS_ADD(stats, frames_skipped_surrounding, 1);
+                continue;
+            }
+            
+            float cost = search_frame_cost(queries_normalized(q), features(i), transition_costs(q), best_costs(q), stats);
+            
+            // If cost is lower than current best then update best
+            if (cost < best_costs(q))
+            {
+                best_indices(q) = i;
+                best_costs(q) = cost;
+            }
+        }
+    }
+};
+
+// Motion Matching search for many queries at once. Rather than
+// walking the whole database once per query we walk it once in
+// total, testing each box against every query which has not
+// already been pruned, so each box and frame is only brought into
+// cache once for the whole batch. Each query visits boxes and 
+// frames in the same order as motion_matching_search so gets the
+// same result as if it had been searched alone.
+/*
+best_indices [in/out]      : 每个query的best_index，含义同motion_matching_search
+best_costs [in/out]        : 每个query的best_cost，含义同motion_matching_search
+queries_normalized [in]    : rows为query数量，每行为一个标准化后的query
+transition_costs [in]      : 每个query的transition_cost
+ignore_surroundings [in]   : 每个query的ignore_surrounding
+其他参数同motion_matching_search
+*/
+void motion_matching_search_batch(
+    slice1d<int> best_indices,
+    slice1d<float> best_costs,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice2d<float> queries_normalized,
+    const slice1d<float> transition_costs,
+    const int ignore_range_end,
+    const slice1d<int> ignore_surroundings,
+    search_stats* stats = NULL)
+{
+    int nqueries = queries_normalized.rows;
+    int nfeatures = queries_normalized.cols;
+    
+    assert(best_indices.size == nqueries && best_costs.size == nqueries);
+    assert(transition_costs.size == nqueries && ignore_surroundings.size == nqueries);
+    
+    array1d<int> curr_indices(nqueries);
+    
+    // Lists of queries still alive in the current large and small box
+    array1d<int> live_lr(nqueries);
+    array1d<int> live_sm(nqueries);
+    
+    // Find cost for current frames
+    for (int q = 0; q < nqueries; q++)
+    {
+        curr_indices(q) = best_indices(q);
+        
+        if (best_indices(q) != -1)
+        {
+            best_costs(q) = 0.0;
+            for (int i = 0; i < nfeatures; i++)
+            {
+                best_costs(q) += squaref(queries_normalized(q, i) - features(best_indices(q), i));
+            }
+        }
+    }
+    
+    SEARCH_STATS_ADD(stats, searches, nqueries);
+    
+    search_sweep_batch sweep = {
+        best_indices, best_costs, curr_indices, live_lr, live_sm, 0, 0, features,
+        bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+        queries_normalized, transition_costs, ignore_surroundings, stats };
+    
+    // Search rest of database, frames around the current ones are
+    // skipped and boxes are counted for each query inside the sweep
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, -1, 0, NULL);
+}
+
+// Search database for a batch of queries, such as one per character in a crowd
+/*
+best_indices [in/out]      : 每个query的best_index，一般情况下传入当前frame_index即可，假如当前frame已经是末尾帧了，传入-1即可
+best_costs [in/out]        : 每个query的best_cost，传入FLT_MAX即可
+db [in]
+queries [in]               : rows为query数量，每行为一个未标准化的query
+transition_costs [in]      : 每个query的transition_cost
+ignore_surroundings [in]   : 每个query的ignore_surrounding
+ignore_range_end [in]      : range末尾忽略的帧数，所有query共用
+*/
+void database_search_batch(
+    slice1d<int> best_indices, 
+    slice1d<float> best_costs, 
+    const database& db, 
+    const slice2d<float> queries,
+    const slice1d<float> transition_costs,
+    const slice1d<int> ignore_surroundings,
+    const int ignore_range_end = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Queries
+    array2d<float> queries_normalized(queries.rows, db.nfeatures());
+    for (int q = 0; q < queries.rows; q++)
+    {
+        database_normalize_query(queries_normalized(q), db, queries(q));
+    }
+    
+    // Search
+    motion_matching_search_batch(
+        best_indices, 
+        best_costs, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        queries_normalized,
+        transition_costs,
+        ignore_range_end,
+        ignore_surroundings,
+        stats);
+}
+
+// Search database using the vectorized search
+/*
+与database_search相同，但使用motion_matching_search_blocked，要求db.features_blocked已经构建
+level [in]             : 使用的指令集，默认使用CPU支持的最宽指令集
+*/
+void database_search_blocked(
+    int& best_index, 
+    float& best_cost, 
+    const database& db, 
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    const simd_level level = simd_level_detect(),
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    // Search
+    motion_matching_search_blocked(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.features_blocked,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        level,
+        stats);
+}
+
+//--------------------------------------
+
+// Fixed capacity max-heap of the best candidates found so far,
+// ordered by cost and then by index so that the worst candidate
+// is always at the top and can be replaced in O(log k).
+struct candidate_heap
+{
+    int size;
+    array1d<int> indices;
+    array1d<float> costs;
+    
+    candidate_heap() : size(0) {}
+    
+    int capacity() const { return indices.size; }
+};
+
+void candidate_heap_init(candidate_heap& heap, const int capacity)
+{
+    heap.indices.resize(capacity);
+    heap.costs.resize(capacity);
+    heap.size = 0;
+}
+
+void candidate_heap_clear(candidate_heap& heap)
+{
+    heap.size = 0;
+}
+
+static inline bool candidate_heap_worse(const candidate_heap& heap, const int a, const int b)
+{
+    return heap.costs(a) > heap.costs(b) || 
+          (heap.costs(a) == heap.costs(b) && heap.indices(a) > heap.indices(b));
+}
+
+static inline void candidate_heap_swap(candidate_heap& heap, const int a, const int b)
+{
+    int index = heap.indices(a); heap.indices(a) = heap.indices(b); heap.indices(b) = index;
+    float cost = heap.costs(a); heap.costs(a) = heap.costs(b); heap.costs(b) = cost;
+}
+
+static inline void candidate_heap_sift_down(candidate_heap& heap, int i)
+{
+    while (true)
+    {
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+        int m = i;
+        if (l < heap.size && candidate_heap_worse(heap, l, m)) { m = l; }
+        if (r < heap.size && candidate_heap_worse(heap, r, m)) { m = r; }
+        if (m == i) { return; }
+        candidate_heap_swap(heap, i, m);
+        i = m;
+    }
+}
+
+// Cost a new candidate must be below to enter the heap
+static inline float candidate_heap_bound(const candidate_heap& heap)
+{
+    return heap.size < heap.capacity() ? FLT_MAX : heap.costs(0);
+}
+
+void candidate_heap_push(candidate_heap& heap, const int index, const float cost)
+{
+    if (heap.size < heap.capacity())
+    {
+        // Append and sift up
+        int i = heap.size;
+        heap.indices(i) = index;
+        heap.costs(i) = cost;
+        heap.size++;
+        
+        while (i > 0 && candidate_heap_worse(heap, i, (i - 1) / 2))
+        {
+            candidate_heap_swap(heap, i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    else if (heap.capacity() > 0 && cost < heap.costs(0))
+    {
+        // Replace the worst candidate
+        heap.indices(0) = index;
+        heap.costs(0) = cost;
+        candidate_heap_sift_down(heap, 0);
+    }
+}
+
+// Sort candidates from best to worst in place. After this
+// the heap property no longer holds so it must be cleared
+// before being pushed into again.
+void candidate_heap_sort(candidate_heap& heap)
+{
+    int size = heap.size;
+    
+    while (heap.size > 1)
+    {
+        candidate_heap_swap(heap, 0, heap.size - 1);
+        heap.size--;
+        candidate_heap_sift_down(heap, 0);
+    }
+    
+    heap.size = size;
+}
+
+// Sweep for motion_matching_search_topk, which prunes against the
+// cost of the k-th best frame rather than the best
+struct search_sweep_topk
+{
+    candidate_heap& candidates;
+    float worst_cost;
+    const slice2d<float> features;
+    const slice2d<float> bound_sm_min;
+    const slice2d<float> bound_sm_max;
+    const slice2d<float> bound_lr_min;
+    const slice2d<float> bound_lr_max;
+    const slice1d<float> query_normalized;
+    const float transition_cost;
+    search_stats* stats;
+    
+    bool prune_lr(const int i_lr) const
+    {
+        return search_box_cost(query_normalized, bound_lr_min(i_lr), bound_lr_max(i_lr), transition_cost, worst_cost) >= worst_cost;
+    }
+    
+    bool prune_sm(const int i_sm) const
+    {
+        return search_box_cost(query_normalized, bound_sm_min(i_sm), bound_sm_max(i_sm), transition_cost, worst_cost) >= worst_cost;
+    }
+    
+    void frame(const int i)
+    {
+        float cost = search_frame_cost(query_normalized, features(i), transition_cost, worst_cost, stats);
+        
+        // If cost is lower than current k-th best then add to candidates
+        if (cost < worst_cost)
+        {
+            candidate_heap_push(candidates, i, cost);
+            worst_cost = candidate_heap_bound(candidates);
+        }
+    }
+};
+
+// Same as motion_matching_search but keeps the k best frames
+// found rather than just the best one. Boxes are pruned against 
+// the cost of the k-th best frame found so far, so when k is 
+// small this costs little more than finding the single best.
+/*
+candidates [in/out]    : 保存找到的最好的k个帧，k为candidates.capacity()，调用前需要clear
+curr_index [in]        : 当前帧，当前帧本身也会作为候选（不计transition_cost，同motion_matching_search），假如当前frame已经是末尾帧了，传入-1即可
+其他参数同motion_matching_search
+*/
+void motion_matching_search_topk(
+    candidate_heap& candidates,
+    const int curr_index,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    int nfeatures = query_normalized.size;
+    
+    // Current frame is the first candidate
+    if (curr_index != -1)
+    {
+        float curr_cost = 0.0f;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            curr_cost += squaref(query_normalized(i) - features(curr_index, i));
+        }
+        
+        candidate_heap_push(candidates, curr_index, curr_cost);
+    }
+    
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_topk sweep = {
+        candidates, candidate_heap_bound(candidates), features,
+        bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+        query_normalized, transition_cost, stats };
+    
+    // Search rest of database
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Search database for the k best frames
+/*
+best_indices [out]     : 找到的帧，按cost从小到大排序，k为best_indices.size
+best_costs [out]       : 对应的cost
+db [in]
+query [in]             : 当前Pose和Trajectory的未标准化数据
+curr_index [in]        : 当前帧，假如当前frame已经是末尾帧了，传入-1即可
+返回值                 : 找到的帧数量，数据库足够大时等于k
+*/
+int database_search_topk(
+    slice1d<int> best_indices,
+    slice1d<float> best_costs,
+    const database& db, 
+    const slice1d<float> query,
+    const int curr_index,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    assert(best_indices.size == best_costs.size);
+    
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    candidate_heap candidates;
+    candidate_heap_init(candidates, best_indices.size);
+    
+    // Search
+    motion_matching_search_topk(
+        candidates,
+        curr_index,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+    
+    candidate_heap_sort(candidates);
+    
+    for (int i = 0; i < candidates.size; i++)
+    {
+        best_indices(i) = candidates.indices(i);
+        best_costs(i) = candidates.costs(i);
+    }
+    
+    return candidates.size;
+}
+
+//--------------------------------------
+
+enum
+{
+    // Number of previous search results kept for warm starting
+    WARM_START_HISTORY = 4,
+    
+    // Frames either side of each advanced result also evaluated
+    WARM_START_NEIGHBOURS = 2,
+};
+
+// Results of the previous searches, used to seed the next search
+// with a tight best cost. Between searches the query changes very
+// little so the frames that matched well last time, advanced by
+// the frames played since, are usually close to the new best.
+struct search_warm_start
+{
+    int count;
+    array1d<int> indices;
+    
+    search_warm_start() : count(0), indices(WARM_START_HISTORY) {}
+};
+
+void search_warm_start_reset(search_warm_start& warm)
+{
+    warm.count = 0;
+}
+
+// Advance the previous results by the number of frames played since
+// the last search, dropping any which have left their range
+void search_warm_start_advance(
+    search_warm_start& warm,
+    const slice1d<int> range_stops,
+    const slice1d<int> frame_ranges,
+    const int elapsed_frames,
+    const int ignore_range_end)
+{
+    int count = 0;
+    for (int h = 0; h < warm.count; h++)
+    {
+        int frame = warm.indices(h);
+        int r = frame_ranges(frame);
+        
+        if (r != -1 && frame + elapsed_frames < range_stops(r) - ignore_range_end)
+        {
+            warm.indices(count) = frame + elapsed_frames;
+            count++;
+        }
+    }
+    
+    warm.count = count;
+}
+
+// Record a search result as the most recent entry in the history
+void search_warm_start_record(search_warm_start& warm, const int index)
+{
+    if (index == -1) { return; }
+    
+    // Move everything else down, dropping any duplicate of this index
+    int count = 0;
+    for (int h = 0; h < warm.count; h++)
+    {
+        if (warm.indices(h) != index) 
+        {
+            warm.indices(count) = warm.indices(h);
+            count++;
+        }
+    }
+    
+    count = count < WARM_START_HISTORY - 1 ? count : WARM_START_HISTORY - 1;
+    
+    for (int h = count; h > 0; h--)
+    {
+        warm.indices(h) = warm.indices(h - 1);
+    }
+    
+    warm.indices(0) = index;
+    warm.count = count + 1;
+}
+
+// Same as motion_matching_search but before sweeping the database
+// the previous results (advanced by the elapsed frames) and their
+// neighbours are evaluated first. The best of these becomes the
+// cost to beat, so the very first boxes tested are already pruned
+// against a tight bound rather than just the current frame.
+/*
+warm [in/out]          : 之前查询的结果，查询后会记录本次的结果
+elapsed_frames [in]    : 距离上次查询经过的帧数
+frame_ranges [in]      : 每一帧所在的range，见database_build_frame_ranges
+weights_squared [in]   : 同motion_matching_search_sweep，NULL表示权重都为1
+其他参数同motion_matching_search
+*/
+void motion_matching_search_warm(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    search_warm_start& warm,
+    const int elapsed_frames,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice1d<int> frame_ranges,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL,
+    const float* weights_squared = NULL)
+{
+    SEARCH_STATS_TIMER_START(stats);
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = search_frame_cost(query_normalized, features(best_index), 0.0f, FLT_MAX, NULL, weights_squared);
+    }
+    
+    search_warm_start_advance(warm, range_stops, frame_ranges, elapsed_frames, ignore_range_end);
+    
+    // Evaluate previous results and their neighbours
+    for (int h = 0; h < warm.count; h++)
+    {
+        // Neighbours must stay inside the searchable part of the same range
+        int r = frame_ranges(warm.indices(h));
+        int range_start = range_starts(r);
+        int range_end = range_stops(r) - ignore_range_end;
+        
+        for (int o = -WARM_START_NEIGHBOURS; o <= WARM_START_NEIGHBOURS; o++)
+        {
+            int i = warm.indices(h) + o;
+            
+            if (i < range_start || i >= range_end) { continue; }
+            
+            // Skip surrounding frames
+            if (curr_index != -1 && abs(i - curr_index) < ignore_surrounding) { continue; }
+            
+            float curr_cost = search_frame_cost(query_normalized, features(i), transition_cost, best_cost, NULL, weights_squared);
+            
+            if (curr_cost < best_cost)
+            {
+                best_index = i;
+                best_cost = curr_cost;
+            }
+        }
+    }
+    
+    // Search rest of database against the seeded cost
+    motion_matching_search_sweep(
+        best_index,
+        best_cost,
+        curr_index,
+        range_starts,
+        range_stops,
+        features,
+        bound_sm_min,
+        bound_sm_max,
+        bound_lr_min,
+        bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats,
+        weights_squared);
+    
+    search_warm_start_record(warm, best_index);
+    
+    SEARCH_STATS_TIMER_STOP(stats);
+}
+
+// Search database seeding the search with the previous results
+/*
+warm [in/out]          : 之前查询的结果，查询后会记录本次的结果
+elapsed_frames [in]    : 距离上次查询经过的帧数
+其他参数同database_search
+*/
+void database_search_warm(
+    int& best_index, 
+    float& best_cost, 
+    search_warm_start& warm,
+    const int elapsed_frames,
+    const database& db, 
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    // Search
+    motion_matching_search_warm(
+        best_index, 
+        best_cost, 
+        warm,
+        elapsed_frames,
+        db.range_starts,
+        db.range_stops,
+        db.frame_ranges,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Same as motion_matching_search but using boxes aligned to the
+// start of each range, see database_build_aligned_bounds. Because
+// the boxes only cover searchable frames `ignore_range_end` must be
+// at least the value the bounds were built with.
+/*
+bounds [in]            : 按range对齐的加速结构，见database_build_aligned_bounds
+其他参数同motion_matching_search
+*/
+void motion_matching_search_aligned(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const aligned_bounds& bounds,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    assert(ignore_range_end >= bounds.ignore_range_end);
+    
+    int nfeatures = query_normalized.size;
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+    
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_best sweep = {
+        best_index, best_cost, features,
+        bounds.sm_min, bounds.sm_max, bounds.lr_min, bounds.lr_max,
+        query_normalized, NULL, transition_cost, stats };
+    
+    // Search rest of database with boxes relative to each range start
+    for (int r = 0; r < range_starts.size; r++)
+    {
+        search_box_layout layout = { range_starts(r), bounds.lr_offsets(r), bounds.sm_offsets(r) };
+        
+        search_sweep(sweep, range_starts(r), range_stops(r) - ignore_range_end, 
+            layout, curr_index, ignore_surrounding, stats);
+    }
+}
+
+// Search database using range aligned bounds
+/*
+bounds [in]            : 按range对齐的加速结构，见database_build_aligned_bounds
+其他参数同database_search
+*/
+void database_search_aligned(
+    int& best_index, 
+    float& best_cost, 
+    const database& db, 
+    const aligned_bounds& bounds,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    // Search
+    motion_matching_search_aligned(
+        best_index, 
+        best_cost, 
+        bounds,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Scratch memory reused from one search to the next so that once
+// it has been initialized searching does not touch the heap. With
+// many characters each searching every few frames the allocation
+// of the normalized query otherwise shows up in profiles.
+/*
+    query_normalized : 标准化后并按features_order重新排列的query，标准化和重新排列在database_normalize_query中一步完成
+    candidates       : top-k查询使用，容量为k
+    weights_squared  : 按features_order排列的每一列权重的平方，database_search_weighted使用
+    stats            : 使用该context的所有查询的统计数据
+    allocations      : search_context_init之后查询中发生的内存分配次数，稳定运行时应该一直为0
+*/
+struct search_context
+{
+    array1d<float> query_normalized;
+    candidate_heap candidates;
+    array1d<float> weights_squared;
+    search_stats stats;
+    int allocations;
+    
+    search_context() : allocations(0) {}
+};
+
+// Size the buffers for searching `db` for up to `k` candidates
+void search_context_init(search_context& ctx, const database& db, const int k = 1)
+{
+    ctx.query_normalized.resize(db.nfeatures());
+    ctx.weights_squared.resize(db.nfeatures());
+    candidate_heap_init(ctx.candidates, k);
+    ctx.allocations = 0;
+}
+
+// Make sure the buffers have the sizes needed by a search, counting
+// any allocation this requires. Unless the sizes change this does
+// nothing after search_context_init.
+static inline void search_context_prepare(search_context& ctx, const int nfeatures, const int k)
+{
+    if (ctx.query_normalized.size != nfeatures)
+    {
+        ctx.query_normalized.resize(nfeatures);
+        ctx.allocations++;
+    }
+    
+    if (ctx.weights_squared.size != nfeatures)
+    {
+        ctx.weights_squared.resize(nfeatures);
+        ctx.allocations++;
+    }
+    
+    if (k > 0 && ctx.candidates.capacity() != k)
+    {
+        candidate_heap_init(ctx.candidates, k);
+        ctx.allocations++;
+    }
+    
+#if SEARCH_CONTEXT_ASSERT_NO_ALLOCATIONS
+    assert(ctx.allocations == 0);
+#endif
+}
+
+// Same as database_search but using the buffers of a search_context
+// and accumulating statistics into `ctx.stats`
+/*
+ctx [in/out]           : 查询使用的临时内存，见search_context_init
+其他参数同database_search
+*/
+void database_search(
+    int& best_index, 
+    float& best_cost, 
+    search_context& ctx,
+    const database& db, 
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20)
+{
+    search_context_prepare(ctx, db.nfeatures(), 0);
+    
+    // Normalize Query
+    database_normalize_query(ctx.query_normalized, db, query);
+    
+    // Search
+    motion_matching_search(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.features_offset,
+        db.features_scale,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        ctx.query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        &ctx.stats);
+}
+
+// Same as database_search_warm but using the buffers of a search_context
+/*
+ctx [in/out]           : 查询使用的临时内存，见search_context_init
+其他参数同database_search_warm
+*/
+void database_search_warm(
+    int& best_index, 
+    float& best_cost, 
+    search_context& ctx,
+    search_warm_start& warm,
+    const int elapsed_frames,
+    const database& db, 
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20)
+{
+    search_context_prepare(ctx, db.nfeatures(), 0);
+    
+    // Normalize Query
+    database_normalize_query(ctx.query_normalized, db, query);
+    
+    // Search
+    motion_matching_search_warm(
+        best_index, 
+        best_cost, 
+        warm,
+        elapsed_frames,
+        db.range_starts,
+        db.range_stops,
+        db.frame_ranges,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        ctx.query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        &ctx.stats);
+}
+
+// Same as database_search_topk but using the candidate heap of a 
+// search_context, which should be initialized with k = best_indices.size,
+// and accumulating statistics into `ctx.stats`
+/*
+ctx [in/out]           : 查询使用的临时内存，见search_context_init
+其他参数同database_search_topk
+*/
+int database_search_topk(
+    slice1d<int> best_indices,
+    slice1d<float> best_costs,
+    search_context& ctx,
+    const database& db, 
+    const slice1d<float> query,
+    const int curr_index,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20)
+{
+    assert(best_indices.size == best_costs.size);
+    
+    search_context_prepare(ctx, db.nfeatures(), best_indices.size);
+    
+    // Normalize Query
+    database_normalize_query(ctx.query_normalized, db, query);
+    
+    candidate_heap_clear(ctx.candidates);
+    
+    // Search
+    motion_matching_search_topk(
+        ctx.candidates,
+        curr_index,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        ctx.query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        &ctx.stats);
+    
+    candidate_heap_sort(ctx.candidates);
+    
+    for (int i = 0; i < ctx.candidates.size; i++)
+    {
+        best_indices(i) = ctx.candidates.indices(i);
+        best_costs(i) = ctx.candidates.costs(i);
+    }
+    
+    return ctx.candidates.size;
+}
+
+//--------------------------------------
 
-可以看到，query_normalized(j)仅仅和clampf上的自己做了一个比较，如果连这种方式计算出的cost比当前best_cost还大的话，那么bound里面的任何一个feature都比当前的都要大，就没有比较的必要了
+// A frame can be returned by a tagged search if it has all of
+// the required tags and none of the excluded tags
+static inline bool search_tags_match(const unsigned int tags, const unsigned int tags_required, const unsigned int tags_excluded)
+{
+    return (tags & tags_required) == tags_required && (tags & tags_excluded) == 0;
+}
 
-bound_sm_max [in]      : 同上
-bound_lr_min [in]      : 同上
-bound_lr_max [in]      : 同上
-query_normalized [in]  : 当前Pose和Trajectory的标准化数据
-transition_cost [in]   : Pose发生改变的固定消耗
-ignore_range_end [in]  : range末尾忽略的帧数，比如range范围为1-50，该参数20表示只考虑1-30的帧
-ignore_surrounding [in]: 忽略附近的帧数，比如当前帧使用的是50，该参数20表示30-70之间的帧都不考虑，这种方式能保证返回的帧肯定不是当前帧
+// A box can only contain such a frame if, between them, its frames
+// have all of the required tags and not every one of them has an
+// excluded tag
+static inline bool search_tags_match_box(const unsigned int tags_any, const unsigned int tags_all, const unsigned int tags_required, const unsigned int tags_excluded)
+{
+    return (tags_any & tags_required) == tags_required && (tags_all & tags_excluded) == 0;
+}
+
+// Sweep for motion_matching_search_tagged, which skips boxes and
+// frames with the wrong tags before finding their cost
+struct search_sweep_tagged
+{
+    search_sweep_best full;
+    const slice1d<unsigned int> frame_tags;
+    const slice1d<unsigned int> bound_sm_tags_any;
+    const slice1d<unsigned int> bound_sm_tags_all;
+    const slice1d<unsigned int> bound_lr_tags_any;
+    const slice1d<unsigned int> bound_lr_tags_all;
+    const unsigned int tags_required;
+    const unsigned int tags_excluded;
+    
+    bool prune_lr(const int i_lr) const
+    {
+        return !search_tags_match_box(bound_lr_tags_any(i_lr), bound_lr_tags_all(i_lr), tags_required, tags_excluded) || full.prune_lr(i_lr);
+    }
+    
+    bool prune_sm(const int i_sm) const
+    {
+        return !search_tags_match_box(bound_sm_tags_any(i_sm), bound_sm_tags_all(i_sm), tags_required, tags_excluded) || full.prune_sm(i_sm);
+    }
+    
+    void frame(const int i)
+    {
+        if (search_tags_match(frame_tags(i), tags_required, tags_excluded))
+        {
+            full.frame(i);
+        }
+    }
+};
+
+// Same as motion_matching_search but only returns frames whose
+// tags match, so that a single database can be searched for just
+// idles, just locomotion, etc. Boxes without any matching frames
+// are skipped before computing any distance. If the current frame
+// does not match it is not used as the cost to beat, and if no 
+// frame matches `best_index` is left as it was given.
+/*
+frame_tags [in]        : 每一帧的tag，见db.frame_tags
+bound_sm_tags_any [in] : 小box的tag按位或，见database_build_bounds
+bound_sm_tags_all [in] : 小box的tag按位与
+bound_lr_tags_any [in] : 大box的tag按位或
+bound_lr_tags_all [in] : 大box的tag按位与
+tags_required [in]     : 帧必须包含的所有tag，0表示不限制
+tags_excluded [in]     : 帧不能包含的tag，0表示不限制
+其他参数同motion_matching_search
 */
-void motion_matching_search(
+void motion_matching_search_tagged(
     int&   _restrict best_index,
     float& _restrict best_cost,
     const slice1d<int> range_starts,
     const slice1d<int> range_stops,
     const slice2d<float> features,
-    const slice1d<float> features_offset,
-    const slice1d<float> features_scale,
+    const slice1d<unsigned int> frame_tags,
     const slice2d<float> bound_sm_min,
     const slice2d<float> bound_sm_max,
     const slice2d<float> bound_lr_min,
     const slice2d<float> bound_lr_max,
+    const slice1d<unsigned int> bound_sm_tags_any,
+    const slice1d<unsigned int> bound_sm_tags_all,
+    const slice1d<unsigned int> bound_lr_tags_any,
+    const slice1d<unsigned int> bound_lr_tags_all,
     const slice1d<float> query_normalized,
+    const unsigned int tags_required,
+    const unsigned int tags_excluded,
     const float transition_cost,
     const int ignore_range_end,
-    const int ignore_surrounding)
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
 {
     int nfeatures = query_normalized.size;
-    int nranges = range_starts.size;
     
     int curr_index = best_index;
     
     // Find cost for current frame
-    if (best_index != -1)
+    if (best_index != -1 && search_tags_match(frame_tags(best_index), tags_required, tags_excluded))
     {
         best_cost = 0.0;
         for (int i = 0; i < nfeatures; i++)
@@ -808,145 +3994,422 @@ void motion_matching_search(
         }
     }
     
-    float curr_cost = 0.0f;
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_tagged sweep = {
+        { best_index, best_cost, features,
+          bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+          query_normalized, NULL, transition_cost, stats },
+        frame_tags, bound_sm_tags_any, bound_sm_tags_all, bound_lr_tags_any, bound_lr_tags_all,
+        tags_required, tags_excluded };
     
     // Search rest of database
-    for (int r = 0; r < nranges; r++)
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Search database only considering frames with matching tags
+/*
+tags_required [in]     : 帧必须包含的所有tag(DATABASE_TAG_*)，0表示不限制
+tags_excluded [in]     : 帧不能包含的tag，0表示不限制
+其他参数同database_search
+*/
+void database_search_tagged(
+    int& best_index, 
+    float& best_cost, 
+    const database& db, 
+    const slice1d<float> query,
+    const unsigned int tags_required,
+    const unsigned int tags_excluded = 0,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    // Search
+    motion_matching_search_tagged(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.frame_tags,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        db.bound_sm_tags_any,
+        db.bound_sm_tags_all,
+        db.bound_lr_tags_any,
+        db.bound_lr_tags_all,
+        query_normalized,
+        tags_required,
+        tags_excluded,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Sweep for motion_matching_search_half, where a frame is a box
+// with the same min and max
+struct search_sweep_half
+{
+    int& best_index;
+    float& best_cost;
+    const slice2d<half> features_half;
+    const slice2d<half> bound_sm_min_half;
+    const slice2d<half> bound_sm_max_half;
+    const slice2d<half> bound_lr_min_half;
+    const slice2d<half> bound_lr_max_half;
+    const float* query;
+    const int ncols;
+    const float transition_cost;
+    const simd_level level;
+    search_stats* stats;
+    
+    bool prune_lr(const int i_lr) const
     {
-        // Exclude end of ranges from search    
-        int i = range_starts(r);
-        int range_end = range_stops(r) - ignore_range_end;
+        return half_box_cost(
+            &bound_lr_min_half(i_lr, 0), &bound_lr_max_half(i_lr, 0), query, ncols, transition_cost, best_cost, level) >= best_cost;
+    }
+    
+    bool prune_sm(const int i_sm) const
+    {
+        return half_box_cost(
+            &bound_sm_min_half(i_sm, 0), &bound_sm_max_half(i_sm, 0), query, ncols, transition_cost, best_cost, level) >= best_cost;
+    }
+    
+    void frame(const int i)
+    {
+        int cols_visited = 0;
+        float cost = half_box_cost(
+            &features_half(i, 0), &features_half(i, 0), query, ncols, transition_cost, best_cost, level, &cols_visited);
         
-        while (i < range_end)
+        SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+        SEARCH_STATS_ADD(stats, frame_dims_visited, cols_visited);
+        
+        // If cost is lower than current best then update best
+        if (cost < best_cost)
         {
-            // Find index of current and next large box
-            int i_lr = i / BOUND_LR_SIZE;
-            int i_lr_next = (i_lr + 1) * BOUND_LR_SIZE;
-            
-			// Find distance to box
-            curr_cost = transition_cost;
-            for (int j = 0; j < nfeatures; j++)
-            {
-                curr_cost += squaref(query_normalized(j) - clampf(query_normalized(j), 
-                    bound_lr_min(i_lr, j), bound_lr_max(i_lr, j)));
-                
-                if (curr_cost >= best_cost)
-                {
-                    break;
-                }
-            }
-            
-			// If distance is greater than current best jump to next box
-            if (curr_cost >= best_cost)
-            {
-                i = i_lr_next;
-                continue;
-            }
-            
-			// Check against small box
-            while (i < i_lr_next && i < range_end)
-            {   
-                // Find index of current and next small box
-                int i_sm = i / BOUND_SM_SIZE;
-                int i_sm_next = (i_sm + 1) * BOUND_SM_SIZE;
-                
-				// Find distance to box
-                curr_cost = transition_cost;
-                for (int j = 0; j < nfeatures; j++)
-                {
-                    curr_cost += squaref(query_normalized(j) - clampf(query_normalized(j), 
-                        bound_sm_min(i_sm, j), bound_sm_max(i_sm, j)));
-                    
-                    if (curr_cost >= best_cost)
-                    {
-                        break;
-                    }
-                }
-                
-				// If distance is greater than current best jump to next box
-                if (curr_cost >= best_cost)
-                {
-                    i = i_sm_next;
-                    continue;
-                }
-                
-				// Search inside small box
-                while (i < i_sm_next && i < range_end)
-                {
-                    // Skip surrounding frames
-                    if (curr_index != - 1 && abs(i - curr_index) < ignore_surrounding)
-                    {
-                        i++;
-                        continue;
-                    }
-                    
-                    // Check against each frame inside small box
-                    curr_cost = transition_cost;
-                    for (int j = 0; j < nfeatures; j++)
-                    {
-                        curr_cost += squaref(query_normalized(j) - features(i, j));
-                        if (curr_cost >= best_cost)
-                        {
-                            break;
-                        }
-                    }
-                    
-					// If cost is lower than current best then update best
-                    if (curr_cost < best_cost)
-                    {
-                        best_index = i;
-                        best_cost = curr_cost;
-                    }
-                    
-                    i++;
-                }
-            }
+            best_index = i;
+            best_cost = cost;
         }
     }
+};
+
+// Same as motion_matching_search but over the half precision 
+// features and bounds, which halves the memory read by the search.
+// The result is exact for the features rounded to half precision,
+// which is almost always the same frame as the float search.
+/*
+features_half [in]     : 半精度features，见db.features_half
+bound_*_half [in]      : 半精度box，见db.bound_sm_min_half
+query_normalized [in]  : 标准化后的query，长度与features_half的列数相同，多出来的部分为0
+level [in]             : 使用的指令集，AVX2时使用F16C转换
+其他参数同motion_matching_search
+*/
+void motion_matching_search_half(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<half> features_half,
+    const slice2d<half> bound_sm_min_half,
+    const slice2d<half> bound_sm_max_half,
+    const slice2d<half> bound_lr_min_half,
+    const slice2d<half> bound_lr_max_half,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    const simd_level level,
+    search_stats* stats = NULL)
+{
+    assert(query_normalized.size == features_half.cols);
+    
+    int ncols = features_half.cols;
+    const float* query = query_normalized.data;
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = half_box_cost(
+            &features_half(best_index, 0), &features_half(best_index, 0), query, ncols, 0.0f, FLT_MAX, level);
+    }
+    
+    SEARCH_STATS_ADD(stats, searches, 1);
+    
+    search_sweep_half sweep = {
+        best_index, best_cost, features_half,
+        bound_sm_min_half, bound_sm_max_half, bound_lr_min_half, bound_lr_max_half,
+        query, ncols, transition_cost, level, stats };
+    
+    // Search rest of database
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
 }
 
-// Search database
+// Search database using the half precision features
 /*
-MotionMatching的核心，查询相似帧并且返回
-best_index [in/out]    : 一般情况下传入当前frame_index即可，假如当前frame已经是末尾帧了，传入-1即可
-best_cost [in/out]     : 传入FLT_MAX即可
-db [in]
-query [in]             : 当前Pose和Trajectory的未标准化数据
-transition_cost [in]   : Pose发生改变的固定消耗
-ignore_range_end [in]  : range末尾忽略的帧数，比如range范围为1-50，该参数20表示只考虑1-30的帧
-ignore_surrounding [in]: 忽略附近的帧数，比如当前帧使用的是50，该参数20表示30-70之间的帧都不考虑，这种方式能保证返回的帧肯定不是当前帧
+与database_search相同，但使用motion_matching_search_half，要求构建时build_half为true
+level [in]             : 使用的指令集，默认使用CPU支持的最宽指令集
 */
-void database_search(
+void database_search_half(
     int& best_index, 
     float& best_cost, 
     const database& db, 
     const slice1d<float> query,
     const float transition_cost = 0.0f,
     const int ignore_range_end = 20,
-    const int ignore_surrounding = 20)
+    const int ignore_surrounding = 20,
+    const simd_level level = simd_level_detect(),
+    search_stats* stats = NULL)
 {
-    // Normalize Query
-    array1d<float> query_normalized(db.nfeatures());
-    for (int i = 0; i < db.nfeatures(); i++)
+    assert(db.features_half.rows == db.nframes());
+    
+    // Normalize Query, padding to the width of the half features
+    array1d<float> query_normalized(db.features_half.cols);
+    query_normalized.zero();
+    database_normalize_query(slice1d<float>(db.nfeatures(), query_normalized.data), db, query);
+    
+    // Search
+    motion_matching_search_half(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_half,
+        db.bound_sm_min_half,
+        db.bound_sm_max_half,
+        db.bound_lr_min_half,
+        db.bound_lr_max_half,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        level,
+        stats);
+}
+
+//--------------------------------------
+
+// Find the squared weight of each column of features_ordered from a
+// weight per feature group. Searching features built with all weights
+// set to one using these gives the same costs as building the features
+// with the weights, so weights can be changed at any time, per
+// character or per state, without rebuilding the database.
+/*
+weights_squared [out]  : 长度为Features Number，按features_order排列的每一列权重的平方
+group_weights [in]     : 长度为FEATURE_GROUP_COUNT，每个group的权重，见FEATURE_GROUP_*
+*/
+void database_feature_weights(
+    slice1d<float> weights_squared,
+    const database& db,
+    const slice1d<float> group_weights)
+{
+    assert(group_weights.size == FEATURE_GROUP_COUNT);
+    
+    for (int k = 0; k < db.nfeatures(); k++)
+    {
+        weights_squared(k) = squaref(group_weights(db.features_group(db.features_order(k))));
+    }
+}
+
+// Same as motion_matching_search but each dimension of the cost is
+// multiplied by the squared weight of its column. The boxes are built
+// over the unweighted features but scaling every dimension of both the
+// box and the query by the same weight keeps the box distance a lower
+// bound so pruning is unchanged.
+/*
+weights_squared [in]   : 按features_order排列的每一列权重的平方，见database_feature_weights
+其他参数同motion_matching_search
+*/
+void motion_matching_search_weighted(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const slice1d<float> weights_squared,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    SEARCH_STATS_TIMER_START(stats);
+    
+    int curr_index = best_index;
+    
+    // Find cost for current frame
+    if (best_index != -1)
     {
-        query_normalized(i) = (query(i) - db.features_offset(i)) / db.features_scale(i);
+        best_cost = search_frame_cost(query_normalized, features(best_index), 0.0f, FLT_MAX, NULL, weights_squared.data);
     }
     
+    // Search rest of database
+    motion_matching_search_sweep(
+        best_index,
+        best_cost,
+        curr_index,
+        range_starts,
+        range_stops,
+        features,
+        bound_sm_min,
+        bound_sm_max,
+        bound_lr_min,
+        bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats,
+        weights_squared.data);
+    
+    SEARCH_STATS_TIMER_STOP(stats);
+}
+
+// Search database using a weight per feature group given at search
+// time. The database should be built with all weights set to one,
+// any weights it was built with are multiplied by these. Columns are
+// still visited in features_order, so building it with the weights
+// usually given here (order_weights of database_build_matching_features)
+// keeps the early-out as effective as with weights built into the features.
+/*
+group_weights [in]     : 长度为FEATURE_GROUP_COUNT，每个group的权重，见database_feature_weights
+其他参数同database_search
+*/
+void database_search_weighted(
+    int& best_index, 
+    float& best_cost, 
+    const database& db, 
+    const slice1d<float> group_weights,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+    
+    array1d<float> weights_squared(db.nfeatures());
+    database_feature_weights(weights_squared, db, group_weights);
+    
     // Search
-    motion_matching_search(
+    motion_matching_search_weighted(
         best_index, 
         best_cost, 
         db.range_starts,
         db.range_stops,
-        db.features,
-        db.features_offset,
-        db.features_scale,
+        db.features_ordered,
         db.bound_sm_min,
         db.bound_sm_max,
         db.bound_lr_min,
         db.bound_lr_max,
         query_normalized,
+        weights_squared,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+// Same as database_search_weighted but using the buffers of a search_context
+/*
+ctx [in/out]           : 查询使用的临时内存，见search_context_init
+其他参数同database_search_weighted
+*/
+void database_search_weighted(
+    int& best_index, 
+    float& best_cost, 
+    search_context& ctx,
+    const database& db, 
+    const slice1d<float> group_weights,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20)
+{
+    search_context_prepare(ctx, db.nfeatures(), 0);
+    
+    // Normalize Query
+    database_normalize_query(ctx.query_normalized, db, query);
+    database_feature_weights(ctx.weights_squared, db, group_weights);
+    
+    // Search
+    motion_matching_search_weighted(
+        best_index, 
+        best_cost, 
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        ctx.query_normalized,
+        ctx.weights_squared,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        &ctx.stats);
+}
+
+// Same as database_search_warm but using weights given at search time
+/*
+group_weights [in]     : 长度为FEATURE_GROUP_COUNT，每个group的权重，见database_feature_weights
+其他参数同database_search_warm
+*/
+void database_search_warm_weighted(
+    int& best_index, 
+    float& best_cost, 
+    search_context& ctx,
+    search_warm_start& warm,
+    const int elapsed_frames,
+    const database& db, 
+    const slice1d<float> group_weights,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20)
+{
+    search_context_prepare(ctx, db.nfeatures(), 0);
+    
+    // Normalize Query
+    database_normalize_query(ctx.query_normalized, db, query);
+    database_feature_weights(ctx.weights_squared, db, group_weights);
+    
+    // Search
+    motion_matching_search_warm(
+        best_index, 
+        best_cost, 
+        warm,
+        elapsed_frames,
+        db.range_starts,
+        db.range_stops,
+        db.frame_ranges,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        ctx.query_normalized,
         transition_cost,
         ignore_range_end,
-        ignore_surrounding);
-}
\ No newline at end of file
+        ignore_surrounding,
+        &ctx.stats,
+        ctx.weights_squared.data);
+}
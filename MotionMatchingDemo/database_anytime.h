@@ -0,0 +1,257 @@
+#pragma once
+
+#include "database.h"
+
+#include <algorithm>
+#include <chrono>
+
+//--------------------------------------
+
+// State of a search which can be spread over several ticks. The
+// ranges are cut into segments, each the part of a range covered
+// by one large box, and segments are visited closest to the query
+// first so the best matches are usually found early on. Once the
+// distance to the closest segment left is no better than the best
+// cost found every remaining segment can be skipped and the search
+// is complete.
+//
+// Finding the distance to every segment is itself a fair amount of
+// work so it is done one range at a time, interleaved with visiting
+// the closest segment found so far. This way the best cost drops
+// quickly and most segments of later ranges are never added at all.
+/*
+    query_normalized   : 开始查询时标准化后的query，之后的每次continue都使用它
+    next_range         : 下一个需要计算segment距离的range，等于nranges时所有segment都已经加入seg_heap
+    seg_starts         : 每个segment的第一帧
+    seg_stops          : 每个segment最后一帧的下一帧
+    seg_costs          : query到每个segment所在的大box的距离(包含transition_cost)
+    seg_heap           : 还没有访问的segment索引，按seg_costs排列的最小堆，距离已经超过best_cost的segment不会加入
+    nheap              : seg_heap中segment的数量
+*/
+struct search_anytime
+{
+    array1d<float> query_normalized;
+    int nranges;
+    int next_range;
+    array1d<int> seg_starts;
+    array1d<int> seg_stops;
+    array1d<float> seg_costs;
+    array1d<int> seg_heap;
+    int nsegments;
+    int nheap;
+
+    int curr_index;
+    int best_index;
+    float best_cost;
+    float transition_cost;
+    int ignore_range_end;
+    int ignore_surrounding;
+
+    search_anytime() :
+        nranges(0),
+        next_range(0),
+        nsegments(0),
+        nheap(0),
+        curr_index(-1),
+        best_index(-1),
+        best_cost(FLT_MAX),
+        transition_cost(0.0f),
+        ignore_range_end(0),
+        ignore_surrounding(0) {}
+};
+
+// Orders the heap so the closest segment is on top, ties in database order
+struct search_anytime_farther
+{
+    const search_anytime& search;
+
+    bool operator()(const int a, const int b) const
+    {
+        return search.seg_costs(a) > search.seg_costs(b) ||
+              (search.seg_costs(a) == search.seg_costs(b) && a > b);
+    }
+};
+
+static inline bool search_anytime_done(const search_anytime& search)
+{
+    return search.next_range >= search.nranges && (search.nheap == 0 ||
+        search.seg_costs(search.seg_heap(0)) >= search.best_cost);
+}
+
+// Start a new search, discarding any search not yet finished. This
+// only finds the cost of the current frame, all other work is left
+// to database_search_anytime_continue.
+/*
+search [out]           : 查询状态，之后传给database_search_anytime_continue
+curr_index [in]        : 当前帧，假如当前frame已经是末尾帧了，传入-1即可
+其他参数同database_search
+*/
+void database_search_anytime_begin(
+    search_anytime& search,
+    const database& db,
+    const slice1d<float> query,
+    const int curr_index,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    int nfeatures = db.nfeatures();
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    // Normalize Query
+    search.query_normalized.resize(nfeatures);
+    database_normalize_query(search.query_normalized, db, query);
+
+    search.curr_index = curr_index;
+    search.best_index = curr_index;
+    search.best_cost = FLT_MAX;
+    search.transition_cost = transition_cost;
+    search.ignore_range_end = ignore_range_end;
+    search.ignore_surrounding = ignore_surrounding;
+
+    // Find cost for current frame
+    if (curr_index != -1)
+    {
+        search.best_cost = 0.0f;
+        for (int j = 0; j < nfeatures; j++)
+        {
+            search.best_cost += squaref(search.query_normalized(j) - db.features_ordered(curr_index, j));
+        }
+    }
+
+    // Enough space for every segment of every range
+    int nsegments_max = db.bound_lr_min.rows + db.nranges();
+    search.seg_starts.resize(nsegments_max);
+    search.seg_stops.resize(nsegments_max);
+    search.seg_costs.resize(nsegments_max);
+    search.seg_heap.resize(nsegments_max);
+    search.nranges = db.nranges();
+    search.next_range = 0;
+    search.nsegments = 0;
+    search.nheap = 0;
+}
+
+// Find the distance to each segment of a range, dropping those
+// which can't beat the best cost found so far
+static inline void search_anytime_add_range(
+    search_anytime& search,
+    const database& db,
+    const int r,
+    search_stats* stats)
+{
+    int i = db.range_starts(r);
+    int range_end = db.range_stops(r) - search.ignore_range_end;
+
+    while (i < range_end)
+    {
+        int i_lr = i / BOUND_LR_SIZE;
+        int i_lr_next = (i_lr + 1) * BOUND_LR_SIZE;
+
+        float curr_cost = search_box_cost(search.query_normalized,
+            db.bound_lr_min(i_lr), db.bound_lr_max(i_lr), search.transition_cost, search.best_cost);
+
+        SEARCH_STATS_ADD(stats, lr_boxes_tested, 1);
+        if (curr_cost >= search.best_cost)
+        {
+            SEARCH_STATS_ADD(stats, lr_boxes_pruned, 1);
+        }
+        else
+        {
+            int s = search.nsegments;
+            search.seg_starts(s) = i;
+            search.seg_stops(s) = i_lr_next < range_end ? i_lr_next : range_end;
+            search.seg_costs(s) = curr_cost;
+            search.nsegments++;
+
+            search.seg_heap(search.nheap) = s;
+            search.nheap++;
+            std::push_heap(search.seg_heap.data, search.seg_heap.data + search.nheap, search_anytime_farther{ search });
+        }
+
+        i = i_lr_next;
+    }
+}
+
+// Search all the frames of a segment
+static inline void search_anytime_visit_segment(
+    search_anytime& search,
+    const database& db,
+    const int s,
+    search_stats* stats)
+{
+    search_sweep_best sweep = {
+        search.best_index, search.best_cost, db.features_ordered,
+        db.bound_sm_min, db.bound_sm_max, db.bound_lr_min, db.bound_lr_max,
+        search.query_normalized, NULL, search.transition_cost, stats };
+
+    // Segments never cross a large box
+    search_sweep_small_boxes(sweep, search.seg_starts(s), search.seg_stops(s),
+        search_box_layout_default, search.curr_index, search.ignore_surrounding, stats);
+}
+
+// Continue a search started by database_search_anytime_begin until
+// it is complete or the budget runs out. The best frame found so
+// far is returned either way, and calling this again on the next
+// tick carries on where it stopped. A complete search returns a
+// frame with the same cost as database_search would.
+//
+// Each step adds the segments of one range, if any are left, and
+// visits the closest segment. The budget is only checked between
+// steps so it can be overrun by the time taken for one of them.
+/*
+best_index [out]       : 目前找到的最好的帧
+best_cost [out]        : 目前找到的最好的帧的cost
+search [in/out]        : 查询状态，见database_search_anytime_begin
+budget_us [in]         : 本次最多使用的时间(微秒)，小于0表示不限制
+budget_steps [in]      : 本次最多执行的步数，每一步加入一个range的segment并访问最近的一个segment，小于0表示不限制
+返回值                 : 查询是否已经完成
+*/
+bool database_search_anytime_continue(
+    int& best_index,
+    float& best_cost,
+    search_anytime& search,
+    const database& db,
+    const float budget_us,
+    const int budget_steps = -1,
+    search_stats* stats = NULL)
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    int steps = 0;
+
+    while (!search_anytime_done(search))
+    {
+        // Stop when out of budget, always making some progress
+        if (steps > 0)
+        {
+            if (budget_steps >= 0 && steps >= budget_steps) { break; }
+
+            if (budget_us >= 0.0f && std::chrono::duration<float, std::micro>(
+                std::chrono::steady_clock::now() - start_time).count() >= budget_us) { break; }
+        }
+
+        if (search.next_range < search.nranges)
+        {
+            search_anytime_add_range(search, db, search.next_range, stats);
+            search.next_range++;
+        }
+
+        if (search.nheap > 0 && search.seg_costs(search.seg_heap(0)) < search.best_cost)
+        {
+            int s = search.seg_heap(0);
+            std::pop_heap(search.seg_heap.data, search.seg_heap.data + search.nheap, search_anytime_farther{ search });
+            search.nheap--;
+
+            search_anytime_visit_segment(search, db, s, stats);
+        }
+
+        steps++;
+    }
+
+    best_index = search.best_index;
+    best_cost = search.best_cost;
+
+    return search_anytime_done(search);
+}
@@ -0,0 +1,510 @@
+#pragma once
+
+#include "database.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+//--------------------------------------
+
+enum
+{
+    // Number of clusters used by default
+    CLUSTER_COUNT_DEFAULT = 256,
+
+    // Number of k-means iterations used when building the index
+    CLUSTER_ITERATIONS_DEFAULT = 10,
+
+    // K-means is trained on at most this many frames spread evenly
+    // over the database, all frames are then assigned to the closest
+    // centroid. This keeps building fast for very large databases.
+    CLUSTER_TRAIN_FRAMES_MAX = 65536,
+};
+
+// Frames clustered by their features using k-means. Unlike the boxes
+// built by database_build_bounds, which cover frames next to each
+// other in the database, a cluster gathers similar frames from any
+// clip so it prunes well even when clips contain very different
+// motion. Frames of each cluster are stored contiguously, sorted by
+// their distance to the centroid, so both whole clusters and single
+// frames can be pruned with the triangle inequality:
+//
+//     |query - frame| >= |query - centroid| - |frame - centroid|
+//
+/*
+    centroids        : 每个cluster的中心，rows为Clusters，cols为Features Number，列顺序与features_ordered相同
+    radii            : 每个cluster中的帧到中心的最大距离
+    cluster_starts   : 每个cluster在frames中的第一个位置
+    cluster_stops    : 每个cluster在frames中最后一个位置的下一个位置
+    frames           : 按cluster排列的帧索引，cluster内按到中心的距离从小到大排列，只包含属于某个range的帧
+    frame_dists      : frames中每一帧到所在cluster中心的距离
+    features         : 按frames顺序排列的features_ordered
+*/
+struct cluster_index
+{
+    array2d<float> centroids;
+    array1d<float> radii;
+    array1d<int> cluster_starts;
+    array1d<int> cluster_stops;
+    array1d<int> frames;
+    array1d<float> frame_dists;
+    array2d<float> features;
+
+    int nclusters() const { return centroids.rows; }
+};
+
+static inline float cluster_distance_squared(const slice1d<float> a, const slice1d<float> b)
+{
+    float sum = 0.0f;
+    for (int j = 0; j < a.size; j++)
+    {
+        sum += squaref(a(j) - b(j));
+    }
+    return sum;
+}
+
+// Lower bounds of |query - frame| from float distances to a centroid.
+// Each distance is only known to within `error` times itself, and that
+// error does not shrink when the two distances are subtracted, so the
+// error of both is taken off rather than scaling their difference.
+static inline float cluster_bound_frame(const float query_dist, const float frame_dist, const float error)
+{
+    return maxf(maxf(
+        query_dist * (1.0f - error) - frame_dist * (1.0f + error),
+        frame_dist * (1.0f - error) - query_dist * (1.0f + error)), 0.0f);
+}
+
+// Same for any frame of a cluster of the given radius
+static inline float cluster_bound_cluster(const float query_dist, const float radius, const float error)
+{
+    return maxf(query_dist * (1.0f - error) - radius * (1.0f + error), 0.0f);
+}
+
+static inline int cluster_closest(const slice2d<float> centroids, const slice1d<float> x)
+{
+    int best = 0;
+    float best_dist = FLT_MAX;
+    for (int c = 0; c < centroids.rows; c++)
+    {
+        float dist = cluster_distance_squared(centroids(c), x);
+        if (dist < best_dist)
+        {
+            best = c;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+// Build the cluster index over db.features_ordered using k-means
+void cluster_index_build(
+    cluster_index& index,
+    const database& db,
+    const int nclusters = CLUSTER_COUNT_DEFAULT,
+    const int iterations = CLUSTER_ITERATIONS_DEFAULT,
+    unsigned int seed = 12345)
+{
+    int nfeatures = db.nfeatures();
+
+    // Gather frames which can be searched
+    array1d<int> searchable(db.nframes());
+    int nsearchable = 0;
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        if (db.frame_ranges(i) != -1)
+        {
+            searchable(nsearchable) = i;
+            nsearchable++;
+        }
+    }
+
+    assert(nclusters > 0 && nclusters <= nsearchable);
+
+    // Pick training frames spread evenly over the database
+    int ntrain = nsearchable < CLUSTER_TRAIN_FRAMES_MAX ? nsearchable : CLUSTER_TRAIN_FRAMES_MAX;
+    array1d<int> train(ntrain);
+    for (int t = 0; t < ntrain; t++)
+    {
+        train(t) = searchable((int)(((long long)t * nsearchable) / ntrain));
+    }
+
+    // Initialize centroids with random training frames
+    index.centroids.resize(nclusters, nfeatures);
+    for (int c = 0; c < nclusters; c++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int i = train((int)(seed % (unsigned int)ntrain));
+        for (int j = 0; j < nfeatures; j++)
+        {
+            index.centroids(c, j) = db.features_ordered(i, j);
+        }
+    }
+
+    // Lloyd iterations
+    array2d<double> sums(nclusters, nfeatures);
+    array1d<int> counts(nclusters);
+
+    for (int it = 0; it < iterations; it++)
+    {
+        sums.zero();
+        counts.zero();
+
+        for (int t = 0; t < ntrain; t++)
+        {
+            int c = cluster_closest(index.centroids, db.features_ordered(train(t)));
+            for (int j = 0; j < nfeatures; j++)
+            {
+                sums(c, j) += db.features_ordered(train(t), j);
+            }
+            counts(c)++;
+        }
+
+        // Empty clusters keep their previous centroid
+        for (int c = 0; c < nclusters; c++)
+        {
+            if (counts(c) == 0) { continue; }
+
+            for (int j = 0; j < nfeatures; j++)
+            {
+                index.centroids(c, j) = (float)(sums(c, j) / counts(c));
+            }
+        }
+    }
+
+    // Assign every searchable frame to its closest centroid
+    array1d<int> assignment(nsearchable);
+    array1d<float> dists(nsearchable);
+    counts.zero();
+
+    for (int s = 0; s < nsearchable; s++)
+    {
+        int c = cluster_closest(index.centroids, db.features_ordered(searchable(s)));
+        assignment(s) = c;
+        dists(s) = sqrtf(cluster_distance_squared(index.centroids(c), db.features_ordered(searchable(s))));
+        counts(c)++;
+    }
+
+    // Store frames of each cluster contiguously
+    index.cluster_starts.resize(nclusters);
+    index.cluster_stops.resize(nclusters);
+
+    int offset = 0;
+    for (int c = 0; c < nclusters; c++)
+    {
+        index.cluster_starts(c) = offset;
+        index.cluster_stops(c) = offset;
+        offset += counts(c);
+    }
+
+    index.frames.resize(nsearchable);
+    index.frame_dists.resize(nsearchable);
+
+    for (int s = 0; s < nsearchable; s++)
+    {
+        int c = assignment(s);
+        index.frames(index.cluster_stops(c)) = searchable(s);
+        index.frame_dists(index.cluster_stops(c)) = dists(s);
+        index.cluster_stops(c)++;
+    }
+
+    // Sort frames of each cluster by distance to the centroid
+    index.radii.resize(nclusters);
+
+    array1d<int> order(nsearchable);
+    for (int c = 0; c < nclusters; c++)
+    {
+        int start = index.cluster_starts(c);
+        int stop = index.cluster_stops(c);
+
+        for (int k = start; k < stop; k++)
+        {
+            order(k) = k;
+        }
+
+        std::sort(order.data + start, order.data + stop, [&](const int a, const int b)
+        {
+            return index.frame_dists(a) < index.frame_dists(b) ||
+                  (index.frame_dists(a) == index.frame_dists(b) && index.frames(a) < index.frames(b));
+        });
+
+        index.radii(c) = stop > start ? index.frame_dists(order(stop - 1)) : 0.0f;
+    }
+
+    array1d<int> frames_sorted(nsearchable);
+    array1d<float> dists_sorted(nsearchable);
+    for (int k = 0; k < nsearchable; k++)
+    {
+        frames_sorted(k) = index.frames(order(k));
+        dists_sorted(k) = index.frame_dists(order(k));
+    }
+
+    index.frames = frames_sorted;
+    index.frame_dists = dists_sorted;
+
+    index.features.resize(nsearchable, nfeatures);
+    for (int k = 0; k < nsearchable; k++)
+    {
+        for (int j = 0; j < nfeatures; j++)
+        {
+            index.features(k, j) = db.features_ordered(index.frames(k), j);
+        }
+    }
+}
+
+size_t cluster_index_memory(const cluster_index& index)
+{
+    return
+        sizeof(float) * index.centroids.rows * index.centroids.cols +
+        sizeof(float) * index.radii.size +
+        sizeof(int) * index.cluster_starts.size +
+        sizeof(int) * index.cluster_stops.size +
+        sizeof(int) * index.frames.size +
+        sizeof(float) * index.frame_dists.size +
+        sizeof(float) * index.features.rows * index.features.cols;
+}
+
+//--------------------------------------
+
+// Same as motion_matching_search but using a cluster index instead
+// of the boxes. Clusters are visited closest first and the search
+// stops as soon as the closest cluster left can't beat the best cost.
+// When several frames have exactly the same cost the one found might
+// differ from motion_matching_search, otherwise the result is the same:
+// the bounds allow for the rounding of the distances to the centroids
+// (see cluster_bound_frame) and of the full cost (search_rounding_error)
+// so a frame is only pruned when its full cost can't beat the best.
+/*
+index [in]             : 加速结构，见cluster_index_build
+cluster_order [out]    : 长度为Clusters，用于按距离下界排列cluster
+cluster_costs [out]    : 长度为Clusters，query到每个cluster中心的距离
+range_stops [in]       : 每个range最后一帧的下一帧
+frame_ranges [in]      : 每一帧所在的range，见database_build_frame_ranges
+其他参数同motion_matching_search
+*/
+void motion_matching_search_cluster(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const cluster_index& index,
+    slice1d<int> cluster_order,
+    slice1d<float> cluster_costs,
+    const slice1d<int> range_stops,
+    const slice1d<int> frame_ranges,
+    const slice2d<float> features,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    int nfeatures = query_normalized.size;
+    int nclusters = index.nclusters();
+
+    int curr_index = best_index;
+
+    // Relative error of the distances to the centroids and of the
+    // full cost, with a few operations of slack for the bounds
+    float dist_error = search_rounding_error(nfeatures + 8);
+    float cost_scale = 1.0f - search_rounding_error(nfeatures + 16);
+
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    // Find distance to each cluster
+    for (int c = 0; c < nclusters; c++)
+    {
+        float dist = sqrtf(cluster_distance_squared(index.centroids(c), query_normalized));
+        cluster_order(c) = c;
+        cluster_costs(c) = dist;
+    }
+
+    std::sort(cluster_order.data, cluster_order.data + nclusters, [&](const int a, const int b)
+    {
+        return cluster_bound_cluster(cluster_costs(a), index.radii(a), dist_error) <
+               cluster_bound_cluster(cluster_costs(b), index.radii(b), dist_error);
+    });
+
+    float curr_cost = 0.0f;
+
+    // Search clusters, closest first
+    for (int o = 0; o < nclusters; o++)
+    {
+        int c = cluster_order(o);
+        float query_dist = cluster_costs(c);
+
+        // All remaining clusters are further away
+        curr_cost = transition_cost + cost_scale * squaref(cluster_bound_cluster(query_dist, index.radii(c), dist_error));
+        if (curr_cost >= best_cost)
+        {
+            break;
+        }
+
+        for (int k = index.cluster_starts(c); k < index.cluster_stops(c); k++)
+        {
+            // Prune frame using its distance to the centroid
+            float dist_diff = query_dist - index.frame_dists(k);
+            float dist_bound = cluster_bound_frame(query_dist, index.frame_dists(k), dist_error);
+
+            if (transition_cost + cost_scale * squaref(dist_bound) >= best_cost)
+            {
+                // Frames are sorted by distance to the centroid so all
+                // remaining frames of the cluster are further away
+                if (dist_diff < 0.0f) { break; }
+
+                continue;
+            }
+
+            int i = index.frames(k);
+
+            // Exclude end of ranges from search
+            if (i >= range_stops(frame_ranges(i)) - ignore_range_end)
+            {
+                continue;
+            }
+
+            // Skip surrounding frames
+            if (curr_index != -1 && abs(i - curr_index) < ignore_surrounding)
+            {
+                continue;
+            }
+
+            // Check against frame
+            curr_cost = transition_cost;
+            int j = 0;
+            while (j < nfeatures)
+            {
+                curr_cost += squaref(query_normalized(j) - index.features(k, j));
+                j++;
+                if (curr_cost >= best_cost)
+                {
+                    break;
+                }
+            }
+
+            SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+            SEARCH_STATS_ADD(stats, frame_dims_visited, j);
+
+            // If cost is lower than current best then update best
+            if (curr_cost < best_cost)
+            {
+                best_index = i;
+                best_cost = curr_cost;
+            }
+        }
+    }
+}
+
+// Search database using a cluster index built over db.features_ordered
+void database_search_cluster(
+    int& best_index,
+    float& best_cost,
+    const database& db,
+    const cluster_index& index,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+
+    array1d<int> cluster_order(index.nclusters());
+    array1d<float> cluster_costs(index.nclusters());
+
+    // Search
+    motion_matching_search_cluster(
+        best_index,
+        best_cost,
+        index,
+        cluster_order,
+        cluster_costs,
+        db.range_stops,
+        db.frame_ranges,
+        db.features_ordered,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Compare the frames evaluated and search time of the box search
+// and cluster indices of a few sizes, see database_random_queries
+void database_benchmark_clusters(const database& db, const int nqueries = 1000, FILE* out = stdout)
+{
+    const int counts[] = { 16, 64, 256, 1024 };
+    int ncounts = sizeof(counts) / sizeof(counts[0]);
+
+    array2d<float> queries(nqueries, db.nfeatures());
+    array1d<int> starts(nqueries);
+    database_random_queries(queries, starts, db);
+
+    array1d<float> exact_costs(nqueries);
+
+    search_stats stats;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int q = 0; q < nqueries; q++)
+    {
+        int best_index = starts(q);
+        exact_costs(q) = FLT_MAX;
+        database_search(best_index, exact_costs(q), db, queries(q), 0.0f, 20, 20, &stats);
+    }
+
+    auto stop_time = std::chrono::high_resolution_clock::now();
+
+    fprintf(out, "%-10s %12s %12s %14s %10s %12s\n", "index", "memory (kb)", "build (ms)", "frames/search", "match (%)", "us/search");
+    fprintf(out, "%-10s %12.1f %12s %14.1f %10.1f %12.1f\n", "boxes",
+        2 * sizeof(float) * (db.bound_sm_min.rows + db.bound_lr_min.rows) * db.nfeatures() / 1024.0, "-",
+        (double)stats.frames_evaluated / nqueries, 100.0,
+        std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+
+    for (int n = 0; n < ncounts; n++)
+    {
+        if (counts[n] > db.nframes()) { continue; }
+
+        auto build_start_time = std::chrono::high_resolution_clock::now();
+
+        cluster_index index;
+        cluster_index_build(index, db, counts[n]);
+
+        auto build_stop_time = std::chrono::high_resolution_clock::now();
+
+        search_stats_reset(stats);
+        int matches = 0;
+
+        start_time = std::chrono::high_resolution_clock::now();
+
+        for (int q = 0; q < nqueries; q++)
+        {
+            int best_index = starts(q);
+            float best_cost = FLT_MAX;
+            database_search_cluster(best_index, best_cost, db, index, queries(q), 0.0f, 20, 20, &stats);
+            matches += best_cost == exact_costs(q);
+        }
+
+        stop_time = std::chrono::high_resolution_clock::now();
+
+        char name[16];
+        snprintf(name, sizeof(name), "k=%d", counts[n]);
+        fprintf(out, "%-10s %12.1f %12.1f %14.1f %10.1f %12.1f\n", name,
+            cluster_index_memory(index) / 1024.0,
+            std::chrono::duration<double, std::milli>(build_stop_time - build_start_time).count(),
+            (double)stats.frames_evaluated / nqueries, 100.0 * matches / nqueries,
+            std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+    }
+}
@@ -0,0 +1,646 @@
+#pragma once
+
+#include "database.h"
+#include "simd.h"
+
+#include <math.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//--------------------------------------
+
+enum
+{
+    // Frames in each block of the key bitsets. This is also the largest
+    // gap allowed between two keys of a bone, so the keys either side of
+    // a frame are always in its own block or a neighbouring one.
+    COMPRESSED_POSES_BLOCK_SIZE = 64,
+};
+
+// A unit quaternion in 48 bits using the "smallest three" encoding:
+// the largest component is dropped (and made positive by negating
+// the quaternion, which represents the same rotation) and the other
+// three are stored in 15 bits each. The index of the dropped component
+// is kept in the top bit of the first two values.
+struct quat48
+{
+    unsigned short v[3];
+};
+
+// An angular velocity quantized to 16 bits per component, multiplied
+// by the scale of the range and bone to decode, see compressed_poses
+struct vec3_16
+{
+    short x, y, z;
+};
+
+// Compressed copy of db.bone_rotations and db.bone_angular_velocities,
+// which take up most of the memory of the database once the static
+// position and velocity channels are removed. Rotations are quantized
+// to 48 bits and, if a tolerance is given, frames that interpolating
+// the neighbouring keys reproduces within the tolerance are dropped.
+// Angular velocities are quantized to 16 bits per component relative
+// to the largest value of that bone in the range.
+/*
+    nframes                  : 帧数
+    nbones                   : 骨骼数量
+    tolerance                : 去掉关键帧时允许的最大旋转误差(弧度)，为0时保留所有帧
+    key_bits                 : rows为block数量，cols为nbones，key_bits(b, j)的第l位为1表示第b * 64 + l帧是第j个骨骼的关键帧
+    key_offsets              : 同上，第b个block中第j个骨骼的第一个关键帧在key_rotations中的位置
+    key_rotations            : 所有关键帧，按block，骨骼，帧的顺序存储，播放时连续的帧只访问同一个block附近的数据
+    frame_ranges             : 长度为nframes，每一帧使用的angular_velocity_scales的行，不属于任何range的帧为nranges
+    angular_velocity_scales  : rows为nranges + 1，cols为nbones，解码时angular_velocities乘以对应的scale
+    angular_velocities       : rows为nframes，cols为nbones
+*/
+struct compressed_poses
+{
+    int nframes;
+    int nbones;
+    float tolerance;
+    array2d<unsigned long long> key_bits;
+    array2d<int> key_offsets;
+    array1d<quat48> key_rotations;
+    array1d<int> frame_ranges;
+    array2d<vec3> angular_velocity_scales;
+    array2d<vec3_16> angular_velocities;
+
+    compressed_poses() : nframes(0), nbones(0), tolerance(0.0f) {}
+};
+
+//--------------------------------------
+
+static inline int compressed_bits_count(unsigned long long x)
+{
+#if defined(_MSC_VER)
+    return (int)__popcnt64(x);
+#elif defined(__POPCNT__)
+    return __builtin_popcountll(x);
+#else
+    // Without the popcnt instruction the builtin is a library call
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (int)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Index of the highest set bit, `x` must not be zero
+static inline int compressed_bits_highest(const unsigned long long x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+// Index of the lowest set bit, `x` must not be zero
+static inline int compressed_bits_lowest(const unsigned long long x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+//--------------------------------------
+
+static inline quat48 quat48_encode(const quat q)
+{
+    const float c[4] = { q.w, q.x, q.y, q.z };
+
+    int largest = 0;
+    for (int k = 1; k < 4; k++)
+    {
+        if (fabsf(c[k]) > fabsf(c[largest])) { largest = k; }
+    }
+
+    // The other components are within +-1/sqrt(2)
+    float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+    quat48 p;
+    int n = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        if (k == largest) { continue; }
+        float v = clampf(sign * c[k] * 0.70710678f + 0.5f, 0.0f, 1.0f);
+        p.v[n++] = (unsigned short)(v * 32767.0f + 0.5f);
+    }
+
+    p.v[0] |= (unsigned short)((largest & 1) << 15);
+    p.v[1] |= (unsigned short)((largest >> 1) << 15);
+    return p;
+}
+
+static inline quat quat48_decode(const quat48 p)
+{
+    int largest = (p.v[0] >> 15) | ((p.v[1] >> 15) << 1);
+
+    float a = (p.v[0] & 0x7FFF) * (1.41421356f / 32767.0f) - 0.70710678f;
+    float b = (p.v[1] & 0x7FFF) * (1.41421356f / 32767.0f) - 0.70710678f;
+    float c = (p.v[2] & 0x7FFF) * (1.41421356f / 32767.0f) - 0.70710678f;
+    float d = sqrtf(maxf(1.0f - a*a - b*b - c*c, 0.0f));
+
+    switch (largest)
+    {
+        case 0: return quat(d, a, b, c);
+        case 1: return quat(a, d, b, c);
+        case 2: return quat(a, b, d, c);
+        default: return quat(a, b, c, d);
+    }
+}
+
+// Interpolate two decoded keys the same way the vectorized decode does
+static inline quat compressed_poses_interpolate(const quat q0, const quat q1, const float t)
+{
+    return quat_nlerp_shortest(q0, q1, t);
+}
+
+// Angle between two unit quaternions. Taken from the vector part of
+// their difference rather than acos of their dot product, which is
+// too imprecise in float for the small angles we care about here.
+static inline float compressed_poses_angle(const quat q, const quat p)
+{
+    quat d = quat_mul_inv(q, p);
+    return 2.0f * atan2f(sqrtf(d.x*d.x + d.y*d.y + d.z*d.z), fabsf(d.w));
+}
+
+//--------------------------------------
+
+// Find the keys either side of a frame for a bone and how far between
+// them the frame is. If the frame is a key both keys are the same.
+static inline void compressed_poses_find_keys(
+    int& key0,
+    int& key1,
+    float& alpha,
+    const compressed_poses& poses,
+    const int frame,
+    const int bone)
+{
+    const int b = frame / COMPRESSED_POSES_BLOCK_SIZE;
+    const int l = frame % COMPRESSED_POSES_BLOCK_SIZE;
+    const unsigned long long bits = poses.key_bits(b, bone);
+    const unsigned long long upto = (2ull << l) - 1; // Bits of frames up to and including this one
+    const int before = compressed_bits_count(bits & upto);
+
+    // The first frame is always a key so there is always a key at or
+    // before the frame, in this block or, since keys are at most a
+    // block apart, the previous one
+    int frame0;
+    if (before > 0)
+    {
+        key0 = poses.key_offsets(b, bone) + before - 1;
+        frame0 = b * COMPRESSED_POSES_BLOCK_SIZE + compressed_bits_highest(bits & upto);
+    }
+    else
+    {
+        const unsigned long long bits_prev = poses.key_bits(b - 1, bone);
+        key0 = poses.key_offsets(b - 1, bone) + compressed_bits_count(bits_prev) - 1;
+        frame0 = (b - 1) * COMPRESSED_POSES_BLOCK_SIZE + compressed_bits_highest(bits_prev);
+    }
+
+    if (frame0 == frame)
+    {
+        key1 = key0;
+        alpha = 0.0f;
+        return;
+    }
+
+    // Likewise the last frame is always a key
+    int frame1;
+    if (bits & ~upto)
+    {
+        key1 = poses.key_offsets(b, bone) + before;
+        frame1 = b * COMPRESSED_POSES_BLOCK_SIZE + compressed_bits_lowest(bits & ~upto);
+    }
+    else
+    {
+        key1 = poses.key_offsets(b + 1, bone);
+        frame1 = (b + 1) * COMPRESSED_POSES_BLOCK_SIZE + compressed_bits_lowest(poses.key_bits(b + 1, bone));
+    }
+
+    alpha = (float)(frame - frame0) / (float)(frame1 - frame0);
+}
+
+// Decode the rotation of a single bone
+static inline quat compressed_poses_decode_rotation(const compressed_poses& poses, const int frame, const int bone)
+{
+    int key0, key1;
+    float alpha;
+    compressed_poses_find_keys(key0, key1, alpha, poses, frame, bone);
+
+    return key0 == key1 ?
+        quat48_decode(poses.key_rotations(key0)) :
+        compressed_poses_interpolate(
+            quat48_decode(poses.key_rotations(key0)),
+            quat48_decode(poses.key_rotations(key1)),
+            alpha);
+}
+
+#if SIMD_X86
+
+// Decode and place the dropped component of four quat48 stored as
+// 32-bit lanes, giving the w, x, y and z of four quaternions
+SIMD_TARGET_SSE4
+static inline void quat48_decode_sse4(
+    __m128& w, __m128& x, __m128& y, __m128& z,
+    const __m128i v0, const __m128i v1, const __m128i v2)
+{
+    const __m128i mask = _mm_set1_epi32(0x7FFF);
+    const __m128 scale = _mm_set1_ps(1.41421356f / 32767.0f);
+    const __m128 offset = _mm_set1_ps(0.70710678f);
+
+    __m128i largest = _mm_or_si128(_mm_srli_epi32(v0, 15), _mm_slli_epi32(_mm_srli_epi32(v1, 15), 1));
+
+    __m128 a = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(v0, mask)), scale), offset);
+    __m128 b = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(v1, mask)), scale), offset);
+    __m128 c = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(v2, mask)), scale), offset);
+
+    __m128 dd = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c)));
+    __m128 d = _mm_sqrt_ps(_mm_max_ps(dd, _mm_setzero_ps()));
+
+    __m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(0)));
+    __m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(1)));
+    __m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(2)));
+    __m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(3)));
+
+    w = _mm_blendv_ps(a, d, is0);
+    x = _mm_blendv_ps(_mm_blendv_ps(b, a, is0), d, is1);
+    y = _mm_blendv_ps(_mm_blendv_ps(b, c, is3), d, is2);
+    z = _mm_blendv_ps(c, d, is3);
+}
+
+// Decode and interpolate the keys of four bones, matching
+// compressed_poses_interpolate of the scalar decode
+SIMD_TARGET_SSE4
+static inline void compressed_poses_decode4_sse4(
+    quat* rotations,
+    const quat48* const* keys0,
+    const quat48* const* keys1,
+    const float* alpha)
+{
+    __m128 w0, x0, y0, z0, w1, x1, y1, z1;
+
+    quat48_decode_sse4(w0, x0, y0, z0,
+        _mm_set_epi32(keys0[3]->v[0], keys0[2]->v[0], keys0[1]->v[0], keys0[0]->v[0]),
+        _mm_set_epi32(keys0[3]->v[1], keys0[2]->v[1], keys0[1]->v[1], keys0[0]->v[1]),
+        _mm_set_epi32(keys0[3]->v[2], keys0[2]->v[2], keys0[1]->v[2], keys0[0]->v[2]));
+
+    quat48_decode_sse4(w1, x1, y1, z1,
+        _mm_set_epi32(keys1[3]->v[0], keys1[2]->v[0], keys1[1]->v[0], keys1[0]->v[0]),
+        _mm_set_epi32(keys1[3]->v[1], keys1[2]->v[1], keys1[1]->v[1], keys1[0]->v[1]),
+        _mm_set_epi32(keys1[3]->v[2], keys1[2]->v[2], keys1[1]->v[2], keys1[0]->v[2]));
+
+    // Take the shortest path by flipping the second key
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, w1), _mm_mul_ps(x0, x1)), _mm_add_ps(_mm_mul_ps(y0, y1), _mm_mul_ps(z0, z1)));
+    __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+    w1 = _mm_xor_ps(w1, flip);
+    x1 = _mm_xor_ps(x1, flip);
+    y1 = _mm_xor_ps(y1, flip);
+    z1 = _mm_xor_ps(z1, flip);
+
+    __m128 t = _mm_loadu_ps(alpha);
+    __m128 s = _mm_sub_ps(_mm_set1_ps(1.0f), t);
+    __m128 w = _mm_add_ps(_mm_mul_ps(s, w0), _mm_mul_ps(t, w1));
+    __m128 x = _mm_add_ps(_mm_mul_ps(s, x0), _mm_mul_ps(t, x1));
+    __m128 y = _mm_add_ps(_mm_mul_ps(s, y0), _mm_mul_ps(t, y1));
+    __m128 z = _mm_add_ps(_mm_mul_ps(s, z0), _mm_mul_ps(t, z1));
+
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w, w), _mm_mul_ps(x, x)), _mm_add_ps(_mm_mul_ps(y, y), _mm_mul_ps(z, z))));
+    __m128 inv_length = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(length, _mm_set1_ps(1e-8f)));
+    w = _mm_mul_ps(w, inv_length);
+    x = _mm_mul_ps(x, inv_length);
+    y = _mm_mul_ps(y, inv_length);
+    z = _mm_mul_ps(z, inv_length);
+
+    // Back from one register per component to one per quaternion,
+    // which has the same w, x, y, z layout as quat
+    _MM_TRANSPOSE4_PS(w, x, y, z);
+    _mm_storeu_ps(&rotations[0].w, w);
+    _mm_storeu_ps(&rotations[1].w, x);
+    _mm_storeu_ps(&rotations[2].w, y);
+    _mm_storeu_ps(&rotations[3].w, z);
+}
+
+#endif
+
+// Decode the rotations of every bone for a frame. Keys are found for
+// each bone then decoded and interpolated four bones at a time.
+/*
+rotations [out]        : 长度为nbones
+frame [in]             : 需要解码的帧
+level [in]             : 使用的指令集，见simd_level_detect
+*/
+void compressed_poses_decode_rotations(
+    slice1d<quat> rotations,
+    const compressed_poses& poses,
+    const int frame,
+    const simd_level level = simd_level_detect())
+{
+    assert(rotations.size == poses.nbones);
+    assert(frame >= 0 && frame < poses.nframes);
+
+#if SIMD_X86
+    if (level >= SIMD_LEVEL_SSE4)
+    {
+        for (int j = 0; j < poses.nbones; j += 4)
+        {
+            const quat48* keys0[4];
+            const quat48* keys1[4];
+            float alpha[4];
+            quat decoded[4];
+
+            int lanes = clamp(poses.nbones - j, 0, 4);
+
+            for (int l = 0; l < 4; l++)
+            {
+                int key0 = 0, key1 = 0;
+                alpha[l] = 0.0f;
+
+                if (l < lanes)
+                {
+                    compressed_poses_find_keys(key0, key1, alpha[l], poses, frame, j + l);
+                }
+
+                keys0[l] = &poses.key_rotations(key0);
+                keys1[l] = &poses.key_rotations(key1);
+            }
+
+            compressed_poses_decode4_sse4(decoded, keys0, keys1, alpha);
+
+            for (int l = 0; l < lanes; l++)
+            {
+                rotations(j + l) = decoded[l];
+            }
+        }
+        return;
+    }
+#else
+    (void)level;
+#endif
+
+    for (int j = 0; j < poses.nbones; j++)
+    {
+        rotations(j) = compressed_poses_decode_rotation(poses, frame, j);
+    }
+}
+
+void compressed_poses_decode_angular_velocities(
+    slice1d<vec3> angular_velocities,
+    const compressed_poses& poses,
+    const int frame)
+{
+    assert(angular_velocities.size == poses.nbones);
+
+    int r = poses.frame_ranges(frame);
+
+    for (int j = 0; j < poses.nbones; j++)
+    {
+        const vec3_16 v = poses.angular_velocities(frame, j);
+        const vec3 s = poses.angular_velocity_scales(r, j);
+        angular_velocities(j) = vec3(v.x * s.x, v.y * s.y, v.z * s.z);
+    }
+}
+
+//--------------------------------------
+
+// Quantized key of a bone in a frame. Both choosing the keys and
+// storing them go through this so the error used to choose them is
+// the error of what is stored.
+static inline quat48 compressed_poses_key(const database& db, const int frame, const int bone)
+{
+    return quat48_encode(quat_normalize(db.bone_rotations(frame, bone)));
+}
+
+// Choose the keys of one bone. Starting from a key, the next key is
+// the furthest frame (at most a block away) for which interpolating
+// between the two quantized keys reproduces every frame in between
+// within the tolerance, so the error bound includes the quantization.
+static inline void compressed_poses_select_keys(
+    slice1d<bool> is_key,
+    const database& db,
+    const int bone,
+    const float tolerance)
+{
+    is_key.zero();
+    is_key(0) = true;
+    is_key(db.nframes() - 1) = true;
+
+    if (tolerance <= 0.0f)
+    {
+        is_key.set(true);
+        return;
+    }
+
+    int start = 0;
+    while (start < db.nframes() - 1)
+    {
+        quat q0 = quat48_decode(compressed_poses_key(db, start, bone));
+
+        int last = clamp(start + COMPRESSED_POSES_BLOCK_SIZE, 0, db.nframes() - 1);
+
+        int next = start + 1;
+        for (int end = start + 2; end <= last; end++)
+        {
+            quat q1 = quat48_decode(compressed_poses_key(db, end, bone));
+
+            bool within = true;
+            for (int i = start + 1; within && i < end; i++)
+            {
+                quat q = compressed_poses_interpolate(q0, q1, (float)(i - start) / (float)(end - start));
+                within = compressed_poses_angle(q, quat_normalize(db.bone_rotations(i, bone))) <= tolerance;
+            }
+
+            if (!within) { break; }
+
+            next = end;
+        }
+
+        is_key(next) = true;
+        start = next;
+    }
+}
+
+// Build the compressed poses from the rotations and angular velocities
+// of the database.
+/*
+tolerance [in]         : 去掉关键帧时允许的最大旋转误差(弧度)，为0时只量化不去掉关键帧
+*/
+void compressed_poses_build(compressed_poses& poses, const database& db, const float tolerance = 0.0f)
+{
+    assert(db.nframes() > 0);
+
+    int nblocks = (db.nframes() + COMPRESSED_POSES_BLOCK_SIZE - 1) / COMPRESSED_POSES_BLOCK_SIZE;
+
+    poses.nframes = db.nframes();
+    poses.nbones = db.nbones();
+    poses.tolerance = tolerance;
+
+    // Rotations
+
+    array2d<bool> is_key(db.nbones(), db.nframes());
+
+    for (int j = 0; j < db.nbones(); j++)
+    {
+        compressed_poses_select_keys(is_key(j), db, j, tolerance);
+    }
+
+    poses.key_bits.resize(nblocks, db.nbones());
+    poses.key_offsets.resize(nblocks, db.nbones());
+    poses.key_bits.zero();
+
+    int nkeys = 0;
+    for (int b = 0; b < nblocks; b++)
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            poses.key_offsets(b, j) = nkeys;
+
+            for (int l = 0; l < COMPRESSED_POSES_BLOCK_SIZE && b * COMPRESSED_POSES_BLOCK_SIZE + l < db.nframes(); l++)
+            {
+                if (is_key(j, b * COMPRESSED_POSES_BLOCK_SIZE + l))
+                {
+                    poses.key_bits(b, j) |= 1ull << l;
+                    nkeys++;
+                }
+            }
+        }
+    }
+
+    poses.key_rotations.resize(nkeys);
+
+    int k = 0;
+    for (int b = 0; b < nblocks; b++)
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            for (int l = 0; l < COMPRESSED_POSES_BLOCK_SIZE && b * COMPRESSED_POSES_BLOCK_SIZE + l < db.nframes(); l++)
+            {
+                int i = b * COMPRESSED_POSES_BLOCK_SIZE + l;
+                if (is_key(j, i))
+                {
+                    poses.key_rotations(k++) = compressed_poses_key(db, i, j);
+                }
+            }
+        }
+    }
+
+    assert(k == nkeys);
+
+    // Angular velocities, scaled by the largest value of each bone in
+    // each range. Frames outside of any range share an extra row.
+
+    poses.frame_ranges.resize(db.nframes());
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        poses.frame_ranges(i) = db.frame_ranges(i) == -1 ? db.nranges() : db.frame_ranges(i);
+    }
+
+    array2d<vec3> largest(db.nranges() + 1, db.nbones());
+    largest.set(vec3());
+
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            vec3 v = db.bone_angular_velocities(i, j);
+            vec3& m = largest(poses.frame_ranges(i), j);
+            m = vec3(maxf(m.x, fabsf(v.x)), maxf(m.y, fabsf(v.y)), maxf(m.z, fabsf(v.z)));
+        }
+    }
+
+    poses.angular_velocity_scales.resize(db.nranges() + 1, db.nbones());
+    for (int r = 0; r < db.nranges() + 1; r++)
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            poses.angular_velocity_scales(r, j) = largest(r, j) / 32767.0f;
+        }
+    }
+
+    poses.angular_velocities.resize(db.nframes(), db.nbones());
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            vec3 v = db.bone_angular_velocities(i, j);
+            vec3 m = largest(poses.frame_ranges(i), j);
+
+            vec3_16 q;
+            q.x = (short)(m.x > 0.0f ? roundf(clampf(v.x / m.x, -1.0f, 1.0f) * 32767.0f) : 0.0f);
+            q.y = (short)(m.y > 0.0f ? roundf(clampf(v.y / m.y, -1.0f, 1.0f) * 32767.0f) : 0.0f);
+            q.z = (short)(m.z > 0.0f ? roundf(clampf(v.z / m.z, -1.0f, 1.0f) * 32767.0f) : 0.0f);
+            poses.angular_velocities(i, j) = q;
+        }
+    }
+}
+
+size_t compressed_poses_memory(const compressed_poses& poses)
+{
+    return
+        sizeof(unsigned long long) * poses.key_bits.rows * poses.key_bits.cols +
+        sizeof(int) * poses.key_offsets.rows * poses.key_offsets.cols +
+        sizeof(quat48) * poses.key_rotations.size +
+        sizeof(int) * poses.frame_ranges.size +
+        sizeof(vec3) * poses.angular_velocity_scales.rows * poses.angular_velocity_scales.cols +
+        sizeof(vec3_16) * poses.angular_velocities.rows * poses.angular_velocities.cols;
+}
+
+// Print the error of the decoded poses against the database for each
+// bone, which can be used to choose the tolerance, and the memory used
+void compressed_poses_error_report(const compressed_poses& poses, const database& db, FILE* out = stdout)
+{
+    array1d<quat> rotations(db.nbones());
+    array1d<vec3> angular_velocities(db.nbones());
+
+    array1d<double> rotation_error_max(db.nbones());
+    array1d<double> rotation_error_sum(db.nbones());
+    array1d<double> angular_velocity_error_max(db.nbones());
+    rotation_error_max.zero();
+    rotation_error_sum.zero();
+    angular_velocity_error_max.zero();
+
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        compressed_poses_decode_rotations(rotations, poses, i);
+        compressed_poses_decode_angular_velocities(angular_velocities, poses, i);
+
+        for (int j = 0; j < db.nbones(); j++)
+        {
+            double angle = compressed_poses_angle(rotations(j), quat_normalize(db.bone_rotations(i, j)));
+            rotation_error_max(j) = angle > rotation_error_max(j) ? angle : rotation_error_max(j);
+            rotation_error_sum(j) += angle;
+
+            double velocity = length(angular_velocities(j) - db.bone_angular_velocities(i, j));
+            angular_velocity_error_max(j) = velocity > angular_velocity_error_max(j) ? velocity : angular_velocity_error_max(j);
+        }
+    }
+
+    fprintf(out, "%-6s %10s %16s %16s %18s\n", "bone", "keys (%)", "max error (deg)", "mean error (deg)", "max ang vel error");
+
+    for (int j = 0; j < db.nbones(); j++)
+    {
+        int nkeys = 0;
+        for (int b = 0; b < poses.key_bits.rows; b++)
+        {
+            nkeys += compressed_bits_count(poses.key_bits(b, j));
+        }
+
+        fprintf(out, "%-6d %10.1f %16.4f %16.4f %18.5f\n", j,
+            100.0 * nkeys / db.nframes(),
+            rotation_error_max(j) * 180.0 / PIf,
+            rotation_error_sum(j) / db.nframes() * 180.0 / PIf,
+            angular_velocity_error_max(j));
+    }
+
+    size_t raw = (sizeof(quat) + sizeof(vec3)) * db.nframes() * db.nbones();
+    fprintf(out, "memory %.2f MB -> %.2f MB (tolerance %.4f rad)\n",
+        raw / (1024.0 * 1024.0), compressed_poses_memory(poses) / (1024.0 * 1024.0), poses.tolerance);
+}
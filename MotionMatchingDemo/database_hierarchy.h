@@ -0,0 +1,331 @@
+#pragma once
+
+#include "database.h"
+
+#include <chrono>
+
+//--------------------------------------
+
+enum
+{
+    BOUND_LEVELS_MAX = 6,
+};
+
+// A hierarchy of axis aligned bounding boxes with any number of
+// levels and any box sizes. Level 0 has the largest boxes and each
+// following level splits every box of the previous level into
+// equally sized smaller boxes, so `sizes[l]` must be a multiple of
+// `sizes[l + 1]`. The built-in two level structure in `database`
+// is the same as a hierarchy with sizes { BOUND_LR_SIZE, BOUND_SM_SIZE }.
+/*
+    对于非常大的数据库(比如2M帧)，增加一层更大的box(比如1024帧)可以一次剔除更多的数据
+    mins(l), maxs(l) 的列顺序与features_ordered相同
+*/
+struct bound_hierarchy
+{
+    int nlevels;
+    int sizes[BOUND_LEVELS_MAX];
+    array2d<float> mins[BOUND_LEVELS_MAX];
+    array2d<float> maxs[BOUND_LEVELS_MAX];
+
+    bound_hierarchy() : nlevels(0) {}
+};
+
+void bound_hierarchy_build(
+    bound_hierarchy& h,
+    const slice2d<float> features,
+    const int* sizes,
+    const int nlevels)
+{
+    assert(nlevels > 0 && nlevels <= BOUND_LEVELS_MAX);
+
+    h.nlevels = nlevels;
+
+    for (int l = 0; l < nlevels; l++)
+    {
+        assert(sizes[l] > 0);
+        assert(l == 0 || sizes[l - 1] % sizes[l] == 0);
+
+        h.sizes[l] = sizes[l];
+
+        int nbounds = (features.rows + sizes[l] - 1) / sizes[l];
+
+        h.mins[l].resize(nbounds, features.cols);
+        h.maxs[l].resize(nbounds, features.cols);
+        h.mins[l].set(FLT_MAX);
+        h.maxs[l].set(-FLT_MAX);
+
+        for (int i = 0; i < features.rows; i++)
+        {
+            int b = i / sizes[l];
+
+            for (int j = 0; j < features.cols; j++)
+            {
+                h.mins[l](b, j) = minf(h.mins[l](b, j), features(i, j));
+                h.maxs[l](b, j) = maxf(h.maxs[l](b, j), features(i, j));
+            }
+        }
+    }
+
+    for (int l = nlevels; l < BOUND_LEVELS_MAX; l++)
+    {
+        h.sizes[l] = 0;
+        h.mins[l].resize(0, 0);
+        h.maxs[l].resize(0, 0);
+    }
+}
+
+// The frames of the last level, its boxes and those of every
+// level above are tested by motion_matching_search_hierarchy_level
+struct search_sweep_hierarchy
+{
+    int& best_index;
+    float& best_cost;
+    const slice2d<float> features;
+    const slice1d<float> query_normalized;
+    const float transition_cost;
+    search_stats* stats;
+
+    void frame(const int i)
+    {
+        float cost = search_frame_cost(query_normalized, features(i), transition_cost, best_cost, stats);
+
+        // If cost is lower than current best then update best
+        if (cost < best_cost)
+        {
+            best_index = i;
+            best_cost = cost;
+        }
+    }
+};
+
+// Search the frames from `start` to `stop` (which never crosses
+// a box of the previous level) using the boxes of `level`,
+// recursing into the next level for every box not pruned and
+// checking frames directly at the last level. Boxes of the last
+// level are counted as small boxes in `stats` and those of every
+// level above it as large boxes.
+void motion_matching_search_hierarchy_level(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const bound_hierarchy& h,
+    const int level,
+    const int start,
+    const int stop,
+    const int curr_index,
+    const slice2d<float> features,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    int size = h.sizes[level];
+
+    int i = start;
+
+    while (i < stop)
+    {
+        // Find index of current and next box
+        int b = i / size;
+        int i_next = (b + 1) * size;
+        int i_end = i_next < stop ? i_next : stop;
+
+        // If distance is greater than current best jump to next box
+        bool last = level + 1 == h.nlevels;
+
+        if (last) { SEARCH_STATS_ADD(stats, sm_boxes_tested, 1); }
+        else      { SEARCH_STATS_ADD(stats, lr_boxes_tested, 1); }
+
+        if (search_box_cost(query_normalized, h.mins[level](b), h.maxs[level](b), transition_cost, best_cost) >= best_cost)
+        {
+            if (last) { SEARCH_STATS_ADD(stats, sm_boxes_pruned, 1); }
+            else      { SEARCH_STATS_ADD(stats, lr_boxes_pruned, 1); }
+
+            i = i_end;
+            continue;
+        }
+
+        if (!last)
+        {
+            // Check against boxes of the next level
+            motion_matching_search_hierarchy_level(
+                best_index,
+                best_cost,
+                h,
+                level + 1,
+                i,
+                i_end,
+                curr_index,
+                features,
+                query_normalized,
+                transition_cost,
+                ignore_surrounding,
+                stats);
+        }
+        else
+        {
+            // Search inside smallest box
+            search_sweep_hierarchy sweep = {
+                best_index, best_cost, features,
+                query_normalized, transition_cost, stats };
+
+            search_sweep_frames(sweep, i, i_end, curr_index, ignore_surrounding, stats);
+        }
+
+        i = i_end;
+    }
+}
+
+// Same as motion_matching_search but using a hierarchy of boxes
+// with any number of levels instead of the fixed two levels
+/*
+h [in]                 : 加速结构，见bound_hierarchy_build
+其他参数同motion_matching_search
+*/
+void motion_matching_search_hierarchy(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const bound_hierarchy& h,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    assert(h.nlevels > 0);
+
+    int nfeatures = query_normalized.size;
+    int nranges = range_starts.size;
+
+    int curr_index = best_index;
+
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    // Search rest of database
+    for (int r = 0; r < nranges; r++)
+    {
+        // Exclude end of ranges from search
+        motion_matching_search_hierarchy_level(
+            best_index,
+            best_cost,
+            h,
+            0,
+            range_starts(r),
+            range_stops(r) - ignore_range_end,
+            curr_index,
+            features,
+            query_normalized,
+            transition_cost,
+            ignore_surrounding,
+            stats);
+    }
+}
+
+// Search database using a custom box hierarchy built over db.features_ordered
+void database_search_hierarchy(
+    int& best_index,
+    float& best_cost,
+    const database& db,
+    const bound_hierarchy& h,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+
+    // Search
+    motion_matching_search_hierarchy(
+        best_index,
+        best_cost,
+        h,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Compare the search time and number of boxes tested and frames
+// evaluated for a few different hierarchies, see database_random_queries
+void database_benchmark_hierarchies(const database& db, const int nqueries = 1000, FILE* out = stdout)
+{
+    struct hierarchy_config { int nlevels; int sizes[BOUND_LEVELS_MAX]; };
+
+    const hierarchy_config configs[] =
+    {
+        { 1, { 16 } },
+        { 1, { 64 } },
+        { 2, { 64, 16 } },
+        { 2, { 128, 16 } },
+        { 2, { 256, 32 } },
+        { 3, { 1024, 64, 16 } },
+        { 3, { 1024, 128, 16 } },
+        { 3, { 4096, 256, 16 } },
+        { 4, { 4096, 512, 64, 8 } },
+        { 4, { 16384, 1024, 64, 16 } },
+    };
+
+    int nconfigs = sizeof(configs) / sizeof(configs[0]);
+
+    // Build queries
+    array2d<float> queries(nqueries, db.nfeatures());
+    array1d<int> starts(nqueries);
+    database_random_queries(queries, starts, db);
+
+    fprintf(out, "%-28s %12s %14s %14s %12s\n", "levels", "memory (kb)", "boxes/search", "frames/search", "us/search");
+
+    for (int c = 0; c < nconfigs; c++)
+    {
+        bound_hierarchy h;
+        bound_hierarchy_build(h, db.features_ordered, configs[c].sizes, configs[c].nlevels);
+
+        size_t memory = 0;
+        char name[64] = "";
+        for (int l = 0; l < h.nlevels; l++)
+        {
+            memory += 2 * sizeof(float) * h.mins[l].rows * h.mins[l].cols;
+            snprintf(name + strlen(name), sizeof(name) - strlen(name), l == 0 ? "%d" : "/%d", h.sizes[l]);
+        }
+
+        search_stats stats;
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        for (int q = 0; q < nqueries; q++)
+        {
+            int best_index = starts(q);
+            float best_cost = FLT_MAX;
+            database_search_hierarchy(best_index, best_cost, db, h, queries(q), 0.0f, 20, 20, &stats);
+        }
+
+        auto stop_time = std::chrono::high_resolution_clock::now();
+
+        double us = std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries;
+
+        fprintf(out, "%-28s %12.1f %14.1f %14.1f %12.1f\n", name, memory / 1024.0,
+            (double)(stats.lr_boxes_tested + stats.sm_boxes_tested) / nqueries,
+            (double)stats.frames_evaluated / nqueries, us);
+    }
+}
@@ -0,0 +1,794 @@
+#pragma once
+
+#include "database.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+//--------------------------------------
+
+enum
+{
+    // Number of neighbours of each frame on the upper levels, frames
+    // on level 0 have up to twice as many
+    HNSW_M_DEFAULT = 16,
+
+    // Size of the candidate list used when building
+    HNSW_EF_CONSTRUCTION_DEFAULT = 100,
+
+    // Size of the candidate list used when searching, larger is
+    // slower but more likely to find the best frame
+    HNSW_EF_SEARCH_DEFAULT = 64,
+
+    HNSW_M_MAX = 64,
+    HNSW_LEVELS_MAX = 16,
+
+    HNSW_FILE_MAGIC = 0x57534e48,
+    HNSW_FILE_VERSION = 1,
+};
+
+// Hierarchical navigable small world graph over db.features_ordered.
+// Each frame is a node linked to frames with similar features, level
+// 0 contains every frame and each level above about 1/M of the frames
+// of the level below. A search greedily walks the upper levels to get
+// close to the query then does a best first search of level 0 keeping
+// `ef` candidates. Unlike the other searches this is approximate, the
+// best frame is not always found, but the number of frames visited
+// grows roughly with the log of the database size, which makes it
+// useful for very large databases.
+//
+// The index only depends on the features so it can be built offline
+// and saved next to the database, see hnsw_index_save.
+/*
+    m                : 上层每一帧最多的邻居数量，第0层为2m
+    entry            : 搜索的起点，位于最高层
+    max_level        : 最高层
+    levels           : 长度为Frames，每一帧所在的最高层
+    links0           : rows为Frames，cols为2m，第0层每一帧的邻居，不足的用-1填充
+    upper_offsets    : 长度为Frames，每一帧第1层及以上的邻居在upper_links中的位置
+    upper_links      : 第l层(l >= 1)第i帧的邻居为upper_links(upper_offsets(i) + (l - 1) * m ...)，不足的用-1填充
+*/
+struct hnsw_index
+{
+    int m;
+    int entry;
+    int max_level;
+    array1d<int> levels;
+    array2d<int> links0;
+    array1d<int> upper_offsets;
+    array1d<int> upper_links;
+
+    hnsw_index() : m(0), entry(-1), max_level(-1) {}
+};
+
+// Scratch memory used by a search, kept between searches so that
+// no allocations are needed once it is large enough
+/*
+    visited          : 长度为Frames，等于visited_epoch的帧本次搜索已经访问过
+    frontier         : 待扩展的帧，按cost排列的最小堆
+    results          : 目前找到的最好的ef帧
+*/
+struct hnsw_search_state
+{
+    struct frontier_entry { float cost; int index; };
+
+    array1d<unsigned int> visited;
+    unsigned int visited_epoch;
+    array1d<frontier_entry> frontier;
+    int nfrontier;
+    candidate_heap results;
+
+    hnsw_search_state() : visited_epoch(0), nfrontier(0) {}
+};
+
+static inline bool hnsw_frontier_farther(
+    const hnsw_search_state::frontier_entry& a,
+    const hnsw_search_state::frontier_entry& b)
+{
+    return a.cost > b.cost || (a.cost == b.cost && a.index > b.index);
+}
+
+void hnsw_search_state_init(hnsw_search_state& state, const int nframes, const int ef)
+{
+    if (state.visited.size != nframes)
+    {
+        state.visited.resize(nframes);
+        state.visited.zero();
+        state.visited_epoch = 0;
+    }
+
+    if (state.frontier.size != nframes)
+    {
+        state.frontier.resize(nframes);
+    }
+
+    if (state.results.capacity() != ef)
+    {
+        candidate_heap_init(state.results, ef);
+    }
+}
+
+static inline void hnsw_search_state_begin(hnsw_search_state& state)
+{
+    state.visited_epoch++;
+
+    // Epoch wrapped around so old marks can't be told apart
+    if (state.visited_epoch == 0)
+    {
+        state.visited.zero();
+        state.visited_epoch = 1;
+    }
+
+    state.nfrontier = 0;
+    candidate_heap_clear(state.results);
+}
+
+static inline float hnsw_distance(const slice1d<float> query, const slice2d<float> features, const int i)
+{
+    float sum = 0.0f;
+    for (int j = 0; j < query.size; j++)
+    {
+        sum += squaref(query(j) - features(i, j));
+    }
+    return sum;
+}
+
+static inline int* hnsw_links(hnsw_index& index, const int i, const int level)
+{
+    return level == 0 ? &index.links0(i, 0) : &index.upper_links(index.upper_offsets(i) + (level - 1) * index.m);
+}
+
+static inline const int* hnsw_links(const hnsw_index& index, const int i, const int level)
+{
+    return level == 0 ? &index.links0(i, 0) : &index.upper_links(index.upper_offsets(i) + (level - 1) * index.m);
+}
+
+static inline int hnsw_links_max(const hnsw_index& index, const int level)
+{
+    return level == 0 ? 2 * index.m : index.m;
+}
+
+// Walk towards the query on one level, always moving to the closest neighbour
+static inline void hnsw_search_greedy(
+    int& best_index,
+    float& best_dist,
+    const hnsw_index& index,
+    const slice2d<float> features,
+    const slice1d<float> query,
+    const int level)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        const int* links = hnsw_links(index, best_index, level);
+        for (int n = 0; n < hnsw_links_max(index, level) && links[n] != -1; n++)
+        {
+            float dist = hnsw_distance(query, features, links[n]);
+            if (dist < best_dist)
+            {
+                best_index = links[n];
+                best_dist = dist;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Best first search of one level starting from `entry`. Every frame
+// reached is expanded but only frames for which `allowed` returns
+// true are kept in state.results, so filtered frames still act as
+// stepping stones between allowed frames.
+template<typename F>
+void hnsw_search_level(
+    hnsw_search_state& state,
+    const hnsw_index& index,
+    const slice2d<float> features,
+    const slice1d<float> query,
+    const int entry,
+    const int level,
+    const F& allowed,
+    search_stats* stats)
+{
+    hnsw_search_state_begin(state);
+
+    float entry_dist = hnsw_distance(query, features, entry);
+    SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+    SEARCH_STATS_ADD(stats, frame_dims_visited, query.size);
+
+    state.visited(entry) = state.visited_epoch;
+    state.frontier(0) = { entry_dist, entry };
+    state.nfrontier = 1;
+
+    if (allowed(entry))
+    {
+        candidate_heap_push(state.results, entry, entry_dist);
+    }
+
+    while (state.nfrontier > 0)
+    {
+        // Take closest frame from frontier
+        hnsw_search_state::frontier_entry curr = state.frontier(0);
+        std::pop_heap(state.frontier.data, state.frontier.data + state.nfrontier, hnsw_frontier_farther);
+        state.nfrontier--;
+
+        // Stop once it is further than every result
+        if (curr.cost > candidate_heap_bound(state.results))
+        {
+            break;
+        }
+
+        const int* links = hnsw_links(index, curr.index, level);
+        for (int n = 0; n < hnsw_links_max(index, level) && links[n] != -1; n++)
+        {
+            int i = links[n];
+
+            if (state.visited(i) == state.visited_epoch) { continue; }
+            state.visited(i) = state.visited_epoch;
+
+            float dist = hnsw_distance(query, features, i);
+            SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+            SEARCH_STATS_ADD(stats, frame_dims_visited, query.size);
+
+            if (dist < candidate_heap_bound(state.results))
+            {
+                state.frontier(state.nfrontier) = { dist, i };
+                state.nfrontier++;
+                std::push_heap(state.frontier.data, state.frontier.data + state.nfrontier, hnsw_frontier_farther);
+
+                if (allowed(i))
+                {
+                    candidate_heap_push(state.results, i, dist);
+                }
+            }
+        }
+    }
+}
+
+// Choose up to `count` neighbours from candidates sorted closest first,
+// preferring candidates which are closer to the frame being linked
+// (whose distances are `candidate_dists`) than to any neighbour
+// already chosen so that links point in many different directions.
+// Returns the number of neighbours written to `out`.
+static inline int hnsw_select_neighbours(
+    int* out,
+    const int count,
+    const slice2d<float> features,
+    const int* candidates,
+    const float* candidate_dists,
+    const int ncandidates)
+{
+    int nout = 0;
+
+    for (int c = 0; c < ncandidates && nout < count; c++)
+    {
+        bool diverse = true;
+        for (int o = 0; o < nout; o++)
+        {
+            if (hnsw_distance(features(candidates[c]), features, out[o]) < candidate_dists[c])
+            {
+                diverse = false;
+                break;
+            }
+        }
+
+        if (diverse)
+        {
+            out[nout] = candidates[c];
+            nout++;
+        }
+    }
+
+    // Fill any space left with the closest candidates not chosen
+    for (int c = 0; c < ncandidates && nout < count; c++)
+    {
+        bool chosen = false;
+        for (int o = 0; o < nout; o++)
+        {
+            if (out[o] == candidates[c]) { chosen = true; break; }
+        }
+
+        if (!chosen)
+        {
+            out[nout] = candidates[c];
+            nout++;
+        }
+    }
+
+    return nout;
+}
+
+// Link frame `j` to frame `i` on one level, re-selecting the
+// neighbours of `i` if its list is already full
+static inline void hnsw_link(
+    hnsw_index& index,
+    const slice2d<float> features,
+    const int i,
+    const int j,
+    const int level)
+{
+    int* links = hnsw_links(index, i, level);
+    int nlinks_max = hnsw_links_max(index, level);
+
+    int nlinks = 0;
+    while (nlinks < nlinks_max && links[nlinks] != -1) { nlinks++; }
+
+    if (nlinks < nlinks_max)
+    {
+        links[nlinks] = j;
+        return;
+    }
+
+    // Sort existing neighbours and the new one by distance
+    int candidates[2 * HNSW_M_MAX + 1];
+    float candidate_dists[2 * HNSW_M_MAX + 1];
+    int order[2 * HNSW_M_MAX + 1];
+
+    for (int n = 0; n < nlinks; n++)
+    {
+        candidates[n] = links[n];
+    }
+    candidates[nlinks] = j;
+
+    for (int n = 0; n <= nlinks; n++)
+    {
+        candidate_dists[n] = hnsw_distance(features(i), features, candidates[n]);
+        order[n] = n;
+    }
+
+    std::sort(order, order + nlinks + 1, [&](const int a, const int b)
+    {
+        return candidate_dists[a] < candidate_dists[b] ||
+              (candidate_dists[a] == candidate_dists[b] && candidates[a] < candidates[b]);
+    });
+
+    int sorted[2 * HNSW_M_MAX + 1];
+    float sorted_dists[2 * HNSW_M_MAX + 1];
+    for (int n = 0; n <= nlinks; n++)
+    {
+        sorted[n] = candidates[order[n]];
+        sorted_dists[n] = candidate_dists[order[n]];
+    }
+
+    int nout = hnsw_select_neighbours(links, nlinks_max, features, sorted, sorted_dists, nlinks + 1);
+    for (int n = nout; n < nlinks_max; n++)
+    {
+        links[n] = -1;
+    }
+}
+
+// Build the graph over db.features_ordered. This takes a while for
+// large databases so is best done offline, see hnsw_index_save.
+void hnsw_index_build(
+    hnsw_index& index,
+    const database& db,
+    const int m = HNSW_M_DEFAULT,
+    const int ef_construction = HNSW_EF_CONSTRUCTION_DEFAULT,
+    unsigned int seed = 12345)
+{
+    assert(m >= 2 && m <= HNSW_M_MAX);
+
+    const slice2d<float> features = db.features_ordered;
+    int nframes = db.nframes();
+
+    index.m = m;
+    index.entry = -1;
+    index.max_level = -1;
+
+    // Draw level of each frame, each level has about 1/m of the frames of the one below
+    float level_mult = 1.0f / logf((float)m);
+
+    index.levels.resize(nframes);
+    index.upper_offsets.resize(nframes);
+
+    int nupper = 0;
+    for (int i = 0; i < nframes; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        float u = ((seed >> 8) + 1) / 16777217.0f;
+        int level = (int)(-logf(u) * level_mult);
+        index.levels(i) = level < HNSW_LEVELS_MAX - 1 ? level : HNSW_LEVELS_MAX - 1;
+        index.upper_offsets(i) = nupper;
+        nupper += index.levels(i) * m;
+    }
+
+    index.links0.resize(nframes, 2 * m);
+    index.links0.set(-1);
+    index.upper_links.resize(nupper);
+    index.upper_links.set(-1);
+
+    hnsw_search_state state;
+    hnsw_search_state_init(state, nframes, ef_construction);
+
+    array1d<int> candidates(ef_construction);
+    array1d<float> candidate_dists(ef_construction);
+    array1d<int> neighbours(2 * m);
+
+    auto allow_all = [](const int) { return true; };
+
+    // Insert frames one at a time
+    for (int i = 0; i < nframes; i++)
+    {
+        int level = index.levels(i);
+
+        if (index.entry == -1)
+        {
+            index.entry = i;
+            index.max_level = level;
+            continue;
+        }
+
+        // Walk down to the level of the new frame
+        int curr = index.entry;
+        float curr_dist = hnsw_distance(features(i), features, curr);
+        for (int l = index.max_level; l > level; l--)
+        {
+            hnsw_search_greedy(curr, curr_dist, index, features, features(i), l);
+        }
+
+        // Link to the closest frames on each level
+        for (int l = level < index.max_level ? level : index.max_level; l >= 0; l--)
+        {
+            hnsw_search_level(state, index, features, features(i), curr, l, allow_all, NULL);
+            candidate_heap_sort(state.results);
+
+            int ncandidates = state.results.size;
+            for (int c = 0; c < ncandidates; c++)
+            {
+                candidates(c) = state.results.indices(c);
+                candidate_dists(c) = state.results.costs(c);
+            }
+
+            int nneighbours = hnsw_select_neighbours(
+                neighbours.data, m, features, candidates.data, candidate_dists.data, ncandidates);
+
+            int* links = hnsw_links(index, i, l);
+            for (int n = 0; n < nneighbours; n++)
+            {
+                links[n] = neighbours(n);
+                hnsw_link(index, features, neighbours(n), i, l);
+            }
+
+            curr = candidates(0);
+        }
+
+        if (level > index.max_level)
+        {
+            index.entry = i;
+            index.max_level = level;
+        }
+    }
+}
+
+//--------------------------------------
+
+// Hash of the features so that an index saved for different features
+// (for example after changing the feature weights) is not loaded
+static inline unsigned int hnsw_features_hash(const database& db)
+{
+    unsigned int hash = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)db.features_ordered.data;
+    size_t nbytes = sizeof(float) * db.features_ordered.rows * db.features_ordered.cols;
+    for (size_t b = 0; b < nbytes; b++)
+    {
+        hash = (hash ^ bytes[b]) * 16777619u;
+    }
+    return hash;
+}
+
+void hnsw_index_save(const hnsw_index& index, const database& db, const char* filename)
+{
+    FILE* f = fopen(filename, "wb");
+    assert(f != NULL);
+
+    int header[5] = { HNSW_FILE_MAGIC, HNSW_FILE_VERSION, db.nframes(), db.nfeatures(), (int)hnsw_features_hash(db) };
+    fwrite(header, sizeof(int), 5, f);
+
+    fwrite(&index.m, sizeof(int), 1, f);
+    fwrite(&index.entry, sizeof(int), 1, f);
+    fwrite(&index.max_level, sizeof(int), 1, f);
+    array1d_write(index.levels, f);
+    array2d_write(index.links0, f);
+    array1d_write(index.upper_offsets, f);
+    array1d_write(index.upper_links, f);
+
+    fclose(f);
+}
+
+// Read an array written by array1d_write, returning false if the
+// file is truncated or the array holds more than `size_max` items
+static inline bool hnsw_read_array(array1d<int>& arr, FILE* f, const long long size_max)
+{
+    int size;
+    if (fread(&size, sizeof(int), 1, f) != 1 || size < 0 || size > size_max) { return false; }
+    arr.resize(size);
+    return (int)fread(arr.data, sizeof(int), size, f) == size;
+}
+
+// Same for array2d_write, the array must have exactly the given shape
+static inline bool hnsw_read_array(array2d<int>& arr, FILE* f, const int rows, const int cols)
+{
+    int shape[2];
+    if (fread(shape, sizeof(int), 2, f) != 2 || shape[0] != rows || shape[1] != cols) { return false; }
+    arr.resize(rows, cols);
+    return (int)fread(arr.data, sizeof(int), rows * cols, f) == rows * cols;
+}
+
+// Check a loaded index is consistent so that searching it can't read
+// outside of its arrays: every level and link is in range, the upper
+// links are laid out as hnsw_index_build does, and the entry is on
+// the highest level.
+bool hnsw_index_valid(const hnsw_index& index, const int nframes)
+{
+    if (index.m < 2 || index.m > HNSW_M_MAX ||
+        index.entry < 0 || index.entry >= nframes ||
+        index.max_level < 0 || index.max_level >= HNSW_LEVELS_MAX ||
+        index.levels.size != nframes ||
+        index.links0.rows != nframes || index.links0.cols != 2 * index.m ||
+        index.upper_offsets.size != nframes ||
+        index.levels(index.entry) != index.max_level)
+    {
+        return false;
+    }
+
+    int nupper = 0;
+    for (int i = 0; i < nframes; i++)
+    {
+        if (index.levels(i) < 0 || index.levels(i) > index.max_level ||
+            index.upper_offsets(i) != nupper)
+        {
+            return false;
+        }
+        nupper += index.levels(i) * index.m;
+    }
+
+    if (index.upper_links.size != nupper) { return false; }
+
+    for (int i = 0; i < nframes; i++)
+    {
+        for (int n = 0; n < index.links0.cols; n++)
+        {
+            if (index.links0(i, n) < -1 || index.links0(i, n) >= nframes) { return false; }
+        }
+    }
+
+    for (int n = 0; n < nupper; n++)
+    {
+        if (index.upper_links(n) < -1 || index.upper_links(n) >= nframes) { return false; }
+    }
+
+    return true;
+}
+
+// Returns false if there is no saved index, it was built for different
+// features, or the file is truncated or otherwise invalid
+bool hnsw_index_load(hnsw_index& index, const database& db, const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { return false; }
+
+    int header[5];
+    if (fread(header, sizeof(int), 5, f) != 5 ||
+        header[0] != HNSW_FILE_MAGIC ||
+        header[1] != HNSW_FILE_VERSION ||
+        header[2] != db.nframes() ||
+        header[3] != db.nfeatures() ||
+        header[4] != (int)hnsw_features_hash(db))
+    {
+        fclose(f);
+        return false;
+    }
+
+    int nframes = db.nframes();
+    int params[3];
+
+    bool valid =
+        fread(params, sizeof(int), 3, f) == 3 &&
+        params[0] >= 2 && params[0] <= HNSW_M_MAX &&
+        hnsw_read_array(index.levels, f, nframes) &&
+        hnsw_read_array(index.links0, f, nframes, 2 * params[0]) &&
+        hnsw_read_array(index.upper_offsets, f, nframes) &&
+        hnsw_read_array(index.upper_links, f, (long long)nframes * (HNSW_LEVELS_MAX - 1) * params[0]);
+
+    fclose(f);
+
+    if (valid)
+    {
+        index.m = params[0];
+        index.entry = params[1];
+        index.max_level = params[2];
+        valid = hnsw_index_valid(index, nframes);
+    }
+
+    if (!valid)
+    {
+        index = hnsw_index();
+    }
+
+    return valid;
+}
+
+//--------------------------------------
+
+// Approximate version of motion_matching_search using the graph.
+// Frames at the end of ranges and around the current frame are
+// filtered out of the results but still walked through. The current
+// frame is only replaced when a frame with a lower cost is found.
+/*
+index [in]             : 加速结构，见hnsw_index_build
+state [in/out]         : 搜索使用的内存，见hnsw_search_state_init
+ef [in]                : 搜索时保留的候选帧数量，越大越慢但找到最好的帧的概率越高
+range_stops [in]       : 每个range最后一帧的下一帧
+frame_ranges [in]      : 每一帧所在的range，见database_build_frame_ranges
+其他参数同motion_matching_search
+*/
+void motion_matching_search_hnsw(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const hnsw_index& index,
+    hnsw_search_state& state,
+    const int ef,
+    const slice1d<int> range_stops,
+    const slice1d<int> frame_ranges,
+    const slice2d<float> features,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    int curr_index = best_index;
+
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = hnsw_distance(query_normalized, features, best_index);
+    }
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    if (index.entry == -1) { return; }
+
+    auto allowed = [&](const int i)
+    {
+        // Exclude end of ranges and frames in no range
+        int r = frame_ranges(i);
+        if (r == -1 || i >= range_stops(r) - ignore_range_end)
+        {
+            return false;
+        }
+
+        // Skip surrounding frames
+        return curr_index == -1 || abs(i - curr_index) >= ignore_surrounding;
+    };
+
+    // Walk down the upper levels
+    int curr = index.entry;
+    float curr_dist = hnsw_distance(query_normalized, features, curr);
+    for (int l = index.max_level; l > 0; l--)
+    {
+        hnsw_search_greedy(curr, curr_dist, index, features, query_normalized, l);
+    }
+
+    // Search level 0
+    hnsw_search_state_init(state, features.rows, ef);
+    hnsw_search_level(state, index, features, query_normalized, curr, 0, allowed, stats);
+
+    // Results are sorted by cost and then index so the first is the best
+    candidate_heap_sort(state.results);
+
+    if (state.results.size > 0 && transition_cost + state.results.costs(0) < best_cost)
+    {
+        best_index = state.results.indices(0);
+        best_cost = transition_cost + state.results.costs(0);
+    }
+}
+
+// Search database using the graph index
+/*
+index [in]             : 加速结构，见hnsw_index_build和hnsw_index_load
+state [in/out]         : 搜索使用的内存，多次搜索之间可以复用
+ef [in]                : 搜索时保留的候选帧数量
+其他参数同database_search
+*/
+void database_search_hnsw(
+    int& best_index,
+    float& best_cost,
+    const database& db,
+    const hnsw_index& index,
+    hnsw_search_state& state,
+    const slice1d<float> query,
+    const int ef = HNSW_EF_SEARCH_DEFAULT,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+
+    // Search
+    motion_matching_search_hnsw(
+        best_index,
+        best_cost,
+        index,
+        state,
+        ef,
+        db.range_stops,
+        db.frame_ranges,
+        db.features_ordered,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Report how often the graph search finds the best frame, and how
+// long it takes, for a few values of ef compared to the exact search.
+// See database_random_queries.
+void database_benchmark_hnsw(const database& db, const hnsw_index& index, const int nqueries = 1000, FILE* out = stdout)
+{
+    const int efs[] = { 8, 16, 32, 64, 128, 256 };
+    int nefs = sizeof(efs) / sizeof(efs[0]);
+
+    array2d<float> queries(nqueries, db.nfeatures());
+    array1d<int> starts(nqueries);
+    database_random_queries(queries, starts, db);
+
+    array1d<float> exact_costs(nqueries);
+
+    search_stats stats;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int q = 0; q < nqueries; q++)
+    {
+        int best_index = starts(q);
+        exact_costs(q) = FLT_MAX;
+        database_search(best_index, exact_costs(q), db, queries(q), 0.0f, 20, 20, &stats);
+    }
+
+    auto stop_time = std::chrono::high_resolution_clock::now();
+
+    fprintf(out, "%-8s %14s %10s %14s %12s\n", "ef", "frames/search", "recall (%)", "cost ratio", "us/search");
+    fprintf(out, "%-8s %14.1f %10.1f %14.4f %12.1f\n", "exact",
+        (double)stats.frames_evaluated / nqueries, 100.0, 1.0,
+        std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+
+    hnsw_search_state state;
+
+    for (int e = 0; e < nefs; e++)
+    {
+        search_stats_reset(stats);
+        int matches = 0;
+        double cost_ratio = 0.0;
+
+        // Allocate scratch memory outside of timing
+        hnsw_search_state_init(state, db.nframes(), efs[e]);
+
+        start_time = std::chrono::high_resolution_clock::now();
+
+        for (int q = 0; q < nqueries; q++)
+        {
+            int best_index = starts(q);
+            float best_cost = FLT_MAX;
+            database_search_hnsw(best_index, best_cost, db, index, state, queries(q), efs[e], 0.0f, 20, 20, &stats);
+            matches += best_cost <= exact_costs(q);
+            cost_ratio += exact_costs(q) > 0.0f ? best_cost / exact_costs(q) : 1.0;
+        }
+
+        stop_time = std::chrono::high_resolution_clock::now();
+
+        char name[16];
+        snprintf(name, sizeof(name), "%d", efs[e]);
+        fprintf(out, "%-8s %14.1f %10.1f %14.4f %12.1f\n", name,
+            (double)stats.frames_evaluated / nqueries, 100.0 * matches / nqueries, cost_ratio / nqueries,
+            std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+    }
+}
@@ -0,0 +1,410 @@
+#pragma once
+
+#include "database.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//--------------------------------------
+
+enum
+{
+    // Databases with fewer frames than this are searched on
+    // the calling thread since waking the workers costs more
+    // than it saves.
+    PARALLEL_SEARCH_MIN_FRAMES = 65536,
+
+    // Ranges are split into chunks of at most this many frames,
+    // aligned to large boxes, which workers take in order.
+    PARALLEL_SEARCH_CHUNK_SIZE = 16 * BOUND_LR_SIZE,
+};
+
+// A simple pool of persistent worker threads. Every call to
+// `search_pool_run` runs the same job on every worker as well
+// as on the calling thread and waits for all of them to finish.
+struct search_pool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(int)> job;
+    int generation = 0;
+    int pending = 0;
+    bool quit = false;
+
+    ~search_pool();
+
+    int nworkers() const { return (int)threads.size() + 1; }
+};
+
+void search_pool_worker(search_pool& pool, const int worker)
+{
+    int generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.wake.wait(lock, [&] { return pool.quit || pool.generation != generation; });
+            if (pool.quit) { return; }
+            generation = pool.generation;
+        }
+
+        pool.job(worker);
+
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.pending--;
+            if (pool.pending == 0) { pool.done.notify_one(); }
+        }
+    }
+}
+
+// Start `nthreads` workers in addition to the calling thread.
+// Passing -1 uses one worker per hardware thread.
+void search_pool_init(search_pool& pool, int nthreads = -1)
+{
+    assert(pool.threads.empty());
+
+    if (nthreads < 0)
+    {
+        nthreads = (int)std::thread::hardware_concurrency() - 1;
+        nthreads = nthreads < 0 ? 0 : nthreads;
+    }
+
+    pool.quit = false;
+    for (int i = 0; i < nthreads; i++)
+    {
+        pool.threads.emplace_back(search_pool_worker, std::ref(pool), i + 1);
+    }
+}
+
+void search_pool_free(search_pool& pool)
+{
+    {
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.quit = true;
+    }
+    pool.wake.notify_all();
+
+    for (int i = 0; i < (int)pool.threads.size(); i++)
+    {
+        pool.threads[i].join();
+    }
+    pool.threads.clear();
+}
+
+search_pool::~search_pool()
+{
+    search_pool_free(*this);
+}
+
+void search_pool_run(search_pool& pool, const std::function<void(int)>& job)
+{
+    {
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.job = job;
+        pool.pending = (int)pool.threads.size();
+        pool.generation++;
+    }
+    pool.wake.notify_all();
+
+    // The calling thread is always worker zero
+    job(0);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&] { return pool.pending == 0; });
+}
+
+//--------------------------------------
+
+static inline void atomic_minf(std::atomic<float>& x, const float v)
+{
+    float curr = x.load(std::memory_order_relaxed);
+    while (v < curr && !x.compare_exchange_weak(curr, v, std::memory_order_relaxed)) {}
+}
+
+// Sweep for a single worker. A box is pruned if it cannot beat the
+// worker's own best or is strictly worse than the best found by any
+// worker, which is only read once per box.
+struct search_sweep_chunk
+{
+    int& local_index;
+    float& local_cost;
+    std::atomic<float>& shared_cost;
+    const slice2d<float> features;
+    const slice2d<float> bound_sm_min;
+    const slice2d<float> bound_sm_max;
+    const slice2d<float> bound_lr_min;
+    const slice2d<float> bound_lr_max;
+    const slice1d<float> query_normalized;
+    const float transition_cost;
+    search_stats* stats;
+
+    // Lowest cost which prunes a box, as costs equal to the shared
+    // best must still be found
+    float box_bound() const
+    {
+        return minf(local_cost, nextafterf(shared_cost.load(std::memory_order_relaxed), INFINITY));
+    }
+
+    bool prune_lr(const int i_lr) const
+    {
+        float bound = box_bound();
+        return search_box_cost(query_normalized, bound_lr_min(i_lr), bound_lr_max(i_lr), transition_cost, bound) >= bound;
+    }
+
+    bool prune_sm(const int i_sm) const
+    {
+        float bound = box_bound();
+        return search_box_cost(query_normalized, bound_sm_min(i_sm), bound_sm_max(i_sm), transition_cost, bound) >= bound;
+    }
+
+    void frame(const int i)
+    {
+        float cost = search_frame_cost(query_normalized, features(i), transition_cost, local_cost, stats);
+
+        // If cost is lower than current best then update best
+        if (cost < local_cost)
+        {
+            local_index = i;
+            local_cost = cost;
+            atomic_minf(shared_cost, cost);
+        }
+    }
+};
+
+// Search the frames `start` to `stop` of a single range for a
+// single worker. Boxes and frames are skipped if they cannot beat
+// the worker's own best, or if they are strictly worse than the
+// best found by any worker so far. Ties with other workers are
+// kept so that they can be broken by index when merging.
+void motion_matching_search_chunk(
+    int&   _restrict local_index,
+    float& _restrict local_cost,
+    std::atomic<float>& shared_cost,
+    const int start,
+    const int stop,
+    const int curr_index,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_surrounding,
+    search_stats* stats)
+{
+    search_sweep_chunk sweep = {
+        local_index, local_cost, shared_cost, features,
+        bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+        query_normalized, transition_cost, stats };
+
+    search_sweep(sweep, start, stop, search_box_layout_default, curr_index, ignore_surrounding, stats);
+}
+
+// Motion Matching search split over a pool of workers. Ranges
+// are cut into chunks which workers take in order, and the best
+// cost found so far is shared between workers so that each one
+// can prune using matches found by the others. Results are merged
+// by lowest cost and then lowest index so the result does not
+// depend on how the work was scheduled.
+/*
+pool [in]              : 工作线程池，见search_pool_init
+其他参数同motion_matching_search
+*/
+void motion_matching_search_parallel(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    search_pool& pool,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice1d<float> features_offset,
+    const slice1d<float> features_scale,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    // Small databases or an empty pool are not worth splitting
+    if (pool.nworkers() <= 1 || features.rows < PARALLEL_SEARCH_MIN_FRAMES)
+    {
+        motion_matching_search(
+            best_index,
+            best_cost,
+            range_starts,
+            range_stops,
+            features,
+            features_offset,
+            features_scale,
+            bound_sm_min,
+            bound_sm_max,
+            bound_lr_min,
+            bound_lr_max,
+            query_normalized,
+            transition_cost,
+            ignore_range_end,
+            ignore_surrounding,
+            stats);
+
+        return;
+    }
+
+    SEARCH_STATS_TIMER_START(stats);
+
+    int nfeatures = query_normalized.size;
+    int nranges = range_starts.size;
+
+    int curr_index = best_index;
+
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+
+    // Cut ranges into chunks aligned to large boxes
+    std::vector<int> chunk_starts;
+    std::vector<int> chunk_stops;
+
+    for (int r = 0; r < nranges; r++)
+    {
+        int i = range_starts(r);
+        int range_end = range_stops(r) - ignore_range_end;
+
+        while (i < range_end)
+        {
+            int i_next = ((i / PARALLEL_SEARCH_CHUNK_SIZE) + 1) * PARALLEL_SEARCH_CHUNK_SIZE;
+            i_next = i_next < range_end ? i_next : range_end;
+            chunk_starts.push_back(i);
+            chunk_stops.push_back(i_next);
+            i = i_next;
+        }
+    }
+
+    int nchunks = (int)chunk_starts.size();
+
+    std::atomic<int> next_chunk(0);
+    std::atomic<float> shared_cost(best_cost);
+
+    array1d<int> worker_indices(pool.nworkers());
+    array1d<float> worker_costs(pool.nworkers());
+
+    // Each worker counts into its own statistics, gathered at the end
+    std::vector<search_stats> worker_stats(stats ? pool.nworkers() : 0);
+
+    search_pool_run(pool, [&](int worker)
+    {
+        int local_index = -1;
+        float local_cost = best_cost;
+        search_stats* local_stats = stats ? &worker_stats[worker] : NULL;
+
+        while (true)
+        {
+            int c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (c >= nchunks) { break; }
+
+            motion_matching_search_chunk(
+                local_index,
+                local_cost,
+                shared_cost,
+                chunk_starts[c],
+                chunk_stops[c],
+                curr_index,
+                features,
+                bound_sm_min,
+                bound_sm_max,
+                bound_lr_min,
+                bound_lr_max,
+                query_normalized,
+                transition_cost,
+                ignore_surrounding,
+                local_stats);
+        }
+
+        worker_indices(worker) = local_index;
+        worker_costs(worker) = local_cost;
+    });
+
+    // Merge by lowest cost then lowest index. Workers only
+    // report frames strictly better than the starting best.
+    for (int w = 0; w < pool.nworkers(); w++)
+    {
+        if (worker_indices(w) == -1) { continue; }
+
+        if (worker_costs(w) < best_cost ||
+           (worker_costs(w) == best_cost && worker_indices(w) < best_index))
+        {
+            best_index = worker_indices(w);
+            best_cost = worker_costs(w);
+        }
+    }
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+#if SEARCH_STATS
+    for (int w = 0; w < (int)worker_stats.size(); w++)
+    {
+        search_stats_accumulate(*stats, worker_stats[w]);
+    }
+#endif
+
+    SEARCH_STATS_TIMER_STOP(stats);
+}
+
+// Search database using a pool of worker threads
+/*
+pool [in]              : 工作线程池，见search_pool_init
+其他参数同database_search
+*/
+void database_search_parallel(
+    int& best_index,
+    float& best_cost,
+    search_pool& pool,
+    const database& db,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+
+    // Search
+    motion_matching_search_parallel(
+        best_index,
+        best_cost,
+        pool,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.features_offset,
+        db.features_scale,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
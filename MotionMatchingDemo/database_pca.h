@@ -0,0 +1,510 @@
+#pragma once
+
+#include "database.h"
+
+#include <chrono>
+#include <math.h>
+
+//--------------------------------------
+
+enum
+{
+    // Number of principal components used by default
+    PCA_DIMS_DEFAULT = 8,
+
+    // Maximum number of sweeps of the Jacobi eigenvalue solver
+    PCA_JACOBI_SWEEPS_MAX = 64,
+};
+
+// Projection of the (ordered) features onto their first principal
+// components. Because the rows of `basis` are orthonormal, the
+// squared distance between two projected feature vectors is never
+// larger than the squared distance between the full vectors, so the
+// projected features give a lower bound for the cost of a frame which
+// is cheaper to compute. The features
+// are highly correlated (foot positions and velocities, trajectory
+// positions and directions) so a few components capture most of the
+// variance and the bound is usually tight.
+//
+// In float the rows of `basis` are only nearly orthonormal and the
+// projections carry rounding error proportional to the length of the
+// projected vectors, not to their difference. `basis_norm` and
+// `norms` are kept so the search can bound both, see
+// motion_matching_search_pca.
+/*
+    ndims            : 主成分数量d
+    mean             : features_ordered每一列的平均值
+    basis            : rows为d，cols为Features Number，每行为一个单位长度的主成分，按方差从大到小排列
+    basis_norm       : basis的谱范数的上界(略大于1)
+    variances        : 每个主成分的方差
+    variance_total   : 所有列方差之和，用于计算主成分解释的方差比例
+    features         : 投影后的features_ordered，rows为Frames，cols为d
+    norms            : 每帧features_ordered减去mean后的长度，用于估计投影的舍入误差
+*/
+struct pca_index
+{
+    int ndims;
+    array1d<float> mean;
+    array2d<float> basis;
+    float basis_norm;
+    array1d<float> variances;
+    float variance_total;
+    array2d<float> features;
+    array1d<float> norms;
+
+    pca_index() : ndims(0), basis_norm(1.0f), variance_total(0.0f) {}
+};
+
+// Find the eigenvalues and eigenvectors of the symmetric matrix `a`
+// using the cyclic Jacobi method. On return the diagonal of `a` holds
+// the eigenvalues and the columns of `v` the eigenvectors.
+void pca_jacobi_eigen(array2d<double>& a, array2d<double>& v)
+{
+    int n = a.rows;
+    assert(a.cols == n);
+
+    v.resize(n, n);
+    v.zero();
+    for (int i = 0; i < n; i++)
+    {
+        v(i, i) = 1.0;
+    }
+
+    for (int sweep = 0; sweep < PCA_JACOBI_SWEEPS_MAX; sweep++)
+    {
+        double off = 0.0;
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                off += a(p, q) * a(p, q);
+            }
+        }
+
+        if (off < 1e-20) { break; }
+
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                if (fabs(a(p, q)) < 1e-30) { continue; }
+
+                // Find rotation which zeros a(p, q)
+                double theta = (a(q, q) - a(p, p)) / (2.0 * a(p, q));
+                double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < n; k++)
+                {
+                    double akp = a(k, p);
+                    double akq = a(k, q);
+                    a(k, p) = c * akp - s * akq;
+                    a(k, q) = s * akp + c * akq;
+                }
+
+                for (int k = 0; k < n; k++)
+                {
+                    double apk = a(p, k);
+                    double aqk = a(q, k);
+                    a(p, k) = c * apk - s * aqk;
+                    a(q, k) = s * apk + c * aqk;
+                }
+
+                for (int k = 0; k < n; k++)
+                {
+                    double vkp = v(k, p);
+                    double vkq = v(k, q);
+                    v(k, p) = c * vkp - s * vkq;
+                    v(k, q) = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// Project a vector in the order of features_ordered onto the principal components
+void pca_index_project(
+    slice1d<float> projected,
+    const pca_index& pca,
+    const slice1d<float> x)
+{
+    for (int k = 0; k < pca.ndims; k++)
+    {
+        float sum = 0.0f;
+        for (int j = 0; j < x.size; j++)
+        {
+            sum += pca.basis(k, j) * (x(j) - pca.mean(j));
+        }
+        projected(k) = sum;
+    }
+}
+
+// Length of a vector in the order of features_ordered relative to the mean
+float pca_index_norm(const pca_index& pca, const slice1d<float> x)
+{
+    double sum = 0.0;
+    for (int j = 0; j < x.size; j++)
+    {
+        sum += ((double)x(j) - pca.mean(j)) * ((double)x(j) - pca.mean(j));
+    }
+    return (float)sqrt(sum);
+}
+
+// Build the projection onto the first `ndims` principal components of
+// db.features_ordered along with the projected features
+void pca_index_build(pca_index& pca, const database& db, const int ndims = PCA_DIMS_DEFAULT)
+{
+    int nfeatures = db.nfeatures();
+    int nframes = db.nframes();
+
+    assert(ndims > 0 && ndims <= nfeatures);
+
+    // Compute mean and covariance
+    array1d<double> mean(nfeatures);
+    mean.zero();
+
+    for (int i = 0; i < nframes; i++)
+    {
+        for (int j = 0; j < nfeatures; j++)
+        {
+            mean(j) += db.features_ordered(i, j) / nframes;
+        }
+    }
+
+    array2d<double> covariance(nfeatures, nfeatures);
+    covariance.zero();
+
+    for (int i = 0; i < nframes; i++)
+    {
+        for (int j0 = 0; j0 < nfeatures; j0++)
+        {
+            double d0 = db.features_ordered(i, j0) - mean(j0);
+            for (int j1 = j0; j1 < nfeatures; j1++)
+            {
+                covariance(j0, j1) += d0 * (db.features_ordered(i, j1) - mean(j1)) / nframes;
+            }
+        }
+    }
+
+    for (int j0 = 0; j0 < nfeatures; j0++)
+    {
+        for (int j1 = 0; j1 < j0; j1++)
+        {
+            covariance(j0, j1) = covariance(j1, j0);
+        }
+    }
+
+    pca.variance_total = 0.0f;
+    for (int j = 0; j < nfeatures; j++)
+    {
+        pca.variance_total += (float)covariance(j, j);
+    }
+
+    // Eigen decomposition
+    array2d<double> eigenvectors;
+    pca_jacobi_eigen(covariance, eigenvectors);
+
+    // Sort components by variance, largest first
+    array1d<int> order(nfeatures);
+    for (int j = 0; j < nfeatures; j++)
+    {
+        order(j) = j;
+    }
+
+    for (int j = 1; j < nfeatures; j++)
+    {
+        int x = order(j);
+        int k = j;
+        while (k > 0 && covariance(order(k - 1), order(k - 1)) < covariance(x, x))
+        {
+            order(k) = order(k - 1);
+            k--;
+        }
+        order(k) = x;
+    }
+
+    // Store the first components, re-normalizing in float precision
+    pca.ndims = ndims;
+    pca.mean.resize(nfeatures);
+    pca.basis.resize(ndims, nfeatures);
+    pca.variances.resize(ndims);
+
+    for (int j = 0; j < nfeatures; j++)
+    {
+        pca.mean(j) = (float)mean(j);
+    }
+
+    for (int k = 0; k < ndims; k++)
+    {
+        double length = 0.0;
+        for (int j = 0; j < nfeatures; j++)
+        {
+            length += eigenvectors(j, order(k)) * eigenvectors(j, order(k));
+        }
+        length = sqrt(length);
+
+        for (int j = 0; j < nfeatures; j++)
+        {
+            pca.basis(k, j) = (float)(eigenvectors(j, order(k)) / length);
+        }
+
+        pca.variances(k) = (float)covariance(order(k), order(k));
+    }
+
+    // Bound the spectral norm of the float basis by the largest
+    // absolute row sum of basis * basis^T (Gershgorin)
+    double gram_max = 0.0;
+    for (int k0 = 0; k0 < ndims; k0++)
+    {
+        double row = 0.0;
+        for (int k1 = 0; k1 < ndims; k1++)
+        {
+            double dot = 0.0;
+            for (int j = 0; j < nfeatures; j++)
+            {
+                dot += (double)pca.basis(k0, j) * pca.basis(k1, j);
+            }
+            row += fabs(dot);
+        }
+        gram_max = row > gram_max ? row : gram_max;
+    }
+    pca.basis_norm = (float)sqrt(gram_max) * (1.0f + FLT_EPSILON);
+
+    // Project features
+    pca.features.resize(nframes, ndims);
+    pca.norms.resize(nframes);
+    for (int i = 0; i < nframes; i++)
+    {
+        pca_index_project(pca.features(i), pca, db.features_ordered(i));
+        pca.norms(i) = pca_index_norm(pca, db.features_ordered(i));
+    }
+}
+
+// Fraction of the total variance captured by the components
+float pca_index_explained_variance(const pca_index& pca)
+{
+    float sum = 0.0f;
+    for (int k = 0; k < pca.ndims; k++)
+    {
+        sum += pca.variances(k);
+    }
+
+    return pca.variance_total > 0.0f ? sum / pca.variance_total : 1.0f;
+}
+
+//--------------------------------------
+
+// Sweep for motion_matching_search_pca, which checks each frame in
+// the reduced space before using all features
+struct search_sweep_pca
+{
+    search_sweep_best full;
+    const pca_index& pca;
+    const slice1d<float> query_projected;
+    const float query_norm;
+    const float reduced_scale;
+    const float error_scale;
+    const float cost_scale;
+
+    bool prune_lr(const int i_lr) const { return full.prune_lr(i_lr); }
+    bool prune_sm(const int i_sm) const { return full.prune_sm(i_sm); }
+
+    void frame(const int i)
+    {
+        // Check against frame in reduced space
+        float reduced_cost = 0.0f;
+        for (int k = 0; k < query_projected.size; k++)
+        {
+            reduced_cost += squaref(query_projected(k) - pca.features(i, k));
+        }
+
+        float reduced_dist = sqrtf(reduced_scale * reduced_cost) - error_scale * (query_norm + pca.norms(i));
+
+        if (reduced_dist > 0.0f && full.transition_cost + cost_scale * squaref(reduced_dist) >= full.best_cost)
+        {
+            return;
+        }
+
+        // Check against frame using all features
+        full.frame(i);
+    }
+};
+
+// Same as motion_matching_search but each frame which is not pruned
+// by the boxes is first checked in the reduced space of the principal
+// components. Only frames whose reduced cost is below the best cost
+// are checked using all the features, so most frames only cost a few
+// dimensions.
+//
+// The reduced distance is turned into a bound which also holds in
+// float. Each projected component of the query or frame is off by at
+// most gamma(nfeatures + 2) * basis_norm * |x - mean|, which is an
+// absolute error that can be larger than the projected difference
+// itself for near identical frames. This error is subtracted from the
+// reduced distance before dividing by basis_norm, and the result is
+// shrunk by the rounding of the full cost, see search_rounding_error.
+// A frame is only pruned when the full search would not have accepted
+// it either, so the result is the same as the full search.
+/*
+pca [in]               : 主成分投影，见pca_index_build
+query_projected [in]   : 投影后的query，见pca_index_project
+其他参数同motion_matching_search
+*/
+void motion_matching_search_pca(
+    int&   _restrict best_index,
+    float& _restrict best_cost,
+    const pca_index& pca,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice2d<float> features,
+    const slice2d<float> bound_sm_min,
+    const slice2d<float> bound_sm_max,
+    const slice2d<float> bound_lr_min,
+    const slice2d<float> bound_lr_max,
+    const slice1d<float> query_normalized,
+    const slice1d<float> query_projected,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    search_stats* stats = NULL)
+{
+    int nfeatures = query_normalized.size;
+    int ndims = query_projected.size;
+
+    int curr_index = best_index;
+
+    // Scales for the lower bound, each with a few operations of
+    // slack for the rounding of the bound itself
+    float query_norm = pca_index_norm(pca, query_normalized);
+    float reduced_scale = 1.0f - search_rounding_error(ndims + 8);
+    float error_scale = sqrtf((float)ndims) * pca.basis_norm * search_rounding_error(nfeatures + 8);
+    float cost_scale = (1.0f - search_rounding_error(nfeatures + 16)) / squaref(pca.basis_norm);
+
+    // Find cost for current frame
+    if (best_index != -1)
+    {
+        best_cost = 0.0;
+        for (int i = 0; i < nfeatures; i++)
+        {
+            best_cost += squaref(query_normalized(i) - features(best_index, i));
+        }
+    }
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    search_sweep_pca sweep = {
+        { best_index, best_cost, features,
+          bound_sm_min, bound_sm_max, bound_lr_min, bound_lr_max,
+          query_normalized, NULL, transition_cost, stats },
+        pca, query_projected, query_norm, reduced_scale, error_scale, cost_scale };
+
+    // Search rest of database
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Search database using the principal components to prune
+/*
+pca [in]               : 主成分投影，见pca_index_build
+其他参数同database_search
+*/
+void database_search_pca(
+    int& best_index,
+    float& best_cost,
+    const database& db,
+    const pca_index& pca,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    search_stats* stats = NULL)
+{
+    // Normalize and project Query
+    array1d<float> query_normalized(db.nfeatures());
+    database_normalize_query(query_normalized, db, query);
+
+    array1d<float> query_projected(pca.ndims);
+    pca_index_project(query_projected, pca, query_normalized);
+
+    // Search
+    motion_matching_search_pca(
+        best_index,
+        best_cost,
+        pca,
+        db.range_starts,
+        db.range_stops,
+        db.features_ordered,
+        db.bound_sm_min,
+        db.bound_sm_max,
+        db.bound_lr_min,
+        db.bound_lr_max,
+        query_normalized,
+        query_projected,
+        transition_cost,
+        ignore_range_end,
+        ignore_surrounding,
+        stats);
+}
+
+//--------------------------------------
+
+// Compare searching with a few different numbers of principal
+// components to the full search, see database_random_queries
+void database_benchmark_pca(const database& db, const int nqueries = 1000, FILE* out = stdout)
+{
+    const int dims[] = { 2, 4, 6, 8, 12, 16 };
+    int ndims = sizeof(dims) / sizeof(dims[0]);
+
+    array2d<float> queries(nqueries, db.nfeatures());
+    array1d<int> starts(nqueries);
+    database_random_queries(queries, starts, db);
+
+    array1d<int> exact_indices(nqueries);
+
+    search_stats stats;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int q = 0; q < nqueries; q++)
+    {
+        float best_cost = FLT_MAX;
+        exact_indices(q) = starts(q);
+        database_search(exact_indices(q), best_cost, db, queries(q), 0.0f, 20, 20, &stats);
+    }
+
+    auto stop_time = std::chrono::high_resolution_clock::now();
+
+    fprintf(out, "%-8s %10s %14s %14s %10s %12s\n", "dims", "variance", "frames/search", "dims/frame", "match (%)", "us/search");
+    fprintf(out, "%-8s %10.3f %14.1f %14.2f %10.1f %12.1f\n", "full", 1.0f,
+        (double)stats.frames_evaluated / nqueries, search_stats_average_dims(stats), 100.0,
+        std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+
+    for (int d = 0; d < ndims; d++)
+    {
+        if (dims[d] > db.nfeatures()) { continue; }
+
+        pca_index pca;
+        pca_index_build(pca, db, dims[d]);
+
+        search_stats_reset(stats);
+        int matches = 0;
+
+        start_time = std::chrono::high_resolution_clock::now();
+
+        for (int q = 0; q < nqueries; q++)
+        {
+            int best_index = starts(q);
+            float best_cost = FLT_MAX;
+            database_search_pca(best_index, best_cost, db, pca, queries(q), 0.0f, 20, 20, &stats);
+            matches += best_index == exact_indices(q);
+        }
+
+        stop_time = std::chrono::high_resolution_clock::now();
+
+        char name[16];
+        snprintf(name, sizeof(name), "%d", dims[d]);
+        fprintf(out, "%-8s %10.3f %14.1f %14.2f %10.1f %12.1f\n", name, pca_index_explained_variance(pca),
+            (double)stats.frames_evaluated / nqueries, search_stats_average_dims(stats), 100.0 * matches / nqueries,
+            std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+    }
+}
@@ -0,0 +1,422 @@
+#pragma once
+
+#include "database.h"
+
+#include <chrono>
+#include <math.h>
+
+//--------------------------------------
+
+enum
+{
+    // Largest ratio between the quantization steps of two
+    // dimensions, see quantized_index
+    QUANTIZED_STEP_MAX = 8,
+
+    // Number of candidates found in the quantized index which
+    // are re-ranked using the float features by default
+    QUANTIZED_RERANK = 8,
+};
+
+// A compressed copy of db.features_ordered and its bounds with one
+// byte per dimension. Every dimension `j` is quantized with its own
+// step, which is always an integer multiple of a common step
+//
+//     step_j = multipliers(j) * step
+//
+// so that multiplying each quantized difference by the multiplier
+// gives distances in units of `step` which are comparable between
+// dimensions. Dimensions with a small range get a small step and so
+// keep their precision. Box bounds are rounded outward so they always
+// contain the quantized frames inside them.
+/*
+    ncols                          : 每帧占用的字节数，nfeatures向上取整到16的倍数，多出来的列值为0，multipliers为0
+    step                           : 公共量化步长，量化后的cost乘以step*step约等于标准化后的cost
+    offsets                        : 每一维量化为0时对应的值(该维的最小值)
+    multipliers                    : 每一维的步长是step的多少倍，范围为[1, QUANTIZED_STEP_MAX]
+    features                       : 量化后的features_ordered，rows为Frames，cols为ncols
+    bound_sm_min ... bound_lr_max  : 量化后的box，与db.bound_*一一对应
+*/
+struct quantized_index
+{
+    int nfeatures;
+    int ncols;
+    float step;
+    array1d<float> offsets;
+    array1d<short> multipliers;
+    array2d<unsigned char> features;
+    array2d<unsigned char> bound_sm_min;
+    array2d<unsigned char> bound_sm_max;
+    array2d<unsigned char> bound_lr_min;
+    array2d<unsigned char> bound_lr_max;
+
+    quantized_index() : nfeatures(0), ncols(0), step(1.0f) {}
+};
+
+static inline int quantized_index_quantize(const quantized_index& index, const int j, const float x)
+{
+    return (int)floorf((x - index.offsets(j)) / (index.multipliers(j) * index.step) + 0.5f);
+}
+
+// Build the quantized index from db.features_ordered, which must
+// already be built, see database_build_matching_features
+void quantized_index_build(quantized_index& index, const database& db)
+{
+    int nfeatures = db.nfeatures();
+    int ncols = ((nfeatures + 15) / 16) * 16;
+
+    index.nfeatures = nfeatures;
+    index.ncols = ncols;
+
+    // Find range of each dimension
+    array1d<float> mins(nfeatures);
+    array1d<float> maxs(nfeatures);
+    mins.set(FLT_MAX);
+    maxs.set(-FLT_MAX);
+
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int j = 0; j < nfeatures; j++)
+        {
+            mins(j) = minf(mins(j), db.features_ordered(i, j));
+            maxs(j) = maxf(maxs(j), db.features_ordered(i, j));
+        }
+    }
+
+    // The widest dimension uses all 255 levels with the largest multiplier
+    float range_max = 0.0f;
+    for (int j = 0; j < nfeatures; j++)
+    {
+        range_max = maxf(range_max, maxs(j) - mins(j));
+    }
+
+    index.step = range_max > 0.0f ? range_max / (255.0f * QUANTIZED_STEP_MAX) : 1.0f;
+
+    index.offsets.resize(ncols);
+    index.multipliers.resize(ncols);
+    index.offsets.zero();
+    index.multipliers.zero();
+
+    for (int j = 0; j < nfeatures; j++)
+    {
+        int multiplier = (int)ceilf((maxs(j) - mins(j)) / (255.0f * index.step));
+        index.offsets(j) = mins(j);
+        index.multipliers(j) = (short)clamp(multiplier, 1, QUANTIZED_STEP_MAX);
+    }
+
+    // Quantize features
+    index.features.resize(db.nframes(), ncols);
+    index.features.zero();
+
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        for (int j = 0; j < nfeatures; j++)
+        {
+            index.features(i, j) = (unsigned char)clamp(quantized_index_quantize(index, j, db.features_ordered(i, j)), 0, 255);
+        }
+    }
+
+    // Build bounds over the quantized features, which is the same
+    // as rounding the float bounds outward
+    int nbound_sm = db.bound_sm_min.rows;
+    int nbound_lr = db.bound_lr_min.rows;
+
+    index.bound_sm_min.resize(nbound_sm, ncols);
+    index.bound_sm_max.resize(nbound_sm, ncols);
+    index.bound_lr_min.resize(nbound_lr, ncols);
+    index.bound_lr_max.resize(nbound_lr, ncols);
+
+    index.bound_sm_min.set(255);
+    index.bound_sm_max.zero();
+    index.bound_lr_min.set(255);
+    index.bound_lr_max.zero();
+
+    for (int i = 0; i < db.nframes(); i++)
+    {
+        int i_sm = i / BOUND_SM_SIZE;
+        int i_lr = i / BOUND_LR_SIZE;
+
+        for (int j = 0; j < ncols; j++)
+        {
+            unsigned char x = index.features(i, j);
+            index.bound_sm_min(i_sm, j) = x < index.bound_sm_min(i_sm, j) ? x : index.bound_sm_min(i_sm, j);
+            index.bound_sm_max(i_sm, j) = x > index.bound_sm_max(i_sm, j) ? x : index.bound_sm_max(i_sm, j);
+            index.bound_lr_min(i_lr, j) = x < index.bound_lr_min(i_lr, j) ? x : index.bound_lr_min(i_lr, j);
+            index.bound_lr_max(i_lr, j) = x > index.bound_lr_max(i_lr, j) ? x : index.bound_lr_max(i_lr, j);
+        }
+    }
+}
+
+// Bytes used by the features and bounds of the quantized index
+size_t quantized_index_memory(const quantized_index& index)
+{
+    return
+        (size_t)index.features.rows * index.features.cols +
+        (size_t)index.bound_sm_min.rows * index.bound_sm_min.cols * 2 +
+        (size_t)index.bound_lr_min.rows * index.bound_lr_min.cols * 2;
+}
+
+// Bytes used by the float features and bounds the index replaces
+size_t quantized_index_memory_replaced(const database& db)
+{
+    return sizeof(float) * (
+        (size_t)db.features_ordered.rows * db.features_ordered.cols +
+        (size_t)db.bound_sm_min.rows * db.bound_sm_min.cols * 2 +
+        (size_t)db.bound_lr_min.rows * db.bound_lr_min.cols * 2);
+}
+
+// Quantize a normalized query. Unlike the features the query may lie
+// outside the range of the data so it is kept as 16-bit, clamped to
+// a range which can't overflow the cost, see quantized_box_cost
+void quantized_index_quantize_query(
+    slice1d<short> query_quantized,
+    const quantized_index& index,
+    const slice1d<float> query_normalized)
+{
+    assert(query_quantized.size == index.ncols);
+
+    query_quantized.zero();
+    for (int j = 0; j < index.nfeatures; j++)
+    {
+        query_quantized(j) = (short)clamp(quantized_index_quantize(index, j, query_normalized(j)), -255, 510);
+    }
+}
+
+//--------------------------------------
+
+// Sweep for motion_matching_search_quantized, where each box and
+// frame is costed all at once and every frame is offered to the heap
+struct search_sweep_quantized
+{
+    candidate_heap& candidates;
+    const quantized_index& index;
+    const short* query;
+    const short* multipliers;
+    const int ncols;
+    const float transition_cost;
+    const simd_level level;
+    search_stats* stats;
+
+    // Boxes are pruned against the current worst candidate
+    bool prune_lr(const int i_lr) const
+    {
+        return transition_cost + (float)quantized_box_cost(
+            &index.bound_lr_min(i_lr, 0), &index.bound_lr_max(i_lr, 0), query, multipliers, ncols, level) >= candidate_heap_bound(candidates);
+    }
+
+    bool prune_sm(const int i_sm) const
+    {
+        return transition_cost + (float)quantized_box_cost(
+            &index.bound_sm_min(i_sm, 0), &index.bound_sm_max(i_sm, 0), query, multipliers, ncols, level) >= candidate_heap_bound(candidates);
+    }
+
+    void frame(const int i)
+    {
+        const unsigned char* frame = &index.features(i, 0);
+        float cost = transition_cost + (float)quantized_box_cost(
+            frame, frame, query, multipliers, ncols, level);
+
+        SEARCH_STATS_ADD(stats, frames_evaluated, 1);
+        SEARCH_STATS_ADD(stats, frame_dims_visited, index.nfeatures);
+
+        candidate_heap_push(candidates, i, cost);
+    }
+};
+
+// Same as motion_matching_search_topk but over the quantized index.
+// Costs are in quantized units (multiply by index.step squared to
+// get the approximate normalized cost) and each box and frame is
+// evaluated all at once with integer SIMD rather than one dimension
+// at a time. The current frame is not a candidate.
+/*
+candidates [in/out]          : 保存找到的最好的k个帧，调用前需要clear
+index [in]                   : 量化后的features和box，见quantized_index_build
+query_quantized [in]         : 量化后的query，见quantized_index_quantize_query
+transition_cost [in]         : 量化单位下的transition_cost
+level [in]                   : 使用的指令集
+其他参数同motion_matching_search_topk
+*/
+void motion_matching_search_quantized(
+    candidate_heap& candidates,
+    const int curr_index,
+    const quantized_index& index,
+    const slice1d<int> range_starts,
+    const slice1d<int> range_stops,
+    const slice1d<short> query_quantized,
+    const float transition_cost,
+    const int ignore_range_end,
+    const int ignore_surrounding,
+    const simd_level level,
+    search_stats* stats = NULL)
+{
+    int ncols = index.ncols;
+    const short* query = query_quantized.data;
+    const short* multipliers = index.multipliers.data;
+
+    SEARCH_STATS_ADD(stats, searches, 1);
+
+    search_sweep_quantized sweep = { candidates, index, query, multipliers, ncols, transition_cost, level, stats };
+
+    search_sweep_ranges(sweep, range_starts, range_stops, ignore_range_end, curr_index, ignore_surrounding, stats);
+}
+
+// Search database using the quantized index, re-ranking the best
+// few candidates using the float features. The current frame is
+// compared exactly as in database_search. The result is usually,
+// but not always, the same as database_search, and gets closer to
+// it the more candidates are re-ranked.
+/*
+index [in]             : 量化后的features和box，见quantized_index_build
+candidates [in/out]    : 临时内存，容量为re-rank的候选帧数量，见candidate_heap_init
+level [in]             : 使用的指令集，默认使用CPU支持的最宽指令集
+其他参数同database_search
+*/
+void database_search_quantized(
+    int& best_index,
+    float& best_cost,
+    candidate_heap& candidates,
+    const database& db,
+    const quantized_index& index,
+    const slice1d<float> query,
+    const float transition_cost = 0.0f,
+    const int ignore_range_end = 20,
+    const int ignore_surrounding = 20,
+    const simd_level level = simd_level_detect(),
+    search_stats* stats = NULL)
+{
+    int nfeatures = db.nfeatures();
+
+    // Normalize and quantize Query
+    array1d<float> query_normalized(nfeatures);
+    database_normalize_query(query_normalized, db, query);
+
+    array1d<short> query_quantized(index.ncols);
+    quantized_index_quantize_query(query_quantized, index, query_normalized);
+
+    int curr_index = best_index;
+
+    // Find candidates
+    candidate_heap_clear(candidates);
+
+    motion_matching_search_quantized(
+        candidates,
+        curr_index,
+        index,
+        db.range_starts,
+        db.range_stops,
+        query_quantized,
+        transition_cost / (index.step * index.step),
+        ignore_range_end,
+        ignore_surrounding,
+        level,
+        stats);
+
+    // Find cost for current frame
+    if (curr_index != -1)
+    {
+        best_cost = 0.0f;
+        for (int j = 0; j < nfeatures; j++)
+        {
+            best_cost += squaref(query_normalized(j) - db.features_ordered(curr_index, j));
+        }
+    }
+
+    // Re-rank candidates using the float features
+    candidate_heap_sort(candidates);
+
+    for (int c = 0; c < candidates.size; c++)
+    {
+        int i = candidates.indices(c);
+
+        // Only stop once the cost is strictly larger, so a cost equal
+        // to the best is always the full sum when breaking the tie
+        float curr_cost = transition_cost;
+        for (int j = 0; j < nfeatures; j++)
+        {
+            curr_cost += squaref(query_normalized(j) - db.features_ordered(i, j));
+            if (curr_cost > best_cost)
+            {
+                break;
+            }
+        }
+
+        if (curr_cost < best_cost || (curr_cost == best_cost && i < best_index))
+        {
+            best_index = i;
+            best_cost = curr_cost;
+        }
+    }
+}
+
+//--------------------------------------
+
+// Compare the quantized index to the float search, printing the
+// memory used, how often the same frame is found, and the time taken
+// for a few different numbers of re-ranked candidates
+void database_benchmark_quantized(
+    const database& db,
+    const quantized_index& index,
+    const int nqueries = 1000,
+    FILE* out = stdout)
+{
+    const int reranks[] = { 1, 4, 8, 16, 32 };
+    int nreranks = sizeof(reranks) / sizeof(reranks[0]);
+
+    array2d<float> queries(nqueries, db.nfeatures());
+    array1d<int> starts(nqueries);
+    database_random_queries(queries, starts, db);
+
+    size_t memory_float = quantized_index_memory_replaced(db);
+    size_t memory_quantized = quantized_index_memory(index);
+
+    fprintf(out, "features and bounds: float %.1f kb, quantized %.1f kb, saved %.1f kb (%.0f%%)\n",
+        memory_float / 1024.0, memory_quantized / 1024.0, (memory_float - memory_quantized) / 1024.0,
+        100.0 * (memory_float - memory_quantized) / memory_float);
+
+    // Exact results to compare against
+    array1d<int> exact_indices(nqueries);
+    array1d<float> exact_costs(nqueries);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int q = 0; q < nqueries; q++)
+    {
+        exact_indices(q) = starts(q);
+        exact_costs(q) = FLT_MAX;
+        database_search(exact_indices(q), exact_costs(q), db, queries(q));
+    }
+
+    auto stop_time = std::chrono::high_resolution_clock::now();
+
+    fprintf(out, "%-10s %12s %14s %12s\n", "rerank", "match (%)", "cost ratio", "us/search");
+    fprintf(out, "%-10s %12.1f %14.4f %12.1f\n", "float", 100.0, 1.0,
+        std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+
+    for (int k = 0; k < nreranks; k++)
+    {
+        candidate_heap candidates;
+        candidate_heap_init(candidates, reranks[k]);
+
+        int matches = 0;
+        double ratio = 0.0;
+
+        start_time = std::chrono::high_resolution_clock::now();
+
+        for (int q = 0; q < nqueries; q++)
+        {
+            int best_index = starts(q);
+            float best_cost = FLT_MAX;
+            database_search_quantized(best_index, best_cost, candidates, db, index, queries(q));
+
+            matches += best_index == exact_indices(q);
+            ratio += exact_costs(q) > 0.0f ? best_cost / exact_costs(q) : 1.0;
+        }
+
+        stop_time = std::chrono::high_resolution_clock::now();
+
+        char name[16];
+        snprintf(name, sizeof(name), "%d", reranks[k]);
+        fprintf(out, "%-10s %12.1f %14.4f %12.1f\n", name, 100.0 * matches / nqueries, ratio / nqueries,
+            std::chrono::duration<double, std::micro>(stop_time - start_time).count() / nqueries);
+    }
+}
@@ -0,0 +1,820 @@
+// Builds lafan01/database.bin from the LAFAN1 BVH files. This does the
+// same processing as lafan01/generate_database.py, but processes every
+// clip on its own thread and doesn't need numpy or scipy.
+//
+//     generate_database [bvh directory] [output file]
+//
+// By default it reads and writes ./lafan01/ like controller.cpp.
+
+#if !defined(_restrict)
+#define _restrict __restrict
+#endif
+
+#include "common.h"
+#include "vec.h"
+#include "quat.h"
+#include "array.h"
+#include "bvh.h"
+#include "character.h"
+#include "database.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+//--------------------------------------
+
+// Files to process, start and stop frames and tags
+struct database_source
+{
+    const char* filename;
+    int start;
+    int stop;
+    unsigned int tags;
+};
+
+static const database_source database_sources[] =
+{
+    // We just use a small section of this clip for the standing idle
+    { "pushAndStumble1_subject5.bvh", 194,  351, DATABASE_TAG_IDLE },
+    // Running
+    { "run1_subject5.bvh",             90, 7086, DATABASE_TAG_RUN },
+    // Walking
+    { "walk1_subject5.bvh",            80, 7791, DATABASE_TAG_WALK },
+};
+
+enum
+{
+    DATABASE_SOURCES_COUNT = sizeof(database_sources) / sizeof(database_sources[0]),
+};
+
+//--------------------------------------
+
+static inline quat quat_from_euler(vec3 e, const char* order)
+{
+    float angles[3] = { e.x, e.y, e.z };
+    quat q[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        vec3 axis = order[i] == 'x' ? vec3(1, 0, 0) : order[i] == 'y' ? vec3(0, 1, 0) : vec3(0, 0, 1);
+        q[i] = quat_from_angle_axis(angles[i], axis);
+    }
+
+    return quat_mul(q[0], quat_mul(q[1], q[2]));
+}
+
+// quat.py inverts by conjugating while quat_inv also negates. Both are
+// the same rotation, but conjugating keeps the signs of the output the
+// same as generate_database.py
+static inline quat quat_conjugate(quat q)
+{
+    return quat(q.w, -q.x, -q.y, -q.z);
+}
+
+// Same as quat_to_scaled_angle_axis but using atan2 like quat.py,
+// which stays accurate for the small rotations between frames
+static inline vec3 quat_to_scaled_angle_axis_atan2(quat q, float eps=1e-5f)
+{
+    float length = sqrtf(q.x*q.x + q.y*q.y + q.z*q.z);
+    float halfangle = length < eps ? 1.0f : atan2f(length, q.w) / length;
+    return 2.0f * halfangle * vec3(q.x, q.y, q.z);
+}
+
+static inline void quat_to_xform(float m[3][3], quat q)
+{
+    float x2 = q.x + q.x, y2 = q.y + q.y, z2 = q.z + q.z;
+    float xx = q.x * x2, yy = q.y * y2, wx = q.w * x2;
+    float xy = q.x * y2, yz = q.y * z2, wy = q.w * y2;
+    float xz = q.x * z2, zz = q.z * z2, wz = q.w * z2;
+
+    m[0][0] = 1.0f - (yy + zz); m[0][1] = xy - wz; m[0][2] = xz + wy;
+    m[1][0] = xy + wz; m[1][1] = 1.0f - (xx + zz); m[1][2] = yz - wx;
+    m[2][0] = xz - wy; m[2][1] = yz + wx; m[2][2] = 1.0f - (xx + yy);
+}
+
+static inline quat quat_from_xform(const float m[3][3], const float eps=1e-10f)
+{
+    float t = m[0][0] + m[1][1] + m[2][2];
+
+    if (t > 0.0f)
+    {
+        float s = 0.5f / sqrtf(maxf(t + 1.0f, eps));
+        return quat(0.25f / s, s * (m[2][1] - m[1][2]), s * (m[0][2] - m[2][0]), s * (m[1][0] - m[0][1]));
+    }
+    else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+    {
+        float s = 2.0f * sqrtf(maxf(1.0f + m[0][0] - m[1][1] - m[2][2], eps));
+        return quat((m[2][1] - m[1][2]) / s, s * 0.25f, (m[0][1] + m[1][0]) / s, (m[0][2] + m[2][0]) / s);
+    }
+    else if (m[1][1] > m[2][2])
+    {
+        float s = 2.0f * sqrtf(maxf(1.0f + m[1][1] - m[0][0] - m[2][2], eps));
+        return quat((m[0][2] - m[2][0]) / s, (m[0][1] + m[1][0]) / s, s * 0.25f, (m[1][2] + m[2][1]) / s);
+    }
+    else
+    {
+        float s = 2.0f * sqrtf(maxf(1.0f + m[2][2] - m[0][0] - m[1][1], eps));
+        return quat((m[1][0] - m[0][1]) / s, (m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s, s * 0.25f);
+    }
+}
+
+// Flip quaternions so each is in the same hemisphere as
+// the one in the previous frame
+void quat_unroll(array2d<quat>& rotations)
+{
+    for (int i = 1; i < rotations.rows; i++)
+    {
+        for (int j = 0; j < rotations.cols; j++)
+        {
+            if (quat_dot(rotations(i, j), rotations(i - 1, j)) < 0.0f)
+            {
+                rotations(i, j) = -rotations(i, j);
+            }
+        }
+    }
+}
+
+//--------------------------------------
+
+// Basic function for mirroring animation data with this particular skeleton structure
+/*
+    rotations [in/out] : [Frames, Bones]，局部旋转，替换为镜像后的结果
+    positions [in/out] : [Frames, Bones]，局部位置，替换为镜像后的结果
+    data      [in]     : 提供bone的名字和父bone，Left和Right开头的bone互为镜像
+*/
+bool animation_mirror(
+    array2d<quat>& rotations,
+    array2d<vec3>& positions,
+    const bvh& data)
+{
+    int nbones = data.nbones();
+
+    array1d<int> joints_mirror(nbones);
+    for (int j = 0; j < nbones; j++)
+    {
+        const std::string& name = data.names[j];
+
+        joints_mirror(j) =
+            name.compare(0, 5, "Right") == 0 ? data.bone_index(("Left" + name.substr(5)).c_str()) :
+            name.compare(0, 4, "Left") == 0 ? data.bone_index(("Right" + name.substr(4)).c_str()) : j;
+
+        if (joints_mirror(j) == -1)
+        {
+            fprintf(stderr, "No mirrored bone for \"%s\"\n", name.c_str());
+            return false;
+        }
+    }
+
+    const float mirror_rot[3][3] = { { -1, -1, 1 }, { 1, 1, -1 }, { 1, 1, -1 } };
+
+    array1d<vec3> global_positions(nbones);
+    array1d<quat> global_rotations(nbones);
+    array1d<vec3> mirror_positions(nbones);
+    array1d<quat> mirror_rotations(nbones);
+
+    for (int i = 0; i < rotations.rows; i++)
+    {
+        forward_kinematics_full(global_positions, global_rotations, positions(i), rotations(i), data.parents);
+
+        for (int j = 0; j < nbones; j++)
+        {
+            vec3 position = global_positions(joints_mirror(j));
+            mirror_positions(j) = vec3(-position.x, position.y, position.z);
+
+            float xform[3][3];
+            quat_to_xform(xform, global_rotations(joints_mirror(j)));
+            for (int r = 0; r < 3; r++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    xform[r][c] *= mirror_rot[r][c];
+                }
+            }
+            mirror_rotations(j) = quat_from_xform(xform);
+        }
+
+        // Back to local space
+        for (int j = 0; j < nbones; j++)
+        {
+            int parent = data.parents(j);
+
+            if (parent == -1)
+            {
+                positions(i, j) = mirror_positions(j);
+                rotations(i, j) = mirror_rotations(j);
+            }
+            else
+            {
+                positions(i, j) = quat_inv_mul_vec3(mirror_rotations(parent), mirror_positions(j) - mirror_positions(parent));
+                rotations(i, j) = quat_mul(quat_conjugate(mirror_rotations(parent)), mirror_rotations(j));
+            }
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------
+
+// Resample `nchannels` signals of `nframes` frames at `nsamples` evenly spaced
+// times from the first to the last frame with a not-a-knot cubic spline, which
+// is what scipy's griddata(method='cubic') does with 1d data
+void cubic_spline_resample(
+    float* out,
+    const int nsamples,
+    const float* in,
+    const int nframes,
+    const int nchannels)
+{
+    assert(nframes >= 4 && nsamples >= 2);
+
+    int n = nframes;
+    std::vector<double> y(n);
+    std::vector<double> m(n);
+    std::vector<double> cp(n);
+    std::vector<double> dp(n);
+
+    double step = (double)(n - 1) / (nsamples - 1);
+
+    for (int ch = 0; ch < nchannels; ch++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            y[i] = in[i * nchannels + ch];
+        }
+
+        // Second derivatives. With unit spacing the spline satisfies
+        // m[i-1] + 4 m[i] + m[i+1] = 6 (y[i+1] - 2 y[i] + y[i-1]), and the
+        // not-a-knot conditions m[0] - 2 m[1] + m[2] = 0 (and the same at the
+        // end) turn the first and last equations into 6 m[1] = ..., leaving
+        // a tridiagonal system for the frames in between
+        m[1] = y[2] - 2.0 * y[1] + y[0];
+        m[n - 2] = y[n - 1] - 2.0 * y[n - 2] + y[n - 3];
+
+        for (int i = 2; i <= n - 3; i++)
+        {
+            double d = 6.0 * (y[i + 1] - 2.0 * y[i] + y[i - 1]);
+            if (i == 2) { d -= m[1]; }
+            if (i == n - 3) { d -= m[n - 2]; }
+
+            double denom = i == 2 ? 4.0 : 4.0 - cp[i - 1];
+            cp[i] = 1.0 / denom;
+            dp[i] = (i == 2 ? d : d - dp[i - 1]) / denom;
+        }
+
+        for (int i = n - 3; i >= 2; i--)
+        {
+            m[i] = i == n - 3 ? dp[i] : dp[i] - cp[i] * m[i + 1];
+        }
+
+        m[0] = 2.0 * m[1] - m[2];
+        m[n - 1] = 2.0 * m[n - 2] - m[n - 3];
+
+        for (int k = 0; k < nsamples; k++)
+        {
+            double t = k == nsamples - 1 ? (double)(n - 1) : k * step;
+            int j = clamp((int)t, 0, n - 2);
+            double a = t - j;
+            double b = 1.0 - a;
+
+            out[k * nchannels + ch] = (float)(
+                b * y[j] + a * y[j + 1] +
+                ((b * b * b - b) * m[j] + (a * a * a - a) * m[j + 1]) / 6.0);
+        }
+    }
+}
+
+// Smooth with a Savitzky-Golay filter fitting a cubic over `window` frames,
+// the same as scipy's savgol_filter(x, window, 3, mode='interp') where frames
+// within half a window of either end use the fit of the first or last window
+void savgol_filter(
+    slice1d<vec3> out,
+    const slice1d<vec3> in,
+    const int window)
+{
+    enum { ORDER = 3, NCOEFS = ORDER + 1 };
+
+    int n = in.size;
+    int half = window / 2;
+    assert(window % 2 == 1 && n >= window && out.size == n);
+
+    // Normal equations of the least squares fit, over the window
+    // position scaled to [-1, 1] so they are well conditioned
+    std::vector<double> u(window);
+    double normal[NCOEFS][2 * NCOEFS] = {};
+
+    for (int k = 0; k < window; k++)
+    {
+        u[k] = (double)(k - half) / half;
+
+        for (int a = 0; a < NCOEFS; a++)
+        {
+            for (int b = 0; b < NCOEFS; b++)
+            {
+                normal[a][b] += pow(u[k], a + b);
+            }
+        }
+    }
+
+    // Invert with Gauss-Jordan elimination
+    for (int a = 0; a < NCOEFS; a++)
+    {
+        normal[a][NCOEFS + a] = 1.0;
+    }
+
+    for (int a = 0; a < NCOEFS; a++)
+    {
+        int pivot = a;
+        for (int b = a + 1; b < NCOEFS; b++)
+        {
+            if (fabs(normal[b][a]) > fabs(normal[pivot][a])) { pivot = b; }
+        }
+
+        for (int c = 0; c < 2 * NCOEFS; c++)
+        {
+            double tmp = normal[a][c];
+            normal[a][c] = normal[pivot][c];
+            normal[pivot][c] = tmp;
+        }
+
+        double scale = 1.0 / normal[a][a];
+        for (int c = 0; c < 2 * NCOEFS; c++)
+        {
+            normal[a][c] *= scale;
+        }
+
+        for (int b = 0; b < NCOEFS; b++)
+        {
+            if (b == a) { continue; }
+
+            double factor = normal[b][a];
+            for (int c = 0; c < 2 * NCOEFS; c++)
+            {
+                normal[b][c] -= factor * normal[a][c];
+            }
+        }
+    }
+
+    // Weight of each frame in the window for the fit evaluated at each position
+    std::vector<double> weights(window * window);
+
+    for (int p = 0; p < window; p++)
+    {
+        for (int k = 0; k < window; k++)
+        {
+            double w = 0.0;
+            for (int a = 0; a < NCOEFS; a++)
+            {
+                for (int b = 0; b < NCOEFS; b++)
+                {
+                    w += pow(u[p], a) * normal[a][NCOEFS + b] * pow(u[k], b);
+                }
+            }
+            weights[p * window + k] = w;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int p = i < half ? i : i >= n - half ? i - (n - window) : half;
+        int base = i - p;
+
+        double x = 0.0, y = 0.0, z = 0.0;
+        for (int k = 0; k < window; k++)
+        {
+            double w = weights[p * window + k];
+            x += w * in(base + k).x;
+            y += w * in(base + k).y;
+            z += w * in(base + k).z;
+        }
+
+        out(i) = vec3((float)x, (float)y, (float)z);
+    }
+}
+
+// Median filter of boolean data as in scipy's median_filter(x, size, mode='nearest'),
+// which acts as a majority vote removing short runs of either value
+void median_filter(
+    slice1d<bool> out,
+    const slice1d<bool> in,
+    const int size)
+{
+    int n = in.size;
+
+    for (int i = 0; i < n; i++)
+    {
+        int count = 0;
+        for (int k = 0; k < size; k++)
+        {
+            count += in(clamp(i - size / 2 + k, 0, n - 1)) ? 1 : 0;
+        }
+
+        out(i) = count >= size - size / 2;
+    }
+}
+
+//--------------------------------------
+
+// A single clip processed into the layout of the database
+struct database_clip
+{
+    array2d<vec3> bone_positions;
+    array2d<vec3> bone_velocities;
+    array2d<quat> bone_rotations;
+    array2d<vec3> bone_angular_velocities;
+    array2d<bool> contact_states;
+    unsigned int tags;
+};
+
+// Process frames [start, stop) of a BVH file as generate_database.py does:
+// supersample to 60 fps while speeding up by 10%, extract the simulation bone,
+// compute velocities and detect foot contacts
+/*
+    clip        [out] : 处理结果，bone 0为simulation bone
+    data        [in]  : 读取的BVH文件
+    bone_parents[in]  : 加上simulation bone后的父bone
+    start/stop  [in]  : 使用的帧范围
+    tags        [in]  : 帧的tag，镜像时再加上DATABASE_TAG_MIRRORED
+    mirror      [in]  : 是否镜像
+*/
+bool database_clip_build(
+    database_clip& clip,
+    const bvh& data,
+    const slice1d<int> bone_parents,
+    const int start,
+    const int stop,
+    const unsigned int tags,
+    const bool mirror)
+{
+    int sim_position_joint = data.bone_index("Spine2");
+    int sim_rotation_joint = data.bone_index("Hips");
+    int contact_joints[2] = { data.bone_index("LeftToe") + 1, data.bone_index("RightToe") + 1 };
+
+    if (sim_position_joint == -1 || sim_rotation_joint == -1 || contact_joints[0] == 0 || contact_joints[1] == 0)
+    {
+        fprintf(stderr, "Missing Spine2, Hips, LeftToe or RightToe bone\n");
+        return false;
+    }
+
+    int first = clamp(start, 0, data.nframes());
+    int nframes = clamp(stop, first, data.nframes()) - first;
+    int nbones = data.nbones();
+
+    // Load data, converting from cm to m
+
+    array2d<vec3> positions(nframes, nbones);
+    array2d<quat> rotations(nframes, nbones);
+
+    for (int i = 0; i < nframes; i++)
+    {
+        for (int j = 0; j < nbones; j++)
+        {
+            positions(i, j) = data.positions(first + i, j) * 0.01f;
+            rotations(i, j) = quat_from_euler(data.rotations(first + i, j) * (PIf / 180.0f), data.order);
+        }
+    }
+
+    quat_unroll(rotations);
+
+    if (mirror)
+    {
+        if (!animation_mirror(rotations, positions, data)) { return false; }
+        quat_unroll(rotations);
+    }
+
+    // Supersample to 60 fps while speeding up by 10%
+
+    if (nframes < 4 || (int)(0.9 * (nframes * 2 - 1)) < 61)
+    {
+        fprintf(stderr, "Not enough frames\n");
+        return false;
+    }
+
+    int nsamples = (int)(0.9 * (nframes * 2 - 1));
+
+    array2d<vec3> sampled_positions(nsamples, nbones);
+    array2d<quat> sampled_rotations(nsamples, nbones);
+
+    cubic_spline_resample((float*)sampled_positions.data, nsamples, (const float*)positions.data, nframes, nbones * 3);
+    cubic_spline_resample((float*)sampled_rotations.data, nsamples, (const float*)rotations.data, nframes, nbones * 4);
+
+    for (int i = 0; i < nsamples; i++)
+    {
+        for (int j = 0; j < nbones; j++)
+        {
+            sampled_rotations(i, j) = quat_normalize(sampled_rotations(i, j));
+        }
+    }
+
+    // Extract simulation bone, with position coming from the spine joint
+    // and direction from the projected hip forward direction
+
+    array1d<vec3> global_positions(nbones);
+    array1d<quat> global_rotations(nbones);
+    array1d<vec3> sim_positions(nsamples);
+    array1d<vec3> sim_directions(nsamples);
+    array1d<vec3> smoothed(nsamples);
+
+    for (int i = 0; i < nsamples; i++)
+    {
+        forward_kinematics_full(global_positions, global_rotations, sampled_positions(i), sampled_rotations(i), data.parents);
+
+        vec3 position = global_positions(sim_position_joint);
+        vec3 direction = quat_mul_vec3(global_rotations(sim_rotation_joint), vec3(0, 1, 0));
+
+        sim_positions(i) = vec3(position.x, 0.0f, position.z);
+        sim_directions(i) = vec3(direction.x, 0.0f, direction.z) / length(vec3(direction.x, 0.0f, direction.z));
+    }
+
+    savgol_filter(smoothed, sim_positions, 31);
+    sim_positions = smoothed;
+
+    savgol_filter(smoothed, sim_directions, 61);
+    for (int i = 0; i < nsamples; i++)
+    {
+        sim_directions(i) = smoothed(i) / length(smoothed(i));
+    }
+
+    // Transform first joints to be local to sim and append sim as root bone
+
+    clip.bone_positions.resize(nsamples, nbones + 1);
+    clip.bone_rotations.resize(nsamples, nbones + 1);
+
+    for (int i = 0; i < nsamples; i++)
+    {
+        quat sim_rotation = quat_between(vec3(0, 0, 1), sim_directions(i));
+
+        clip.bone_positions(i, 0) = sim_positions(i);
+        clip.bone_rotations(i, 0) = sim_rotation;
+        clip.bone_positions(i, 1) = quat_inv_mul_vec3(sim_rotation, sampled_positions(i, 0) - sim_positions(i));
+        clip.bone_rotations(i, 1) = quat_mul(quat_conjugate(sim_rotation), sampled_rotations(i, 0));
+
+        for (int j = 1; j < nbones; j++)
+        {
+            clip.bone_positions(i, j + 1) = sampled_positions(i, j);
+            clip.bone_rotations(i, j + 1) = sampled_rotations(i, j);
+        }
+    }
+
+    // Compute velocities via central difference
+
+    int n = nsamples;
+
+    clip.bone_velocities.resize(n, nbones + 1);
+    clip.bone_angular_velocities.resize(n, nbones + 1);
+
+    for (int j = 0; j < nbones + 1; j++)
+    {
+        for (int i = 1; i < n - 1; i++)
+        {
+            clip.bone_velocities(i, j) =
+                0.5f * (clip.bone_positions(i + 1, j) - clip.bone_positions(i, j)) * 60.0f +
+                0.5f * (clip.bone_positions(i, j) - clip.bone_positions(i - 1, j)) * 60.0f;
+
+            clip.bone_angular_velocities(i, j) =
+                0.5f * quat_to_scaled_angle_axis_atan2(quat_abs(quat_mul_inv(clip.bone_rotations(i + 1, j), clip.bone_rotations(i, j)))) * 60.0f +
+                0.5f * quat_to_scaled_angle_axis_atan2(quat_abs(quat_mul_inv(clip.bone_rotations(i, j), clip.bone_rotations(i - 1, j)))) * 60.0f;
+        }
+
+        clip.bone_velocities(0, j) = clip.bone_velocities(1, j) - (clip.bone_velocities(3, j) - clip.bone_velocities(2, j));
+        clip.bone_velocities(n - 1, j) = clip.bone_velocities(n - 2, j) + (clip.bone_velocities(n - 2, j) - clip.bone_velocities(n - 3, j));
+
+        clip.bone_angular_velocities(0, j) = clip.bone_angular_velocities(1, j) - (clip.bone_angular_velocities(3, j) - clip.bone_angular_velocities(2, j));
+        clip.bone_angular_velocities(n - 1, j) = clip.bone_angular_velocities(n - 2, j) + (clip.bone_angular_velocities(n - 2, j) - clip.bone_angular_velocities(n - 3, j));
+    }
+
+    // Contacts are given for when contact bones are below velocity threshold.
+    // The world space velocities are accumulated as in quat.fk_vel, where the
+    // angular velocity of the parent is not rotated a second time.
+
+    const float contact_velocity_threshold = 0.15f;
+
+    array1d<vec3> global_velocities(nbones + 1);
+    array1d<vec3> global_angular_velocities(nbones + 1);
+    global_positions.resize(nbones + 1);
+    global_rotations.resize(nbones + 1);
+
+    array1d<bool> contacts(n);
+    array1d<bool> filtered(n);
+
+    clip.contact_states.resize(n, 2);
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < nbones + 1; j++)
+        {
+            int parent = bone_parents(j);
+
+            if (parent == -1)
+            {
+                global_positions(j) = clip.bone_positions(i, j);
+                global_rotations(j) = clip.bone_rotations(i, j);
+                global_velocities(j) = clip.bone_velocities(i, j);
+                global_angular_velocities(j) = clip.bone_angular_velocities(i, j);
+            }
+            else
+            {
+                vec3 offset = quat_mul_vec3(global_rotations(parent), clip.bone_positions(i, j));
+
+                global_positions(j) = offset + global_positions(parent);
+                global_rotations(j) = quat_mul(global_rotations(parent), clip.bone_rotations(i, j));
+                global_velocities(j) =
+                    quat_mul_vec3(global_rotations(parent), clip.bone_velocities(i, j)) +
+                    cross(global_angular_velocities(parent), offset) +
+                    global_velocities(parent);
+                global_angular_velocities(j) =
+                    quat_mul_vec3(global_rotations(parent), clip.bone_angular_velocities(i, j)) +
+                    global_angular_velocities(parent);
+            }
+        }
+
+        for (int c = 0; c < 2; c++)
+        {
+            clip.contact_states(i, c) = length(global_velocities(contact_joints[c])) < contact_velocity_threshold;
+        }
+    }
+
+    // Median filter here acts as a kind of "majority vote", and removes
+    // small regions where contact is either active or inactive
+    for (int c = 0; c < 2; c++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            contacts(i) = clip.contact_states(i, c);
+        }
+
+        median_filter(filtered, contacts, 6);
+
+        for (int i = 0; i < n; i++)
+        {
+            clip.contact_states(i, c) = filtered(i);
+        }
+    }
+
+    clip.tags = tags | (mirror ? DATABASE_TAG_MIRRORED : 0);
+
+    return true;
+}
+
+//--------------------------------------
+
+int main(int argc, char** argv)
+{
+    std::string directory = argc > 1 ? argv[1] : "./lafan01/";
+    const char* output = argc > 2 ? argv[2] : "./lafan01/database.bin";
+
+    if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+    {
+        directory += '/';
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // Load every file on its own thread
+
+    bvh sources[DATABASE_SOURCES_COUNT];
+    bool loaded[DATABASE_SOURCES_COUNT];
+    std::vector<std::thread> threads;
+
+    for (int s = 0; s < DATABASE_SOURCES_COUNT; s++)
+    {
+        printf("Loading \"%s\"...\n", database_sources[s].filename);
+
+        threads.emplace_back([&, s]
+        {
+            loaded[s] = bvh_load(sources[s], (directory + database_sources[s].filename).c_str());
+        });
+    }
+
+    for (std::thread& thread : threads) { thread.join(); }
+    threads.clear();
+
+    for (int s = 0; s < DATABASE_SOURCES_COUNT; s++)
+    {
+        if (!loaded[s])
+        {
+            fprintf(stderr, "Failed to load \"%s%s\"\n", directory.c_str(), database_sources[s].filename);
+            return 1;
+        }
+
+        if (sources[s].names != sources[0].names)
+        {
+            fprintf(stderr, "Skeleton of \"%s\" differs from \"%s\"\n", database_sources[s].filename, database_sources[0].filename);
+            return 1;
+        }
+    }
+
+    // The simulation bone is added as the root
+
+    int nbones = sources[0].nbones() + 1;
+
+    array1d<int> bone_parents(nbones);
+    bone_parents(0) = -1;
+    for (int j = 1; j < nbones; j++)
+    {
+        bone_parents(j) = sources[0].parents(j - 1) + 1;
+    }
+
+    // Process each file mirrored and not mirrored, every clip on its own thread
+
+    enum { NCLIPS = DATABASE_SOURCES_COUNT * 2 };
+
+    database_clip clips[NCLIPS];
+    bool built[NCLIPS];
+
+    for (int c = 0; c < NCLIPS; c++)
+    {
+        threads.emplace_back([&, c]
+        {
+            const database_source& source = database_sources[c / 2];
+            built[c] = database_clip_build(clips[c], sources[c / 2], bone_parents, source.start, source.stop, source.tags, c % 2 == 1);
+        });
+    }
+
+    for (std::thread& thread : threads) { thread.join(); }
+    threads.clear();
+
+    for (int c = 0; c < NCLIPS; c++)
+    {
+        if (!built[c])
+        {
+            fprintf(stderr, "Failed to process \"%s\" %s\n", database_sources[c / 2].filename, c % 2 ? "(Mirrored)" : "");
+            return 1;
+        }
+    }
+
+    // Concatenate data
+
+    int nframes = 0;
+    for (int c = 0; c < NCLIPS; c++)
+    {
+        nframes += clips[c].bone_positions.rows;
+    }
+
+    array2d<vec3> bone_positions(nframes, nbones);
+    array2d<vec3> bone_velocities(nframes, nbones);
+    array2d<quat> bone_rotations(nframes, nbones);
+    array2d<vec3> bone_angular_velocities(nframes, nbones);
+    array1d<int> range_starts(NCLIPS);
+    array1d<int> range_stops(NCLIPS);
+    array2d<bool> contact_states(nframes, 2);
+    array1d<unsigned int> frame_tags(nframes);
+
+    int offset = 0;
+    for (int c = 0; c < NCLIPS; c++)
+    {
+        const database_clip& clip = clips[c];
+        int n = clip.bone_positions.rows;
+
+        memcpy(&bone_positions(offset, 0), clip.bone_positions.data, sizeof(vec3) * n * nbones);
+        memcpy(&bone_velocities(offset, 0), clip.bone_velocities.data, sizeof(vec3) * n * nbones);
+        memcpy(&bone_rotations(offset, 0), clip.bone_rotations.data, sizeof(quat) * n * nbones);
+        memcpy(&bone_angular_velocities(offset, 0), clip.bone_angular_velocities.data, sizeof(vec3) * n * nbones);
+        memcpy(&contact_states(offset, 0), clip.contact_states.data, sizeof(bool) * n * 2);
+
+        for (int i = 0; i < n; i++)
+        {
+            frame_tags(offset + i) = clip.tags;
+        }
+
+        range_starts(c) = offset;
+        range_stops(c) = offset + n;
+        offset += n;
+    }
+
+    // Write database, in the layout read by database_load
+
+    printf("Writing Database...\n");
+
+    FILE* f = fopen(output, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Failed to open \"%s\" for writing\n", output);
+        return 1;
+    }
+
+    array2d_write(bone_positions, f);
+    array2d_write(bone_velocities, f);
+    array2d_write(bone_rotations, f);
+    array2d_write(bone_angular_velocities, f);
+    array1d_write(bone_parents, f);
+
+    array1d_write(range_starts, f);
+    array1d_write(range_stops, f);
+
+    array2d_write(contact_states, f);
+
+    array1d_write(frame_tags, f);
+
+    fclose(f);
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+
+    printf("Wrote %i frames of %i bones in %i ranges to \"%s\" in %.1f ms\n",
+        nframes, nbones, NCLIPS, output,
+        std::chrono::duration<double, std::milli>(end_time - start_time).count());
+
+    return 0;
+}
@@ -0,0 +1,552 @@
+#pragma once
+
+#include "common.h"
+
+#include <assert.h>
+#include <float.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+// GCC and Clang need to be told which functions may use
+// instructions beyond the base target. MSVC lets any function
+// use any intrinsic so there these expand to nothing.
+#if SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#else
+#define SIMD_TARGET_SSE4
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX2_F16C
+#endif
+
+//--------------------------------------
+
+enum simd_level
+{
+    SIMD_LEVEL_SCALAR = 0,
+    SIMD_LEVEL_SSE4   = 1,
+    SIMD_LEVEL_AVX2   = 2,
+};
+
+static inline const char* simd_level_name(const simd_level level)
+{
+    switch (level)
+    {
+        case SIMD_LEVEL_AVX2: return "avx2";
+        case SIMD_LEVEL_SSE4: return "sse4";
+        default: return "scalar";
+    }
+}
+
+// Find the widest instruction set the CPU (and OS, in the
+// case of the AVX registers) supports. This only needs to
+// be done once so the result is cached.
+static inline simd_level simd_level_detect_uncached()
+{
+#if SIMD_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int nids = info[0];
+
+    if (nids < 1) { return SIMD_LEVEL_SCALAR; }
+
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    bool avx2 = false;
+    if (nids >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    return avx2 ? SIMD_LEVEL_AVX2 : sse41 ? SIMD_LEVEL_SSE4 : SIMD_LEVEL_SCALAR;
+#elif SIMD_X86
+    __builtin_cpu_init();
+    return
+        __builtin_cpu_supports("avx2") ? SIMD_LEVEL_AVX2 :
+        __builtin_cpu_supports("sse4.1") ? SIMD_LEVEL_SSE4 : SIMD_LEVEL_SCALAR;
+#else
+    return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+static inline simd_level simd_level_detect()
+{
+    static const simd_level level = simd_level_detect_uncached();
+    return level;
+}
+
+//--------------------------------------
+
+// Compute the cost of a block of `lanes` frames stored transposed
+// so that `block[j * lanes + l]` is feature `j` of frame `l`. The
+// cost of each frame is accumulated in exactly the same order as
+// the scalar search (transition cost first, then each dimension
+// in turn) so the resulting costs are bit-identical. Once every
+// frame in the block has reached `best_cost` we stop early, since
+// none of them can be selected anymore.
+static inline void frame_costs_block_scalar(
+    float* costs,
+    const float* block,
+    const float* query,
+    const int lanes,
+    const int nfeatures,
+    const float transition_cost,
+    const float best_cost)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        costs[l] = transition_cost;
+    }
+
+    for (int j = 0; j < nfeatures; j++)
+    {
+        bool any_below = false;
+        for (int l = 0; l < lanes; l++)
+        {
+            costs[l] += squaref(query[j] - block[j * lanes + l]);
+            any_below |= costs[l] < best_cost;
+        }
+
+        if (!any_below) { break; }
+    }
+}
+
+#if SIMD_X86
+
+SIMD_TARGET_SSE4
+static inline void frame_costs_block_sse4(
+    float* costs,
+    const float* block,
+    const float* query,
+    const int lanes,
+    const int nfeatures,
+    const float transition_cost,
+    const float best_cost)
+{
+    assert(lanes % 4 == 0 && lanes <= 16);
+
+    const int nregs = lanes / 4;
+    const __m128 best = _mm_set1_ps(best_cost);
+    __m128 acc[4];
+    for (int r = 0; r < nregs; r++)
+    {
+        acc[r] = _mm_set1_ps(transition_cost);
+    }
+
+    for (int j = 0; j < nfeatures; j++)
+    {
+        const __m128 q = _mm_set1_ps(query[j]);
+        int below = 0;
+        for (int r = 0; r < nregs; r++)
+        {
+            __m128 d = _mm_sub_ps(q, _mm_loadu_ps(block + j * lanes + r * 4));
+            acc[r] = _mm_add_ps(acc[r], _mm_mul_ps(d, d));
+            below |= _mm_movemask_ps(_mm_cmplt_ps(acc[r], best));
+        }
+
+        if (!below) { break; }
+    }
+
+    for (int r = 0; r < nregs; r++)
+    {
+        _mm_storeu_ps(costs + r * 4, acc[r]);
+    }
+}
+
+SIMD_TARGET_AVX2
+static inline void frame_costs_block_avx2(
+    float* costs,
+    const float* block,
+    const float* query,
+    const int lanes,
+    const int nfeatures,
+    const float transition_cost,
+    const float best_cost)
+{
+    assert(lanes % 8 == 0 && lanes <= 16);
+
+    // Multiply and add are kept separate (no FMA) so that
+    // rounding matches the scalar path exactly.
+    const int nregs = lanes / 8;
+    const __m256 best = _mm256_set1_ps(best_cost);
+    __m256 acc[2];
+    for (int r = 0; r < nregs; r++)
+    {
+        acc[r] = _mm256_set1_ps(transition_cost);
+    }
+
+    for (int j = 0; j < nfeatures; j++)
+    {
+        const __m256 q = _mm256_set1_ps(query[j]);
+        int below = 0;
+        for (int r = 0; r < nregs; r++)
+        {
+            __m256 d = _mm256_sub_ps(q, _mm256_loadu_ps(block + j * lanes + r * 8));
+            acc[r] = _mm256_add_ps(acc[r], _mm256_mul_ps(d, d));
+            below |= _mm256_movemask_ps(_mm256_cmp_ps(acc[r], best, _CMP_LT_OQ));
+        }
+
+        if (!below) { break; }
+    }
+
+    for (int r = 0; r < nregs; r++)
+    {
+        _mm256_storeu_ps(costs + r * 8, acc[r]);
+    }
+}
+
+#endif
+
+static inline void frame_costs_block(
+    float* costs,
+    const float* block,
+    const float* query,
+    const int lanes,
+    const int nfeatures,
+    const float transition_cost,
+    const float best_cost,
+    const simd_level level)
+{
+#if SIMD_X86
+    if (level == SIMD_LEVEL_AVX2 && lanes % 8 == 0)
+    {
+        frame_costs_block_avx2(costs, block, query, lanes, nfeatures, transition_cost, best_cost);
+        return;
+    }
+
+    if (level >= SIMD_LEVEL_SSE4 && lanes % 4 == 0)
+    {
+        frame_costs_block_sse4(costs, block, query, lanes, nfeatures, transition_cost, best_cost);
+        return;
+    }
+#endif
+
+    frame_costs_block_scalar(costs, block, query, lanes, nfeatures, transition_cost, best_cost);
+}
+
+//--------------------------------------
+
+// Squared distance from a quantized query to a box of 8-bit
+// features between `bmin` and `bmax`, or to a single frame if
+// both point to the same data. Each difference is scaled by the
+// integer step of that dimension, see quantized_index, so the
+// result is proportional to the float distance. The query is 
+// 16-bit so it can lie outside the range of the data, and must
+// be within [-255, 510] with multipliers of at most 8 so that 
+// the sum of up to 128 dimensions can't overflow.
+static inline unsigned int quantized_box_cost_scalar(
+    const unsigned char* bmin,
+    const unsigned char* bmax,
+    const short* query,
+    const short* multipliers,
+    const int ncols)
+{
+    unsigned int cost = 0;
+    for (int j = 0; j < ncols; j++)
+    {
+        int c = query[j] < bmin[j] ? bmin[j] : query[j] > bmax[j] ? bmax[j] : query[j];
+        int e = (query[j] - c) * multipliers[j];
+        cost += (unsigned int)(e * e);
+    }
+    
+    return cost;
+}
+
+#if SIMD_X86
+
+SIMD_TARGET_SSE4
+static inline unsigned int quantized_box_cost_sse4(
+    const unsigned char* bmin,
+    const unsigned char* bmax,
+    const short* query,
+    const short* multipliers,
+    const int ncols)
+{
+    assert(ncols % 8 == 0);
+    
+    __m128i acc = _mm_setzero_si128();
+    for (int j = 0; j < ncols; j += 8)
+    {
+        __m128i lo = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(bmin + j)));
+        __m128i hi = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(bmax + j)));
+        __m128i q = _mm_loadu_si128((const __m128i*)(query + j));
+        __m128i m = _mm_loadu_si128((const __m128i*)(multipliers + j));
+        __m128i e = _mm_mullo_epi16(_mm_sub_epi16(q, _mm_min_epi16(_mm_max_epi16(q, lo), hi)), m);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(e, e));
+    }
+    
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    return (unsigned int)_mm_cvtsi128_si32(acc);
+}
+
+SIMD_TARGET_AVX2
+static inline unsigned int quantized_box_cost_avx2(
+    const unsigned char* bmin,
+    const unsigned char* bmax,
+    const short* query,
+    const short* multipliers,
+    const int ncols)
+{
+    assert(ncols % 16 == 0);
+    
+    __m256i acc = _mm256_setzero_si256();
+    for (int j = 0; j < ncols; j += 16)
+    {
+        __m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(bmin + j)));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(bmax + j)));
+        __m256i q = _mm256_loadu_si256((const __m256i*)(query + j));
+        __m256i m = _mm256_loadu_si256((const __m256i*)(multipliers + j));
+        __m256i e = _mm256_mullo_epi16(_mm256_sub_epi16(q, _mm256_min_epi16(_mm256_max_epi16(q, lo), hi)), m);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(e, e));
+    }
+    
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return (unsigned int)_mm_cvtsi128_si32(sum);
+}
+
+#endif
+
+static inline unsigned int quantized_box_cost(
+    const unsigned char* bmin,
+    const unsigned char* bmax,
+    const short* query,
+    const short* multipliers,
+    const int ncols,
+    const simd_level level)
+{
+#if SIMD_X86
+    if (level == SIMD_LEVEL_AVX2 && ncols % 16 == 0)
+    {
+        return quantized_box_cost_avx2(bmin, bmax, query, multipliers, ncols);
+    }
+    
+    if (level >= SIMD_LEVEL_SSE4 && ncols % 8 == 0)
+    {
+        return quantized_box_cost_sse4(bmin, bmax, query, multipliers, ncols);
+    }
+#endif
+
+    return quantized_box_cost_scalar(bmin, bmax, query, multipliers, ncols);
+}
+
+//--------------------------------------
+
+// IEEE half precision float stored as its bits
+typedef unsigned short half;
+
+// Convert to the nearest half, rounding ties to even. This is the 
+// same as the F16C conversion but works on any CPU.
+static inline half half_from_float(const float f)
+{
+    const unsigned int f32_infinity = 255u << 23;
+    const unsigned int f16_max = (127u + 16u) << 23;
+    const unsigned int denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    
+    unsigned int x;
+    memcpy(&x, &f, sizeof(float));
+    
+    unsigned int sign = x & 0x80000000u;
+    x ^= sign;
+    
+    unsigned int o;
+    if (x >= f16_max)
+    {
+        // Overflow to infinity, keeping NaN as NaN
+        o = x > f32_infinity ? 0x7E00 : 0x7C00;
+    }
+    else if (x < (113u << 23))
+    {
+        // Denormal, let the FPU do the rounding by adding a magic number
+        float fx, magic;
+        memcpy(&fx, &x, sizeof(float));
+        memcpy(&magic, &denorm_magic, sizeof(float));
+        fx += magic;
+        memcpy(&x, &fx, sizeof(float));
+        o = x - denorm_magic;
+    }
+    else
+    {
+        // Rebias exponent and round mantissa to nearest even
+        unsigned int mantissa_odd = (x >> 13) & 1;
+        x += ((15u - 127u) << 23) + 0xFFF;
+        x += mantissa_odd;
+        o = x >> 13;
+    }
+    
+    return (half)(o | (sign >> 16));
+}
+
+static inline float half_to_float(const half h)
+{
+    const unsigned int shifted_exponent = 0x7C00u << 13;
+    const unsigned int denorm_magic = 113u << 23;
+    
+    unsigned int o = (h & 0x7FFFu) << 13;
+    unsigned int exponent = o & shifted_exponent;
+    o += (127u - 15u) << 23;
+    
+    if (exponent == shifted_exponent)
+    {
+        // Infinity or NaN
+        o += (128u - 16u) << 23;
+    }
+    else if (exponent == 0)
+    {
+        // Zero or denormal, renormalize
+        float fo, magic;
+        o += 1u << 23;
+        memcpy(&fo, &o, sizeof(float));
+        memcpy(&magic, &denorm_magic, sizeof(float));
+        fo -= magic;
+        memcpy(&o, &fo, sizeof(float));
+    }
+    
+    o |= (unsigned int)(h & 0x8000u) << 16;
+    
+    float f;
+    memcpy(&f, &o, sizeof(float));
+    return f;
+}
+
+// Next half towards positive or negative infinity
+static inline half half_next_up(const half h)
+{
+    if (h == 0x8000 || h == 0x0000) { return 0x0001; }
+    return (h & 0x8000) ? (half)(h - 1) : (half)(h + 1);
+}
+
+static inline half half_next_down(const half h)
+{
+    if (h == 0x0000 || h == 0x8000) { return 0x8001; }
+    return (h & 0x8000) ? (half)(h + 1) : (half)(h - 1);
+}
+
+// Largest half not greater than `f`, used for the minimum of boxes
+static inline half half_from_float_down(const float f)
+{
+    half h = half_from_float(f);
+    return half_to_float(h) > f ? half_next_down(h) : h;
+}
+
+// Smallest half not less than `f`, used for the maximum of boxes
+static inline half half_from_float_up(const float f)
+{
+    half h = half_from_float(f);
+    return half_to_float(h) < f ? half_next_up(h) : h;
+}
+
+// Add the squared distance from `query` to a box of half precision
+// features between `bmin` and `bmax` (or a single frame if both are
+// the same) to `cost`. Dimensions are done in groups of eight and we
+// stop early once `best_cost` is reached, writing the number of
+// columns summed to `cols_visited` if given. Each group is summed in
+// the same order on every path so the costs are bit-identical.
+static inline float half_box_cost_scalar(
+    const half* bmin,
+    const half* bmax,
+    const float* query,
+    const int ncols,
+    float cost,
+    const float best_cost,
+    int* cols_visited)
+{
+    assert(ncols % 8 == 0);
+    
+    int j = 0;
+    while (j < ncols)
+    {
+        float d[8];
+        for (int l = 0; l < 8; l++)
+        {
+            d[l] = squaref(query[j + l] - clampf(query[j + l], 
+                half_to_float(bmin[j + l]), half_to_float(bmax[j + l])));
+        }
+        
+        cost += ((d[0] + d[4]) + (d[2] + d[6])) + ((d[1] + d[5]) + (d[3] + d[7]));
+        j += 8;
+        
+        if (cost >= best_cost) { break; }
+    }
+    
+    if (cols_visited) { *cols_visited = j; }
+    
+    return cost;
+}
+
+#if SIMD_X86
+
+// Every CPU with AVX2 also has F16C so this is used for the AVX2 level
+SIMD_TARGET_AVX2_F16C
+static inline float half_box_cost_avx2(
+    const half* bmin,
+    const half* bmax,
+    const float* query,
+    const int ncols,
+    float cost,
+    const float best_cost,
+    int* cols_visited)
+{
+    assert(ncols % 8 == 0);
+    
+    int j = 0;
+    while (j < ncols)
+    {
+        __m256 lo = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(bmin + j)));
+        __m256 hi = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(bmax + j)));
+        __m256 q = _mm256_loadu_ps(query + j);
+        __m256 d = _mm256_sub_ps(q, _mm256_min_ps(_mm256_max_ps(q, lo), hi));
+        d = _mm256_mul_ps(d, d);
+        
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(d), _mm256_extractf128_ps(d, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        
+        cost += _mm_cvtss_f32(s);
+        j += 8;
+        
+        if (cost >= best_cost) { break; }
+    }
+    
+    if (cols_visited) { *cols_visited = j; }
+    
+    return cost;
+}
+
+#endif
+
+static inline float half_box_cost(
+    const half* bmin,
+    const half* bmax,
+    const float* query,
+    const int ncols,
+    const float cost,
+    const float best_cost,
+    const simd_level level,
+    int* cols_visited = NULL)
+{
+#if SIMD_X86
+    if (level == SIMD_LEVEL_AVX2)
+    {
+        return half_box_cost_avx2(bmin, bmax, query, ncols, cost, best_cost, cols_visited);
+    }
+#endif
+
+    return half_box_cost_scalar(bmin, bmax, query, ncols, cost, best_cost, cols_visited);
+}
@@ -80,6 +80,7 @@ project "MotionMatchingDemo"
 		["Source Files"] = {"**.c", "**.cpp"},
 	}
 	files {"%{wks.name}/**.c", "%{wks.name}/**.cpp", "%{wks.name}/**.h"}
+	removefiles {"%{wks.name}/generate_database.cpp"}
 
 	links {"raylib"}
 	
@@ -93,4 +94,28 @@ project "MotionMatchingDemo"
 		libdirs {"bin/%{cfg.buildcfg}"}
 		
 	filter "action:gmake*"
-		links {"pthread", "GL", "m", "dl", "rt", "X11"}
\ No newline at end of file
+		links {"pthread", "GL", "m", "dl", "rt", "X11"}
+
+	filter{}
+
+project "generate_database"
+	kind "ConsoleApp"
+	location "%{wks.name}"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	cppdialect "C++17"
+	
+	vpaths 
+	{
+		["Header Files"] = { "**.h"},
+		["Source Files"] = {"**.cpp"},
+	}
+	files {"%{wks.name}/generate_database.cpp", "%{wks.name}/**.h"}
+	
+	includedirs { "%{wks.name}" }
+	
+	filter "action:vs*"
+		defines{"_CRT_SECURE_NO_WARNINGS"}
+		
+	filter "action:gmake*"
+		links {"pthread"}
\ No newline at end of file